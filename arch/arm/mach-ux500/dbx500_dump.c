@@ -12,6 +12,7 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/kdebug.h>
+#include <linux/apanic.h>
 
 #include <mach/hardware.h>
 #include <mach/db8500-regs.h>
@@ -23,6 +24,7 @@ struct dbx500_dump_info {
 	int *io_addr;
 	int phy_addr;
 	int size;
+	struct apanic_region region;
 };
 
 static struct dbx500_dump_info db8500_dump[] = {
@@ -218,6 +220,19 @@ int __init dbx500_dump_init(void)
 			err);
 		goto free_panic_notifier;
 	}
+
+	/*
+	 * The registers are copied by our notifier, before apanic runs.
+	 * Regions can't be unregistered, so only hand them over once
+	 * nothing can fail anymore.
+	 */
+	for (i = 0; i < dbx500_dump_size; i++) {
+		dbx500_dump[i].region.name = dbx500_dump[i].name;
+		dbx500_dump[i].region.data = dbx500_dump[i].data;
+		dbx500_dump[i].region.size = dbx500_dump[i].size;
+		apanic_register_region(&dbx500_dump[i].region);
+	}
+
 	pr_info("dbx500_dump: driver initialized\n");
 	return err;
 
@@ -7,6 +7,7 @@
 
 #include <linux/types.h>
 #include <linux/dma-mapping.h>
+#include <linux/apanic.h>
 #include <mach/hardware.h>
 
 struct ux500_debug_last_io {
@@ -18,6 +19,7 @@ struct ux500_debug_last_io {
 static struct ux500_debug_last_io *ux500_last_io;
 static dma_addr_t ux500_last_io_phys;
 static void __iomem *l2x0_base;
+static struct apanic_region ux500_last_io_region;
 
 void ux500_debug_last_io_save(void *pc, void __iomem *vaddr)
 {
@@ -47,6 +49,11 @@ static int __init ux500_debug_last_io_init(void)
 		return -ENOMEM;
 	}
 
+	ux500_last_io_region.name = "last_io";
+	ux500_last_io_region.data = ux500_last_io;
+	ux500_last_io_region.size = size;
+	apanic_register_region(&ux500_last_io_region);
+
 	if (cpu_is_u5500())
 		l2x0_base = __io_address(U5500_L2CC_BASE);
 	else if (cpu_is_u8500() || cpu_is_u9540())
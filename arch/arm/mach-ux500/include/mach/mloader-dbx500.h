@@ -37,12 +37,18 @@ struct dbx500_ml_fw {
  * @nr_fws: number of firmwares
  * @areas: pointer on areas table
  * @nr_areas: number of areas
+ * @use_dma: copy firmwares to their area with a DMA memcpy channel
+ * @hash_alg: ahash algorithm digesting firmwares while they are copied,
+ *	NULL for none. A "<firmware name>.<hash_alg>" file holding the
+ *	expected digest in hex, if present, is checked against the result.
  */
 struct dbx500_mloader_pdata {
 	struct dbx500_ml_fw *fws;
 	int nr_fws;
 	struct dbx500_ml_area *areas;
 	int	nr_areas;
+	int use_dma;
+	const char *hash_alg;
 };
 
 #endif /* _MLOADER_UX500_H_ */
@@ -31,6 +31,8 @@ static struct dbx500_mloader_pdata mloader_fw_data = {
 	.nr_fws = ARRAY_SIZE(modem_fws),
 	.areas = modem_areas,
 	.nr_areas = ARRAY_SIZE(modem_areas),
+	.use_dma = 1,
+	.hash_alg = "sha256",
 };
 
 static struct resource mloader_fw_rsrc[] = {
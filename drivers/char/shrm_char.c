@@ -15,6 +15,8 @@
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/sched.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
 #include <linux/modem/shrm/shrm_driver.h>
 #include <linux/modem/shrm/shrm_private.h>
 #include <linux/modem/shrm/shrm_config.h>
@@ -32,10 +34,8 @@
 
 static u8 message_fifo[ISA_DEVICES][SIZE_OF_FIFO];
 
-static u8 wr_rpc_msg[10*1024];
-static u8 wr_sec_msg[10*1024];
-static u8 wr_audio_msg[10*1024];
-static u8 wr_rtc_cal_msg[100];
+#define ISA_MAX_MSG_LEN		(10*1024)
+#define ISA_MAX_RTC_CAL_MSG_LEN	100
 
 struct map_device {
 	u8 l2_header;
@@ -434,31 +434,128 @@ ssize_t isa_read(struct file *filp, char __user *buf, size_t len, loff_t *ppos)
 }
 
 /**
- * isa_write() - Write to shrm char device
- * @filp:	file descriptor
- * @buf:	user buffer pointer
- * @len:	size of requested data transfer
- * @ppos:	not used
+ * struct isa_iov_src - user iovec a message is written from
+ * @iov:	user segments, together making up one message
+ * @nr_segs:	number of segments
+ */
+struct isa_iov_src {
+	const struct iovec *iov;
+	unsigned long nr_segs;
+};
+
+/*
+ * Called under the channel lock, which may be a spinlock, so the user
+ * pages must not be faulted in from here: a missing page fails the copy.
+ */
+static int isa_copy_from_iov(void *dst, struct shrm_tx_src *src,
+						u32 offset, u32 len)
+{
+	struct isa_iov_src *from = src->data;
+	const struct iovec *iov = from->iov;
+	unsigned long seg, left;
+	u8 *to = dst;
+	size_t n;
+
+	for (seg = 0; len && seg < from->nr_segs; seg++, iov++) {
+		if (offset >= iov->iov_len) {
+			offset -= iov->iov_len;
+			continue;
+		}
+		n = min_t(size_t, iov->iov_len - offset, len);
+		pagefault_disable();
+		left = __copy_from_user_inatomic(to, iov->iov_base + offset, n);
+		pagefault_enable();
+		if (left)
+			return -EFAULT;
+		to += n;
+		len -= n;
+		offset = 0;
+	}
+	return len ? -EFAULT : 0;
+}
+
+static int isa_copy_from_bounce(void *dst, struct shrm_tx_src *src,
+						u32 offset, u32 len)
+{
+	memcpy(dst, (u8 *)src->data + offset, len);
+	return 0;
+}
+
+/* touch every user page of the message so the atomic copy rarely faults */
+static int isa_fault_in_iov(const struct iovec *iov, unsigned long nr_segs)
+{
+	const char __user *p, *end;
+	volatile char c;
+	unsigned long seg;
+
+	for (seg = 0; seg < nr_segs; seg++, iov++) {
+		if (!iov->iov_len)
+			continue;
+		p = iov->iov_base;
+		end = p + iov->iov_len - 1;
+		while (p < end) {
+			if (__get_user(c, p))
+				return -EFAULT;
+			p = (const char __user *)
+				(((unsigned long)p & PAGE_MASK) + PAGE_SIZE);
+		}
+		if (__get_user(c, end))
+			return -EFAULT;
+	}
+	(void)c;
+	return 0;
+}
+
+static int isa_write_msg(struct shrm_dev *shrm, int l2_header,
+				struct shrm_tx_src *src, size_t len)
+{
+	int err;
+
+	if ((l2_header == AUDIO_MESSAGING) ||
+			(l2_header == AUDIO_LOOPBACK_MESSAGING)) {
+		mutex_lock(&shrm->isa_context->tx_audio_mutex);
+		err = shm_write_msg_src(shrm, l2_header, src, len);
+		mutex_unlock(&shrm->isa_context->tx_audio_mutex);
+	} else {
+		spin_lock_bh(&shrm->isa_context->common_tx);
+		err = shm_write_msg_src(shrm, l2_header, src, len);
+		spin_unlock_bh(&shrm->isa_context->common_tx);
+	}
+	return err;
+}
+
+/**
+ * isa_writev() - write one message gathered from a user iovec
+ * @isadev:	shrm char device context
+ * @iov:	user segments making up the message
+ * @nr_segs:	number of segments
  *
- * It checks if there is space available in queue, and copies the message
- * inside queue. If there is no space, it blocks until space becomes available.
- * It also schedules transfer thread to transmit the newly added message.
+ * The user pages are faulted in up front and then copied straight into
+ * the FIFO under the channel lock. Should a page go away in between, the
+ * message is bounced through a kernel buffer instead.
  */
-ssize_t isa_write(struct file *filp, const char __user *buf,
-				 size_t len, loff_t *ppos)
+static ssize_t isa_writev(struct isadev_context *isadev,
+			const struct iovec *iov, unsigned long nr_segs)
 {
-	struct isadev_context *isadev = filp->private_data;
 	struct shrm_dev *shrm = isadev->dl_queue.shrm;
-	struct message_queue *q;
-	void *addr = 0;
+	struct isa_iov_src from = {
+		.iov = iov,
+		.nr_segs = nr_segs,
+	};
+	struct shrm_tx_src src = {
+		.copy = isa_copy_from_iov,
+		.data = &from,
+	};
+	size_t len = iov_length(iov, nr_segs);
+	size_t max_len = ISA_MAX_MSG_LEN;
+	unsigned long seg;
+	u8 *addr;
 	int err, l2_header;
-	int ret = 0;
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
 
-	if (len <= 0 || buf == NULL)
+	if (len == 0)
 		return -EFAULT;
-	q = &isadev->dl_queue;
 	l2_header = shrm_get_cdev_l2header(isadev->device_id);
 	if (l2_header < 0) {
 		dev_err(shrm->dev, "failed to get L2 header\n");
@@ -468,62 +565,98 @@ ssize_t isa_write(struct file *filp, const char __user *buf,
 	switch (l2_header) {
 	case RPC_MESSAGING:
 		dev_dbg(shrm->dev, "RPC\n");
-		addr = (void *)wr_rpc_msg;
 		break;
 	case AUDIO_MESSAGING:
 		dev_dbg(shrm->dev, "Audio\n");
-		addr = (void *)wr_audio_msg;
 		break;
 	case SECURITY_MESSAGING:
 		dev_dbg(shrm->dev, "Security\n");
-		addr = (void *)wr_sec_msg;
 		break;
 	case COMMON_LOOPBACK_MESSAGING:
 		dev_dbg(shrm->dev, "Common loopback\n");
-		addr = isadev->addr;
 		break;
 	case AUDIO_LOOPBACK_MESSAGING:
 		dev_dbg(shrm->dev, "Audio loopback\n");
-		addr = isadev->addr;
 		break;
 	case CIQ_MESSAGING:
 		dev_dbg(shrm->dev, "CIQ\n");
-		addr = isadev->addr;
 		break;
 	case RTC_CAL_MESSAGING:
 		dev_dbg(shrm->dev, "isa_write(): RTC Calibration\n");
-		addr = (void *)wr_rtc_cal_msg;
+		max_len = ISA_MAX_RTC_CAL_MSG_LEN;
 		break;
 	default:
 		dev_dbg(shrm->dev, "Wrong device\n");
 		return -EFAULT;
 	}
+	if (len > max_len)
+		return -EMSGSIZE;
 
-	if (copy_from_user(addr, buf, len)) {
+	err = isa_fault_in_iov(iov, nr_segs);
+	if (err) {
 		dev_err(shrm->dev, "copy_from_user failed\n");
-		return -EFAULT;
+		return err;
 	}
 	/* Write msg to Fifo */
-	if ((l2_header == AUDIO_MESSAGING) ||
-			(l2_header == AUDIO_LOOPBACK_MESSAGING)) {
-		mutex_lock(&shrm->isa_context->tx_audio_mutex);
-		err = shm_write_msg(shrm, l2_header, addr, len);
-		if (!err)
-			ret = len;
-		else
-			ret = err;
-		mutex_unlock(&shrm->isa_context->tx_audio_mutex);
-	} else {
-		spin_lock_bh(&shrm->isa_context->common_tx);
-		err = shm_write_msg(shrm, l2_header, addr, len);
-		if (!err)
-			ret = len;
-		else
-			ret = err;
-		spin_unlock_bh(&shrm->isa_context->common_tx);
+	err = isa_write_msg(shrm, l2_header, &src, len);
+
+	if (err == -EFAULT) {
+		addr = kmalloc(len, GFP_KERNEL);
+		if (!addr)
+			return -ENOMEM;
+		src.copy = isa_copy_from_bounce;
+		src.data = addr;
+		for (seg = 0; seg < nr_segs; seg++) {
+			if (copy_from_user(addr, iov[seg].iov_base,
+						iov[seg].iov_len)) {
+				dev_err(shrm->dev, "copy_from_user failed\n");
+				kfree(src.data);
+				return -EFAULT;
+			}
+			addr += iov[seg].iov_len;
+		}
+		err = isa_write_msg(shrm, l2_header, &src, len);
+		kfree(src.data);
 	}
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
-	return ret;
+	return err ? err : len;
+}
+
+/**
+ * isa_write() - Write to shrm char device
+ * @filp:	file descriptor
+ * @buf:	user buffer pointer
+ * @len:	size of requested data transfer
+ * @ppos:	not used
+ *
+ * Writes the message in @buf to the modem, see isa_writev().
+ */
+ssize_t isa_write(struct file *filp, const char __user *buf,
+				 size_t len, loff_t *ppos)
+{
+	struct iovec iov = {
+		.iov_base = (void __user *)buf,
+		.iov_len = len,
+	};
+
+	if (buf == NULL)
+		return -EFAULT;
+	return isa_writev(filp->private_data, &iov, 1);
+}
+
+/**
+ * isa_aio_write() - Write a vector to shrm char device
+ * @iocb:	kernel I/O control block
+ * @iov:	user segments making up the message
+ * @nr_segs:	number of segments
+ * @pos:	not used
+ *
+ * All segments are sent to the modem as a single message.
+ */
+static ssize_t isa_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				unsigned long nr_segs, loff_t pos)
+{
+	return isa_writev(iocb->ki_filp->private_data, iov, nr_segs);
 }
 
 /**
@@ -642,15 +775,12 @@ static int isa_close(struct inode *inode, struct file *filp)
 		dev_info(shrm->dev, "CLose SECURITY_MESSAGING Device\n");
 		break;
 	case COMMON_LOOPBACK_MESSAGING:
-		kfree(isadev->addr);
 		dev_info(shrm->dev, "Close COMMON_LOOPBACK_MESSAGING Device\n");
 		break;
 	case AUDIO_LOOPBACK_MESSAGING:
-		kfree(isadev->addr);
 		dev_info(shrm->dev, "Close AUDIO_LOOPBACK_MESSAGING Device\n");
 		break;
 	case CIQ_MESSAGING:
-		kfree(isadev->addr);
 		dev_info(shrm->dev, "Close CIQ_MESSAGING Device\n");
 		break;
 	case RTC_CAL_MESSAGING:
@@ -736,27 +866,12 @@ static int isa_open(struct inode *inode, struct file *filp)
 		dev_info(shrm->dev, "Open SECURITY_MESSAGING Device\n");
 		break;
 	case COMMON_LOOPBACK_MESSAGING:
-		isadev->addr = kzalloc(10 * 1024, GFP_KERNEL);
-		if (!isadev->addr) {
-			mutex_unlock(&isa_lock);
-			return -ENOMEM;
-		}
 		dev_info(shrm->dev, "Open COMMON_LOOPBACK_MESSAGING Device\n");
 		break;
 	case AUDIO_LOOPBACK_MESSAGING:
-		isadev->addr = kzalloc(10 * 1024, GFP_KERNEL);
-		if (!isadev->addr) {
-			mutex_unlock(&isa_lock);
-			return -ENOMEM;
-		}
 		dev_info(shrm->dev, "Open AUDIO_LOOPBACK_MESSAGING Device\n");
 		break;
 	case CIQ_MESSAGING:
-		isadev->addr = kzalloc(10 * 1024, GFP_KERNEL);
-		if (!isadev->addr) {
-			mutex_unlock(&isa_lock);
-			return -ENOMEM;
-		}
 		dev_info(shrm->dev, "Open CIQ_MESSAGING Device\n");
 		break;
 	case RTC_CAL_MESSAGING:
@@ -777,6 +892,7 @@ const struct file_operations isa_fops = {
 	.mmap = isa_mmap,
 	.read = isa_read,
 	.write = isa_write,
+	.aio_write = isa_aio_write,
 	.poll = isa_select,
 };
 
@@ -16,6 +16,12 @@
 #include <linux/regulator/consumer.h>
 #include <linux/gpio.h>
 #include <linux/mfd/dbx500-prcmu.h>
+#include <linux/scatterlist.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kernel_stat.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
 
 #ifdef CONFIG_STE_DMA40
 #include <linux/dmaengine.h>
@@ -56,6 +62,7 @@ struct ste_hsi_hw_context {
  * @lock: locking primitive for HSI controller
  * @use_dma: flag for DMA enabled
  * @ck_on: flag for HSI clocks enabled
+ * @dir: debugfs directory
  */
 struct ste_hsi_controller {
 	struct device *dev;
@@ -76,13 +83,82 @@ struct ste_hsi_controller {
 	spinlock_t lock;
 	unsigned int use_dma:1;
 	unsigned int ck_on:1;
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *dir;
+#endif
 };
 
+/* Messages submitted ahead on one DMA channel, so it never idles between them */
+#define STE_HSI_DMA_MAX_INFLIGHT	8
+
 #ifdef CONFIG_STE_DMA40
+/**
+ * struct ste_hsi_channel_dma - DMA state of one HSI channel and direction
+ * @dma_chan: DMA40 channel
+ * @port: port the channel belongs to
+ * @queue: message queue served by the channel
+ * @cookie: cookies of the in-flight messages, the oldest at @head
+ * @head: ring index of the oldest in-flight message
+ * @inflight: number of submitted, not yet completed messages; they are
+ *	the first @inflight entries of @queue
+ * @channel: HSI channel number
+ * @ttype: HSI_MSG_READ or HSI_MSG_WRITE
+ * @submitted: messages handed to the DMA engine
+ * @completed: messages completed
+ * @callbacks: DMA engine completion callbacks
+ * @max_inflight: deepest the channel has been kept busy
+ * @max_batch: most messages completed in one pass
+ */
 struct ste_hsi_channel_dma {
 	struct dma_chan *dma_chan;
-	struct dma_async_tx_descriptor *desc;
-	dma_cookie_t cookie;
+	struct ste_hsi_port *port;
+	struct list_head *queue;
+	dma_cookie_t cookie[STE_HSI_DMA_MAX_INFLIGHT];
+	unsigned int head;
+	unsigned int inflight;
+	unsigned int channel;
+	unsigned int ttype;
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long callbacks;
+	unsigned int max_inflight;
+	unsigned int max_batch;
+};
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+/**
+ * struct ste_hsi_bench - loopback benchmark
+ * @run_lock: one run at a time
+ * @lock: protects the counters against the completion path
+ * @cl: client whose configuration and port claim the run borrows
+ * @wait: woken when the last benchmark message is gone
+ * @outstanding: benchmark messages not yet freed
+ * @stop: set when the measuring window is over
+ * @channel: HSI channel used
+ * @size: bytes per message
+ * @depth: messages queued per direction
+ * @tx_bytes: bytes written in the window
+ * @rx_bytes: bytes read back in the window
+ * @errors: messages that completed with an error
+ * @elapsed_us: length of the window
+ * @load: CPU time busy during the window, in permille of all CPUs
+ */
+struct ste_hsi_bench {
+	struct mutex run_lock;
+	spinlock_t lock;
+	struct hsi_client *cl;
+	wait_queue_head_t wait;
+	atomic_t outstanding;
+	int stop;
+	unsigned int channel;
+	unsigned int size;
+	unsigned int depth;
+	u64 tx_bytes;
+	u64 rx_bytes;
+	unsigned long errors;
+	s64 elapsed_us;
+	unsigned int load;
 };
 #endif
 
@@ -103,9 +179,13 @@ struct ste_hsi_port {
 	struct tasklet_struct overrun_tasklet;
 	unsigned char channels;
 #ifdef CONFIG_STE_DMA40
+	struct tasklet_struct dma_tasklet;
 	struct ste_hsi_channel_dma tx_dma[STE_HSI_MAX_CHANNELS];
 	struct ste_hsi_channel_dma rx_dma[STE_HSI_MAX_CHANNELS];
 #endif
+#ifdef CONFIG_DEBUG_FS
+	struct ste_hsi_bench bench;
+#endif
 };
 
 #define hsi_to_ste_port(port) (hsi_port_drvdata(port))
@@ -470,100 +550,214 @@ static int ste_hsi_start_irq(struct hsi_msg *msg)
 	return 0;
 }
 
-static int ste_hsi_start_transfer(struct ste_hsi_port *ste_port,
-				  struct list_head *queue);
 #ifdef CONFIG_STE_DMA40
-static void ste_hsi_dma_callback(void *dma_async_param)
+static struct ste_hsi_channel_dma *ste_hsi_msg_dma(struct hsi_msg *msg)
 {
-	struct hsi_msg *msg = dma_async_param;
-	struct hsi_controller *hsi = client_to_hsi(msg->cl);
 	struct ste_hsi_port *ste_port = client_to_ste_port(msg->cl);
-	struct ste_hsi_controller *ste_hsi = client_to_ste_controller(msg->cl);
-	struct list_head *queue;
-	struct dma_chan *chan;
-	struct ste_hsi_channel_dma *hsi_dma_chan;
-	char *dma_enable_address;
-	enum dma_data_direction direction;
-	u32 dma_mask;
 
-	/* Message finished, remove from list and notify client */
-	spin_lock_bh(&ste_hsi->lock);
-	list_del(&msg->link);
+	if (msg->ttype == HSI_MSG_WRITE)
+		return &ste_port->tx_dma[msg->channel];
+	return &ste_port->rx_dma[msg->channel];
+}
 
-	if (msg->ttype == HSI_MSG_WRITE) {
-		queue = &ste_port->txqueue[msg->channel];
-		direction = DMA_TO_DEVICE;
+static void ste_hsi_dma_enable(struct ste_hsi_channel_dma *hsi_dma_chan,
+			       int enable)
+{
+	struct ste_hsi_controller *ste_hsi =
+		ste_port_to_ste_controller(hsi_dma_chan->port);
+	unsigned char __iomem *dma_enable_address;
+	u32 dma_mask;
+
+	if (hsi_dma_chan->ttype == HSI_MSG_WRITE)
 		dma_enable_address = ste_hsi->tx_base + STE_HSI_TX_DMAEN;
-		hsi_dma_chan = &ste_port->tx_dma[msg->channel];
-	} else {
-		queue = &ste_port->rxqueue[msg->channel];
-		direction = DMA_FROM_DEVICE;
+	else
 		dma_enable_address = ste_hsi->rx_base + STE_HSI_RX_DMAEN;
-		hsi_dma_chan = &ste_port->rx_dma[msg->channel];
-	}
-
-	dma_sync_sg_for_cpu(&hsi->device, msg->sgt.sgl,
-			    msg->sgt.nents, direction);
-	chan = hsi_dma_chan->dma_chan;
 
-	/* disable DMA channel on HSI controller */
 	dma_mask = readl(dma_enable_address);
-	writel(dma_mask & ~(1 << msg->channel), dma_enable_address);
+	if (enable)
+		dma_mask |= 1 << hsi_dma_chan->channel;
+	else
+		dma_mask &= ~(1 << hsi_dma_chan->channel);
+	writel(dma_mask, dma_enable_address);
+}
 
-	hsi_dma_chan->desc = NULL;
+static void ste_hsi_dma_callback(void *dma_async_param)
+{
+	struct ste_hsi_channel_dma *hsi_dma_chan = dma_async_param;
 
-	dma_unmap_sg(&hsi->device, msg->sgt.sgl, msg->sgt.nents, direction);
+	/*
+	 * Completions are collected by the port tasklet, which then sees
+	 * every message the DMA engine has finished in the meantime.
+	 */
+	hsi_dma_chan->callbacks++;
+	tasklet_hi_schedule(&hsi_dma_chan->port->dma_tasklet);
+}
 
-	msg->status = HSI_STATUS_COMPLETED;
-	msg->actual_len = sg_dma_len(msg->sgt.sgl);
+static void dma_device_control(struct ste_hsi_channel_dma *chan,
+			       enum dma_ctrl_cmd cmd, unsigned long arg)
+{
+	chan->dma_chan->device->device_control(chan->dma_chan, cmd, arg);
+}
 
-	spin_unlock_bh(&ste_hsi->lock);
+static unsigned int ste_hsi_sg_dma_len(struct hsi_msg *msg)
+{
+	struct scatterlist *sg;
+	unsigned int len = 0;
+	int i;
 
-	msg->complete(msg);
+	for_each_sg(msg->sgt.sgl, sg, msg->sgt.nents, i)
+		len += sg_dma_len(sg);
 
-	ste_hsi_clock_disable(hsi);
+	return len;
+}
 
-	spin_lock_bh(&ste_hsi->lock);
-	ste_hsi_start_transfer(ste_port, queue);
-	spin_unlock_bh(&ste_hsi->lock);
+/*
+ * Take every message the DMA engine has finished off the channel and
+ * move it to done, in order. ste_hsi->lock must be held.
+ */
+static unsigned int ste_hsi_dma_reap(struct ste_hsi_channel_dma *hsi_dma_chan,
+				     struct list_head *done)
+{
+	struct hsi_controller *hsi =
+		to_hsi_controller(hsi_dma_chan->port->dev->parent);
+	struct dma_chan *chan = hsi_dma_chan->dma_chan;
+	enum dma_data_direction direction;
+	struct hsi_msg *msg;
+	unsigned int batch = 0;
+
+	direction = hsi_dma_chan->ttype == HSI_MSG_WRITE ?
+				DMA_TO_DEVICE : DMA_FROM_DEVICE;
+
+	while (hsi_dma_chan->inflight) {
+		dma_cookie_t cookie = hsi_dma_chan->cookie[hsi_dma_chan->head];
+
+		if (dma_async_is_tx_complete(chan, cookie, NULL, NULL) !=
+								DMA_SUCCESS)
+			break;
+
+		msg = list_first_entry(hsi_dma_chan->queue, struct hsi_msg,
+				       link);
+		list_move_tail(&msg->link, done);
+		hsi_dma_chan->head = (hsi_dma_chan->head + 1) %
+						STE_HSI_DMA_MAX_INFLIGHT;
+		hsi_dma_chan->inflight--;
+
+		dma_sync_sg_for_cpu(&hsi->device, msg->sgt.sgl,
+				    msg->sgt.nents, direction);
+		dma_unmap_sg(&hsi->device, msg->sgt.sgl, msg->sgt.nents,
+			     direction);
+
+		msg->status = HSI_STATUS_COMPLETED;
+		msg->actual_len = ste_hsi_sg_dma_len(msg);
+		batch++;
+	}
+
+	hsi_dma_chan->completed += batch;
+	if (batch > hsi_dma_chan->max_batch)
+		hsi_dma_chan->max_batch = batch;
+
+	return batch;
 }
 
-static void dma_device_control(struct ste_hsi_channel_dma *chan,
-			       enum dma_ctrl_cmd cmd, unsigned long arg)
+/* Notify the client of reaped messages. ste_hsi->lock must not be held. */
+static void ste_hsi_dma_giveback(struct hsi_controller *hsi,
+				 struct list_head *done)
 {
-	chan->dma_chan->device->device_control(chan->dma_chan, cmd, arg);
+	struct hsi_msg *msg, *tmp;
+
+	list_for_each_entry_safe(msg, tmp, done, link) {
+		list_del(&msg->link);
+		msg->complete(msg);
+		ste_hsi_clock_disable(hsi);
+	}
 }
 
-static void ste_hsi_terminate_dma_chan(struct ste_hsi_channel_dma *chan)
+/*
+ * Stop a DMA channel. Messages the DMA engine had already finished are
+ * reaped to done, unless it is NULL; the others are unmapped and queued
+ * again. ste_hsi->lock must be held.
+ */
+static void ste_hsi_terminate_dma_chan(struct ste_hsi_channel_dma *chan,
+				       struct list_head *done)
 {
-	if (chan->desc) {
-		dma_device_control(chan, DMA_TERMINATE_ALL, 0);
-		chan->desc = NULL;
+	struct ste_hsi_port *ste_port = chan->port;
+	struct hsi_controller *hsi = to_hsi_controller(ste_port->dev->parent);
+	enum dma_data_direction direction;
+	struct hsi_msg *msg;
+
+	if (!chan->inflight)
+		return;
+
+	direction = chan->ttype == HSI_MSG_WRITE ?
+				DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	dma_device_control(chan, DMA_TERMINATE_ALL, 0);
+	ste_hsi_dma_enable(chan, 0);
+
+	if (done)
+		ste_hsi_dma_reap(chan, done);
+
+	list_for_each_entry(msg, chan->queue, link) {
+		if (!chan->inflight)
+			break;
+		dma_unmap_sg(&hsi->device, msg->sgt.sgl, msg->sgt.nents,
+			     direction);
+		msg->status = HSI_STATUS_QUEUED;
+		chan->inflight--;
+		ste_hsi_clock_disable(hsi);
 	}
-	chan->cookie = 0;
+	chan->inflight = 0;
+	chan->head = 0;
 }
 
 static void ste_hsi_terminate_dma(struct ste_hsi_port *ste_port)
 {
+	struct ste_hsi_controller *ste_hsi =
+		ste_port_to_ste_controller(ste_port);
 	int i;
 
+	/* Everything queued is flushed next, finished or not */
+	spin_lock_bh(&ste_hsi->lock);
 	for (i = 0; i < ste_port->channels; ++i) {
-		ste_hsi_terminate_dma_chan(&ste_port->tx_dma[i]);
-		ste_hsi_terminate_dma_chan(&ste_port->rx_dma[i]);
+		ste_hsi_terminate_dma_chan(&ste_port->tx_dma[i], NULL);
+		ste_hsi_terminate_dma_chan(&ste_port->rx_dma[i], NULL);
 	}
+	spin_unlock_bh(&ste_hsi->lock);
 }
 
-static int ste_hsi_start_dma(struct hsi_msg *msg)
+/*
+ * Stop the RX DMA of a channel after an error, and complete the reads it
+ * had already finished. The read at the head of the queue afterwards is
+ * the one the error hit.
+ */
+static void ste_hsi_terminate_rx_dma(struct ste_hsi_port *ste_port,
+				     unsigned int channel)
+{
+	struct ste_hsi_controller *ste_hsi =
+		ste_port_to_ste_controller(ste_port);
+	struct hsi_controller *hsi = to_hsi_controller(ste_port->dev->parent);
+	LIST_HEAD(done);
+
+	spin_lock_bh(&ste_hsi->lock);
+	ste_hsi_terminate_dma_chan(&ste_port->rx_dma[channel], &done);
+	spin_unlock_bh(&ste_hsi->lock);
+
+	ste_hsi_dma_giveback(hsi, &done);
+}
+
+/*
+ * Map a message and hand it to the DMA engine. The whole scatterlist goes
+ * into one DMA40 job, its entries chained as linked LLIs. The transfer
+ * only starts at the next device_issue_pending().
+ */
+static int ste_hsi_submit_dma(struct hsi_msg *msg,
+			      struct ste_hsi_channel_dma *hsi_dma_chan)
 {
 	struct hsi_controller *hsi = client_to_hsi(msg->cl);
-	struct ste_hsi_port *ste_port = client_to_ste_port(msg->cl);
 	struct ste_hsi_controller *ste_hsi = client_to_ste_controller(msg->cl);
 	struct dma_async_tx_descriptor *desc;
-	struct dma_chan *chan;
-	struct ste_hsi_channel_dma *hsi_dma_chan;
-	char *dma_enable_address;
+	struct dma_chan *chan = hsi_dma_chan->dma_chan;
 	enum dma_data_direction direction;
-	u32 dma_mask;
+	unsigned int slot;
 	int err;
 
 	err = ste_hsi_clock_enable(hsi);
@@ -574,13 +768,9 @@ static int ste_hsi_start_dma(struct hsi_msg *msg)
 
 	if (msg->ttype == HSI_MSG_WRITE) {
 		direction = DMA_TO_DEVICE;
-		dma_enable_address = ste_hsi->tx_base + STE_HSI_TX_DMAEN;
-		hsi_dma_chan = &ste_port->tx_dma[msg->channel];
 	} else {
 		u32 val;
 		direction = DMA_FROM_DEVICE;
-		dma_enable_address = ste_hsi->rx_base + STE_HSI_RX_DMAEN;
-		hsi_dma_chan = &ste_port->rx_dma[msg->channel];
 
 		/* enable overrun for this channel */
 		val = readl(ste_hsi->rx_base + STE_HSI_RX_OVERRUNIM) |
@@ -588,8 +778,6 @@ static int ste_hsi_start_dma(struct hsi_msg *msg)
 		writel(val, ste_hsi->rx_base + STE_HSI_RX_OVERRUNIM);
 	}
 
-	chan = hsi_dma_chan->dma_chan;
-
 	if (0 == dma_map_sg(&hsi->device, msg->sgt.sgl, msg->sgt.nents,
 			    direction)) {
 		dev_dbg(&hsi->device, "DMA map SG failed !\n");
@@ -607,22 +795,22 @@ static int ste_hsi_start_dma(struct hsi_msg *msg)
 	if (!desc) {
 		dma_unmap_sg(&hsi->device, msg->sgt.sgl, msg->sgt.nents,
 			     direction);
-		/* "Complete" DMA (errorpath) */
-		ste_hsi_terminate_dma_chan(hsi_dma_chan);
 		err = -EBUSY;
 		goto out;
 	}
 	desc->callback = ste_hsi_dma_callback;
-	desc->callback_param = msg;
-	hsi_dma_chan->cookie = desc->tx_submit(desc);
-	hsi_dma_chan->desc = desc;
+	desc->callback_param = hsi_dma_chan;
 
-	/* Fire the DMA transaction */
-	chan->device->device_issue_pending(chan);
+	slot = (hsi_dma_chan->head + hsi_dma_chan->inflight) %
+						STE_HSI_DMA_MAX_INFLIGHT;
+	hsi_dma_chan->cookie[slot] = desc->tx_submit(desc);
+	hsi_dma_chan->inflight++;
+	hsi_dma_chan->submitted++;
+	if (hsi_dma_chan->inflight > hsi_dma_chan->max_inflight)
+		hsi_dma_chan->max_inflight = hsi_dma_chan->inflight;
 
-	/* Enable DMA channel on HSI controller */
-	dma_mask = readl(dma_enable_address);
-	writel(dma_mask | 1 << msg->channel, dma_enable_address);
+	msg->actual_len = 0;
+	msg->status = HSI_STATUS_PROCEEDING;
 
 out:
 	if (unlikely(err))
@@ -631,6 +819,88 @@ out:
 	return err;
 }
 
+/*
+ * Submit the queued messages of a channel, up to STE_HSI_DMA_MAX_INFLIGHT
+ * ahead, so the DMA engine moves from one to the next on its own.
+ * ste_hsi->lock must be held.
+ */
+static int ste_hsi_start_dma(struct ste_hsi_port *ste_port,
+			     struct list_head *queue)
+{
+	struct ste_hsi_channel_dma *hsi_dma_chan;
+	struct hsi_msg *msg;
+	unsigned int submitted = 0;
+	int err = 0;
+
+	msg = list_first_entry(queue, struct hsi_msg, link);
+	hsi_dma_chan = ste_hsi_msg_dma(msg);
+
+	list_for_each_entry(msg, queue, link) {
+		if (msg->status == HSI_STATUS_PROCEEDING)
+			continue;
+		if (msg->status != HSI_STATUS_QUEUED ||
+		    hsi_dma_chan->inflight == STE_HSI_DMA_MAX_INFLIGHT)
+			break;
+		err = ste_hsi_submit_dma(msg, hsi_dma_chan);
+		if (err)
+			break;
+		submitted++;
+	}
+
+	if (submitted) {
+		/* Fire the DMA transactions */
+		hsi_dma_chan->dma_chan->device->device_issue_pending(
+						hsi_dma_chan->dma_chan);
+
+		/* Enable DMA channel on HSI controller */
+		ste_hsi_dma_enable(hsi_dma_chan, 1);
+	}
+
+	return err;
+}
+
+/*
+ * Reap the finished messages of a channel, keep the channel fed from the
+ * queue, and only then notify the client of the whole batch.
+ */
+static void ste_hsi_dma_complete(struct ste_hsi_channel_dma *hsi_dma_chan)
+{
+	struct ste_hsi_port *ste_port = hsi_dma_chan->port;
+	struct ste_hsi_controller *ste_hsi =
+		ste_port_to_ste_controller(ste_port);
+	struct hsi_controller *hsi = to_hsi_controller(ste_port->dev->parent);
+	LIST_HEAD(done);
+
+	spin_lock_bh(&ste_hsi->lock);
+	if (!ste_hsi_dma_reap(hsi_dma_chan, &done)) {
+		spin_unlock_bh(&ste_hsi->lock);
+		return;
+	}
+
+	if (!list_empty(hsi_dma_chan->queue))
+		ste_hsi_start_dma(ste_port, hsi_dma_chan->queue);
+
+	/* disable DMA channel on HSI controller */
+	if (!hsi_dma_chan->inflight)
+		ste_hsi_dma_enable(hsi_dma_chan, 0);
+
+	spin_unlock_bh(&ste_hsi->lock);
+
+	/* Message finished, notify client */
+	ste_hsi_dma_giveback(hsi, &done);
+}
+
+static void ste_hsi_dma_tasklet(unsigned long data)
+{
+	struct ste_hsi_port *ste_port = (struct ste_hsi_port *)data;
+	unsigned int i;
+
+	for (i = 0; i < ste_port->channels; ++i) {
+		ste_hsi_dma_complete(&ste_port->tx_dma[i]);
+		ste_hsi_dma_complete(&ste_port->rx_dma[i]);
+	}
+}
+
 static void __init ste_hsi_init_dma(struct ste_hsi_platform_data *data,
 				    struct hsi_controller *hsi)
 {
@@ -649,18 +919,29 @@ static void __init ste_hsi_init_dma(struct ste_hsi_platform_data *data,
 		port = &hsi->port[i];
 		ste_port = hsi_port_drvdata(port);
 
+		tasklet_init(&ste_port->dma_tasklet, ste_hsi_dma_tasklet,
+			     (unsigned long)ste_port);
+
 		for (ch = 0; ch < STE_HSI_MAX_CHANNELS; ++ch) {
 			ste_port->tx_dma[ch].dma_chan =
 			    dma_request_channel(mask,
 						data->port_cfg[i].dma_filter,
 						&data->port_cfg[i].
 						dma_tx_cfg[ch]);
+			ste_port->tx_dma[ch].port = ste_port;
+			ste_port->tx_dma[ch].queue = &ste_port->txqueue[ch];
+			ste_port->tx_dma[ch].channel = ch;
+			ste_port->tx_dma[ch].ttype = HSI_MSG_WRITE;
 
 			ste_port->rx_dma[ch].dma_chan =
 			    dma_request_channel(mask,
 						data->port_cfg[i].dma_filter,
 						&data->port_cfg[i].
 						dma_rx_cfg[ch]);
+			ste_port->rx_dma[ch].port = ste_port;
+			ste_port->rx_dma[ch].queue = &ste_port->rxqueue[ch];
+			ste_port->rx_dma[ch].channel = ch;
+			ste_port->rx_dma[ch].ttype = HSI_MSG_READ;
 		}
 	}
 }
@@ -711,8 +992,9 @@ static int ste_hsi_setup_dma(struct hsi_client *cl)
 
 #else
 #define ste_hsi_init_dma(data, hsi) do { } while (0)
-#define ste_hsi_start_dma ste_hsi_start_irq
+#define ste_hsi_start_dma(ste_port, queue) (-ENOSYS)
 #define ste_hsi_terminate_dma(ste_port) do { } while (0)
+#define ste_hsi_terminate_rx_dma(ste_port, channel) do { } while (0)
 #define ste_hsi_setup_dma(cl) do { } while (0)
 #endif
 
@@ -725,6 +1007,9 @@ static int ste_hsi_start_transfer(struct ste_hsi_port *ste_port,
 	if (list_empty(queue))
 		return 0;
 
+	if (ste_port_to_ste_controller(ste_port)->use_dma)
+		return ste_hsi_start_dma(ste_port, queue);
+
 	msg = list_first_entry(queue, struct hsi_msg, link);
 	if (msg->status != HSI_STATUS_QUEUED)
 		return 0;
@@ -732,10 +1017,9 @@ static int ste_hsi_start_transfer(struct ste_hsi_port *ste_port,
 	msg->actual_len = 0;
 	msg->status = HSI_STATUS_PROCEEDING;
 
-	if (ste_port_to_ste_controller(ste_port)->use_dma)
-		err = ste_hsi_start_dma(msg);
-	else
-		err = ste_hsi_start_irq(msg);
+	err = ste_hsi_start_irq(msg);
+	if (err)
+		msg->status = HSI_STATUS_QUEUED;
 
 	return err;
 }
@@ -1008,10 +1292,16 @@ static void ste_hsi_break_complete(struct hsi_port *port,
 static void ste_hsi_error(struct hsi_port *port)
 {
 	struct ste_hsi_port *ste_port = hsi_port_drvdata(port);
+	struct ste_hsi_controller *ste_hsi =
+		ste_port_to_ste_controller(ste_port);
 	struct hsi_msg *msg;
 	unsigned int i;
 
 	for (i = 0; i < ste_port->channels; i++) {
+		if (list_empty(&ste_port->rxqueue[i]))
+			continue;
+		/* Reads queued behind the failed one are started again */
+		ste_hsi_terminate_rx_dma(ste_port, i);
 		if (list_empty(&ste_port->rxqueue[i]))
 			continue;
 		msg = list_first_entry(&ste_port->rxqueue[i], struct hsi_msg,
@@ -1020,7 +1310,9 @@ static void ste_hsi_error(struct hsi_port *port)
 		msg->status = HSI_STATUS_ERROR;
 		msg->complete(msg);
 		/* Now restart queued reads if any */
+		spin_lock_bh(&ste_hsi->lock);
 		ste_hsi_start_transfer(ste_port, &ste_port->rxqueue[i]);
+		spin_unlock_bh(&ste_hsi->lock);
 	}
 }
 
@@ -1083,6 +1375,7 @@ static void ste_hsi_overrun_tasklet(unsigned long data)
 	u8 rised_overrun;
 	u8 mask;
 	u8 blocked = 0;
+	int err;
 
 	rised_overrun = (u8) readl(ste_hsi->rx_base + STE_HSI_RX_OVERRUNMIS);
 	mask = rised_overrun;
@@ -1098,6 +1391,11 @@ static void ste_hsi_overrun_tasklet(unsigned long data)
 				blocked |= 1 << channel;
 				break;
 			}
+			ste_hsi_terminate_rx_dma(ste_port, channel);
+			if (list_empty(&ste_port->rxqueue[channel])) {
+				blocked |= 1 << channel;
+				break;
+			}
 			/*
 			 * Complete with error
 			 */
@@ -1111,8 +1409,11 @@ static void ste_hsi_overrun_tasklet(unsigned long data)
 			 * Now restart queued reads if any
 			 * If start_transfer fails, try with next message
 			 */
-			if (ste_hsi_start_transfer(ste_port,
-						   &ste_port->rxqueue[channel]))
+			spin_lock_bh(&ste_hsi->lock);
+			err = ste_hsi_start_transfer(ste_port,
+						     &ste_port->rxqueue[channel]);
+			spin_unlock_bh(&ste_hsi->lock);
+			if (err)
 				continue;
 		} while (0);
 	}
@@ -1311,15 +1612,16 @@ static int ste_hsi_async(struct hsi_msg *msg)
 	if (unlikely(!msg))
 		return -ENOSYS;
 
-	if (msg->sgt.nents > 1)
+	ste_port = client_to_ste_port(msg->cl);
+	ste_hsi = client_to_ste_controller(msg->cl);
+
+	/* Only DMA can follow a scatterlist */
+	if (msg->sgt.nents > 1 && !ste_hsi->use_dma)
 		return -ENOSYS;
 
 	if (unlikely(msg->break_frame))
 		return ste_hsi_async_break(msg);
 
-	ste_port = client_to_ste_port(msg->cl);
-	ste_hsi = client_to_ste_controller(msg->cl);
-
 	if (msg->ttype == HSI_MSG_WRITE) {
 		/* TX transfer */
 		BUG_ON(msg->channel >= ste_port->channels);
@@ -1333,8 +1635,12 @@ static int ste_hsi_async(struct hsi_msg *msg)
 	list_add_tail(&msg->link, queue);
 	msg->status = HSI_STATUS_QUEUED;
 
+	/*
+	 * An error may also come from an older message, and msg is only
+	 * dropped if it could not be started.
+	 */
 	err = ste_hsi_start_transfer(ste_port, queue);
-	if (err)
+	if (err && msg->status == HSI_STATUS_QUEUED)
 		list_del(&msg->link);
 
 	spin_unlock_bh(&ste_hsi->lock);
@@ -1342,6 +1648,329 @@ static int ste_hsi_async(struct hsi_msg *msg)
 	return err;
 }
 
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Loopback benchmark. Reads and writes of a given size are kept queued on
+ * one channel for a fixed time, and the bytes moved and the CPU time used
+ * are reported. It needs the link partner to echo what it receives (modem
+ * loopback mode), and borrows the configuration and port claim of the
+ * last client set up, so that client should leave the channel alone for
+ * the duration of the run.
+ */
+static int ste_hsi_flush(struct hsi_client *cl);
+
+static void ste_hsi_bench_destruct(struct hsi_msg *msg)
+{
+	struct ste_hsi_bench *bench = msg->context;
+
+	kfree(sg_virt(msg->sgt.sgl));
+	hsi_free_msg(msg);
+	if (atomic_dec_and_test(&bench->outstanding))
+		wake_up(&bench->wait);
+}
+
+static void ste_hsi_bench_complete(struct hsi_msg *msg)
+{
+	struct ste_hsi_bench *bench = msg->context;
+	int stop;
+
+	spin_lock_bh(&bench->lock);
+	stop = bench->stop;
+	if (!stop) {
+		if (msg->status != HSI_STATUS_COMPLETED)
+			bench->errors++;
+		else if (msg->ttype == HSI_MSG_WRITE)
+			bench->tx_bytes += msg->actual_len;
+		else
+			bench->rx_bytes += msg->actual_len;
+	}
+	spin_unlock_bh(&bench->lock);
+
+	/* Keep the queue full until the window is over */
+	if (!stop && msg->status == HSI_STATUS_COMPLETED &&
+	    !hsi_async(bench->cl, msg))
+		return;
+
+	ste_hsi_bench_destruct(msg);
+}
+
+static int ste_hsi_bench_queue(struct ste_hsi_bench *bench,
+			       unsigned int ttype)
+{
+	struct hsi_msg *msg;
+	void *buf;
+	int err;
+
+	msg = hsi_alloc_msg(1, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	buf = kmalloc(bench->size, GFP_KERNEL | GFP_DMA);
+	if (!buf) {
+		hsi_free_msg(msg);
+		return -ENOMEM;
+	}
+	memset(buf, 0xa5, bench->size);
+	sg_init_one(msg->sgt.sgl, buf, bench->size);
+
+	msg->channel = bench->channel;
+	msg->ttype = ttype;
+	msg->context = bench;
+	msg->complete = ste_hsi_bench_complete;
+	msg->destructor = ste_hsi_bench_destruct;
+
+	atomic_inc(&bench->outstanding);
+	err = hsi_async(bench->cl, msg);
+	if (err)
+		ste_hsi_bench_destruct(msg);
+
+	return err;
+}
+
+/* Idle time of all online CPUs, in jiffies */
+static u64 ste_hsi_idle_jiffies(void)
+{
+	u64 idle = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		idle += cputime64_to_jiffies64(kstat_cpu(cpu).cpustat.idle) +
+			cputime64_to_jiffies64(kstat_cpu(cpu).cpustat.iowait);
+
+	return idle;
+}
+
+static int ste_hsi_bench_run(struct ste_hsi_port *ste_port,
+			     unsigned int channel, unsigned int size,
+			     unsigned int depth, unsigned int msecs)
+{
+	struct ste_hsi_bench *bench = &ste_port->bench;
+	u64 idle, busy, wall;
+	ktime_t start;
+	unsigned int i;
+	int err = 0;
+
+	if (!bench->cl)
+		return -ENODEV;
+
+	if (channel >= ste_port->channels || !size || size % 4 ||
+	    size > PAGE_SIZE * 16 || !depth ||
+	    depth > STE_HSI_DMA_MAX_INFLIGHT || !msecs)
+		return -EINVAL;
+
+	mutex_lock(&bench->run_lock);
+
+	bench->channel = channel;
+	bench->size = size;
+	bench->depth = depth;
+	bench->tx_bytes = 0;
+	bench->rx_bytes = 0;
+	bench->errors = 0;
+	bench->stop = 0;
+
+	idle = ste_hsi_idle_jiffies();
+	wall = get_jiffies_64();
+	start = ktime_get();
+
+	/* Reads first, so that the echo always finds one waiting */
+	for (i = 0; i < depth && !err; i++)
+		err = ste_hsi_bench_queue(bench, HSI_MSG_READ);
+	for (i = 0; i < depth && !err; i++)
+		err = ste_hsi_bench_queue(bench, HSI_MSG_WRITE);
+
+	if (!err)
+		msleep_interruptible(msecs);
+
+	spin_lock_bh(&bench->lock);
+	bench->stop = 1;
+	spin_unlock_bh(&bench->lock);
+
+	bench->elapsed_us = ktime_us_delta(ktime_get(), start);
+	idle = ste_hsi_idle_jiffies() - idle;
+	wall = (get_jiffies_64() - wall) * num_online_cpus();
+	busy = wall > idle ? wall - idle : 0;
+	bench->load = wall ? div64_u64(busy * 1000, wall) : 0;
+
+	/* Reads still waiting for data are taken back by a flush */
+	if (!wait_event_timeout(bench->wait,
+				!atomic_read(&bench->outstanding), HZ)) {
+		ste_hsi_flush(bench->cl);
+		wait_event(bench->wait, !atomic_read(&bench->outstanding));
+	}
+
+	mutex_unlock(&bench->run_lock);
+
+	return err;
+}
+
+static u64 ste_hsi_kbps(u64 bytes, s64 us)
+{
+	return us > 0 ? div64_u64(bytes * 8 * 1000, us) : 0;
+}
+
+static int ste_hsi_bench_show(struct seq_file *m, void *p __maybe_unused)
+{
+	struct ste_hsi_port *ste_port = m->private;
+	struct ste_hsi_bench *bench = &ste_port->bench;
+
+	mutex_lock(&bench->run_lock);
+	seq_printf(m, "channel %u size %u depth %u time %lld us\n",
+		   bench->channel, bench->size, bench->depth,
+		   bench->elapsed_us);
+	seq_printf(m, "tx %llu bytes, %llu kbit/s\n", bench->tx_bytes,
+		   ste_hsi_kbps(bench->tx_bytes, bench->elapsed_us));
+	seq_printf(m, "rx %llu bytes, %llu kbit/s\n", bench->rx_bytes,
+		   ste_hsi_kbps(bench->rx_bytes, bench->elapsed_us));
+	seq_printf(m, "errors %lu\n", bench->errors);
+	seq_printf(m, "cpu load %u.%u%%\n", bench->load / 10,
+		   bench->load % 10);
+	mutex_unlock(&bench->run_lock);
+
+	return 0;
+}
+
+static int ste_hsi_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ste_hsi_bench_show, inode->i_private);
+}
+
+/* "<channel> <size> <depth> <msecs>" runs the benchmark */
+static ssize_t ste_hsi_bench_write(struct file *file,
+				   const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	unsigned int channel, size, depth, msecs;
+	char buf[64];
+	int err;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%u %u %u %u", &channel, &size, &depth, &msecs) != 4)
+		return -EINVAL;
+
+	err = ste_hsi_bench_run(m->private, channel, size, depth, msecs);
+
+	return err ? err : count;
+}
+
+static const struct file_operations ste_hsi_bench_fops = {
+	.open		= ste_hsi_bench_open,
+	.read		= seq_read,
+	.write		= ste_hsi_bench_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#ifdef CONFIG_STE_DMA40
+static void ste_hsi_dma_stats_chan(struct seq_file *m, const char *name,
+				   struct ste_hsi_channel_dma *chan)
+{
+	seq_printf(m, "%s%u\t: submitted %lu completed %lu callbacks %lu "
+		   "inflight %u max_inflight %u max_batch %u\n",
+		   name, chan->channel, chan->submitted, chan->completed,
+		   chan->callbacks, chan->inflight, chan->max_inflight,
+		   chan->max_batch);
+}
+
+static int ste_hsi_dma_stats_show(struct seq_file *m, void *p __maybe_unused)
+{
+	struct ste_hsi_port *ste_port = m->private;
+	unsigned int i;
+
+	for (i = 0; i < ste_port->channels; i++) {
+		ste_hsi_dma_stats_chan(m, "tx", &ste_port->tx_dma[i]);
+		ste_hsi_dma_stats_chan(m, "rx", &ste_port->rx_dma[i]);
+	}
+
+	return 0;
+}
+
+static int ste_hsi_dma_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ste_hsi_dma_stats_show, inode->i_private);
+}
+
+static const struct file_operations ste_hsi_dma_stats_fops = {
+	.open		= ste_hsi_dma_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+static void ste_hsi_bench_init(struct ste_hsi_port *ste_port)
+{
+	struct ste_hsi_bench *bench = &ste_port->bench;
+
+	mutex_init(&bench->run_lock);
+	spin_lock_init(&bench->lock);
+	init_waitqueue_head(&bench->wait);
+	atomic_set(&bench->outstanding, 0);
+}
+
+static void ste_hsi_bench_attach(struct ste_hsi_port *ste_port,
+				 struct hsi_client *cl)
+{
+	ste_port->bench.cl = cl;
+}
+
+static void ste_hsi_bench_detach(struct ste_hsi_port *ste_port,
+				 struct hsi_client *cl)
+{
+	mutex_lock(&ste_port->bench.run_lock);
+	if (ste_port->bench.cl == cl)
+		ste_port->bench.cl = NULL;
+	mutex_unlock(&ste_port->bench.run_lock);
+}
+
+static void __init ste_hsi_debug_add_ctrl(struct hsi_controller *hsi)
+{
+	struct ste_hsi_controller *ste_hsi = hsi_controller_drvdata(hsi);
+	struct ste_hsi_port *ste_port;
+	struct dentry *dir;
+	unsigned int i;
+
+	ste_hsi->dir = debugfs_create_dir(dev_name(&hsi->device), NULL);
+	if (IS_ERR_OR_NULL(ste_hsi->dir)) {
+		ste_hsi->dir = NULL;
+		return;
+	}
+
+	for (i = 0; i < hsi->num_ports; i++) {
+		ste_port = hsi_port_drvdata(&hsi->port[i]);
+		dir = debugfs_create_dir(dev_name(ste_port->dev),
+					 ste_hsi->dir);
+		if (IS_ERR_OR_NULL(dir))
+			continue;
+		debugfs_create_file("loopback", S_IRUGO | S_IWUSR, dir,
+				    ste_port, &ste_hsi_bench_fops);
+#ifdef CONFIG_STE_DMA40
+		if (ste_hsi->use_dma)
+			debugfs_create_file("dma_stats", S_IRUGO, dir,
+					    ste_port, &ste_hsi_dma_stats_fops);
+#endif
+	}
+}
+
+static void ste_hsi_debug_remove_ctrl(struct hsi_controller *hsi)
+{
+	struct ste_hsi_controller *ste_hsi = hsi_controller_drvdata(hsi);
+
+	debugfs_remove_recursive(ste_hsi->dir);
+}
+#else
+#define ste_hsi_bench_init(ste_port) do { } while (0)
+#define ste_hsi_bench_attach(ste_port, cl) do { } while (0)
+#define ste_hsi_bench_detach(ste_port, cl) do { } while (0)
+#define ste_hsi_debug_add_ctrl(hsi) do { } while (0)
+#define ste_hsi_debug_remove_ctrl(hsi) do { } while (0)
+#endif /* CONFIG_DEBUG_FS */
+
 static int ste_hsi_setup(struct hsi_client *cl)
 {
 	struct hsi_port *port = to_hsi_port(cl->device.parent);
@@ -1400,6 +2029,7 @@ static int ste_hsi_setup(struct hsi_client *cl)
 	ste_port->channels = max(cl->tx_cfg.channels, cl->rx_cfg.channels);
 
 	ste_hsi_setup_dma(cl);
+	ste_hsi_bench_attach(ste_port, cl);
 
 	ste_hsi_clock_disable(hsi);
 
@@ -1415,6 +2045,7 @@ static int ste_hsi_flush(struct hsi_client *cl)
 	struct ste_hsi_port *ste_port = hsi_port_drvdata(port);
 	struct hsi_controller *hsi = to_hsi_controller(port->device.parent);
 	struct ste_hsi_controller *ste_hsi = hsi_controller_drvdata(hsi);
+	struct hsi_msg *msg;
 	int i;
 
 	ste_hsi_clock_enable(hsi);
@@ -1451,11 +2082,13 @@ static int ste_hsi_flush(struct hsi_client *cl)
 
 	/* Dequeue all pending requests */
 	for (i = 0; i < ste_port->channels; i++) {
-		/* Release write clocks */
-		if (!list_empty(&ste_port->txqueue[i]))
-			ste_hsi_clock_disable(hsi);
-		if (!list_empty(&ste_port->rxqueue[i]))
-			ste_hsi_clock_disable(hsi);
+		/* Release the clocks of started transfers */
+		list_for_each_entry(msg, &ste_port->txqueue[i], link)
+			if (msg->status == HSI_STATUS_PROCEEDING)
+				ste_hsi_clock_disable(hsi);
+		list_for_each_entry(msg, &ste_port->rxqueue[i], link)
+			if (msg->status == HSI_STATUS_PROCEEDING)
+				ste_hsi_clock_disable(hsi);
 		ste_hsi_flush_queue(&ste_port->txqueue[i], NULL);
 		ste_hsi_flush_queue(&ste_port->rxqueue[i], NULL);
 	}
@@ -1501,6 +2134,7 @@ static int ste_hsi_release(struct hsi_client *cl)
 	int err;
 	struct ste_hsi_controller *ste_hsi = client_to_ste_controller(cl);
 
+	ste_hsi_bench_detach(client_to_ste_port(cl), cl);
 	err = ste_hsi_flush(cl);
 	cancel_delayed_work(&ste_hsi->clk_work);
 
@@ -1576,6 +2210,7 @@ static int ste_hsi_ports_init(struct hsi_controller *hsi,
 			return err;
 
 		ste_hsi_queues_init(ste_port);
+		ste_hsi_bench_init(ste_port);
 	}
 	return 0;
 }
@@ -1757,6 +2392,8 @@ static int ste_hsi_remove_controller(struct hsi_controller *hsi,
 	struct hsi_port *port = to_hsi_port(&pdev->dev);
 	struct ste_hsi_port *ste_port = hsi_port_drvdata(port);
 
+	ste_hsi_debug_remove_ctrl(hsi);
+
 	if (ste_hsi->regulator)
 		regulator_put(ste_hsi->regulator);
 
@@ -1798,6 +2435,8 @@ static int __init ste_hsi_probe(struct platform_device *pdev)
 	if (pdata->use_dma)
 		ste_hsi_init_dma(pdata, hsi);
 
+	ste_hsi_debug_add_ctrl(hsi);
+
 	return 0;
 
 err_free_controller:
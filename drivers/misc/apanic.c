@@ -37,34 +37,67 @@
 #include <linux/mutex.h>
 #include <linux/workqueue.h>
 #include <linux/preempt.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/genhd.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/zlib.h>
+#include <linux/apanic.h>
 
 extern void ram_console_enable_console(int);
 
+/*
+ * Each section is a zlib stream starting on a write_size boundary.
+ * length is its compressed size, size the size it inflates to.
+ */
+struct apanic_section {
+	char name[16];
+	u32 offset;
+	u32 length;
+	u32 size;
+};
+
 struct panic_header {
 	u32 magic;
 #define PANIC_MAGIC 0xdeadf00d
 
 	u32 version;
-#define PHDR_VERSION   0x01
-
-	u32 console_offset;
-	u32 console_length;
+#define PHDR_VERSION   0x02
 
-	u32 threads_offset;
-	u32 threads_length;
+	u32 nr_sections;
+#define APANIC_MAX_SECTIONS 16
+	struct apanic_section section[APANIC_MAX_SECTIONS];
 };
 
+/* compressor output is written out in chunks of this size */
+#define APANIC_OUT_SIZE		(64 * 1024)
+/* a small window keeps the workspace allocated for panic time small */
+#define APANIC_ZLIB_WBITS	12
+#define APANIC_ZLIB_MEMLEVEL	5
+/* sanity limit on the uncompressed size of a section */
+#define APANIC_MAX_SECTION_SIZE	(32 * 1024 * 1024)
+
 struct apanic_data {
 	struct mtd_info		*mtd;
+	struct block_device	*bdev;
+	unsigned int		write_size;
+	u64			size;
 	struct panic_header	curr;
+	struct panic_header	hdr;
 	void			*bounce;
-	struct proc_dir_entry	*apanic_console;
-	struct proc_dir_entry	*apanic_threads;
+	void			*out;
+	u32			off;
+	z_stream		zstream;
+	struct proc_dir_entry	*proc[APANIC_MAX_SECTIONS];
+	void			*dump[APANIC_MAX_SECTIONS];
+	size_t			dump_len[APANIC_MAX_SECTIONS];
 };
 
 static struct apanic_data drv_ctx;
 static struct work_struct proc_removal_work;
 static DEFINE_MUTEX(drv_mutex);
+static LIST_HEAD(apanic_regions);
 
 static unsigned int *apanic_bbt;
 static unsigned int apanic_erase_blocks;
@@ -138,72 +171,42 @@ static void apanic_erase_callback(struct erase_info *done)
 	wake_up(wait_q);
 }
 
-static int apanic_proc_read(char *buffer, char **start, off_t offset,
-			       int count, int *peof, void *dat)
+static int in_panic = 0;
+
+static int apanic_writeflashpage(struct mtd_info *mtd, loff_t to,
+				 const u_char *buf)
 {
-	struct apanic_data *ctx = &drv_ctx;
-	size_t file_length;
-	off_t file_offset;
-	unsigned int page_no;
-	off_t page_offset;
 	int rc;
-	size_t len;
+	size_t wlen;
+	int panic = in_interrupt() | in_atomic();
 
-	if (!count)
+	if (panic && !mtd->panic_write) {
+		printk(KERN_EMERG "%s: No panic_write available\n", __func__);
+		return 0;
+	} else if (!panic && !mtd->write) {
+		printk(KERN_EMERG "%s: No write available\n", __func__);
 		return 0;
-
-	mutex_lock(&drv_mutex);
-
-	switch ((int) dat) {
-	case 1:	/* apanic_console */
-		file_length = ctx->curr.console_length;
-		file_offset = ctx->curr.console_offset;
-		break;
-	case 2:	/* apanic_threads */
-		file_length = ctx->curr.threads_length;
-		file_offset = ctx->curr.threads_offset;
-		break;
-	default:
-		pr_err("Bad dat (%d)\n", (int) dat);
-		mutex_unlock(&drv_mutex);
-		return -EINVAL;
 	}
 
-	if ((offset + count) > file_length) {
-		mutex_unlock(&drv_mutex);
+	to = phy_offset(mtd, to);
+	if (to == APANIC_INVALID_OFFSET) {
+		printk(KERN_EMERG "apanic: write to invalid address\n");
 		return 0;
 	}
 
-	/* We only support reading a maximum of a flash page */
-	if (count > ctx->mtd->writesize)
-		count = ctx->mtd->writesize;
-
-	page_no = (file_offset + offset) / ctx->mtd->writesize;
-	page_offset = (file_offset + offset) % ctx->mtd->writesize;
-
+	if (panic)
+		rc = mtd->panic_write(mtd, to, mtd->writesize, &wlen, buf);
+	else
+		rc = mtd->write(mtd, to, mtd->writesize, &wlen, buf);
 
-	if (phy_offset(ctx->mtd, (page_no * ctx->mtd->writesize))
-		== APANIC_INVALID_OFFSET) {
-		pr_err("apanic: reading an invalid address\n");
-		mutex_unlock(&drv_mutex);
-		return -EINVAL;
+	if (rc) {
+		printk(KERN_EMERG
+		       "%s: Error writing data to flash (%d)\n",
+		       __func__, rc);
+		return rc;
 	}
-	rc = ctx->mtd->read(ctx->mtd,
-		phy_offset(ctx->mtd, (page_no * ctx->mtd->writesize)),
-		ctx->mtd->writesize,
-		&len, ctx->bounce);
 
-	if (page_offset)
-		count -= page_offset;
-	memcpy(buffer, ctx->bounce + page_offset, count);
-
-	*start = count;
-
-	if ((offset + count) == file_length)
-		*peof = 1;
-
-	mutex_unlock(&drv_mutex);
-	return count;
+	return wlen;
 }
 
 static void mtd_panic_erase(void)
@@ -266,42 +269,277 @@ out:
 	return;
 }
 
-static void apanic_remove_proc_work(struct work_struct *work)
+/*
+ * Read len bytes at off, a multiple of write_size, from the dump
+ * partition.
+ */
+static int apanic_read(struct apanic_data *ctx, u32 off, void *buf,
+		       size_t len)
 {
-	struct apanic_data *ctx = &drv_ctx;
+	while (len) {
+		size_t count = min_t(size_t, len, ctx->write_size);
+
+		if (ctx->mtd) {
+			size_t rlen;
+			int rc;
+
+			if (phy_offset(ctx->mtd, off) == APANIC_INVALID_OFFSET)
+				return -EINVAL;
+			rc = ctx->mtd->read(ctx->mtd, phy_offset(ctx->mtd, off),
+					    ctx->write_size, &rlen,
+					    ctx->bounce);
+			if (rc == -EBADMSG)
+				printk(KERN_WARNING
+				       "apanic: Bad ECC at %x (ignored)\n", off);
+			else if (rc && rc != -EUCLEAN)
+				return rc;
+			memcpy(buf, ctx->bounce, count);
+		} else {
+			struct buffer_head *bh;
+
+			bh = __bread(ctx->bdev, off / ctx->write_size,
+				     ctx->write_size);
+			if (!bh)
+				return -EIO;
+			memcpy(buf, bh->b_data, count);
+			brelse(bh);
+		}
+		off += ctx->write_size;
+		buf += count;
+		len -= count;
+	}
+	return 0;
+}
 
-	mutex_lock(&drv_mutex);
-	mtd_panic_erase();
-	memset(&ctx->curr, 0, sizeof(struct panic_header));
-	if (ctx->apanic_console) {
-		remove_proc_entry("apanic_console", NULL);
-		ctx->apanic_console = NULL;
+/*
+ * Write len bytes, a multiple of write_size, at off.  From panic context
+ * this polls the device through its panic write method.
+ */
+static int apanic_write(struct apanic_data *ctx, u32 off, void *buf,
+			size_t len)
+{
+	int panic = in_interrupt() | in_atomic();
+	struct block_device *bdev = ctx->bdev;
+
+	if (off + len > ctx->size)
+		return -ENOSPC;
+
+	if (ctx->mtd) {
+		for (; len; len -= ctx->write_size) {
+			if (apanic_writeflashpage(ctx->mtd, off, buf) <= 0)
+				return -EIO;
+			off += ctx->write_size;
+			buf += ctx->write_size;
+		}
+		return 0;
 	}
-	if (ctx->apanic_threads) {
-		remove_proc_entry("apanic_threads", NULL);
-		ctx->apanic_threads = NULL;
+
+	if (panic)
+		return bdev->bd_disk->fops->panic_write(bdev, off >> 9, buf,
+							len >> 9);
+
+	for (; len; len -= ctx->write_size) {
+		struct buffer_head *bh;
+
+		bh = __getblk(bdev, off / ctx->write_size, ctx->write_size);
+		if (!bh)
+			return -ENOMEM;
+		lock_buffer(bh);
+		memcpy(bh->b_data, buf, ctx->write_size);
+		set_buffer_uptodate(bh);
+		unlock_buffer(bh);
+		mark_buffer_dirty(bh);
+		sync_dirty_buffer(bh);
+		brelse(bh);
+		off += ctx->write_size;
+		buf += ctx->write_size;
 	}
+	return 0;
+}
+
+static void apanic_erase(struct apanic_data *ctx)
+{
+	if (ctx->mtd) {
+		mtd_panic_erase();
+		return;
+	}
+
+	/* a block device has nothing to erase, forget the header */
+	memset(ctx->bounce, 0, ctx->write_size);
+	if (apanic_write(ctx, 0, ctx->bounce, ctx->write_size))
+		printk(KERN_ERR "apanic: Failed to clear header\n");
+}
+
+static void *apanic_inflate(struct apanic_data *ctx,
+			    struct apanic_section *sec, size_t *len)
+{
+	z_stream strm;
+	void *in, *out = NULL;
+	int rc;
+
+	if (sec->size > APANIC_MAX_SECTION_SIZE || !sec->length ||
+	    (u64)sec->offset + sec->length > ctx->size ||
+	    sec->offset % ctx->write_size) {
+		printk(KERN_ERR "apanic: Bad section %s\n", sec->name);
+		return NULL;
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	in = vmalloc(sec->length);
+	strm.workspace = vmalloc(zlib_inflate_workspacesize());
+	if (!in || !strm.workspace)
+		goto out;
+	if (apanic_read(ctx, sec->offset, in, sec->length)) {
+		printk(KERN_ERR "apanic: Error reading %s\n", sec->name);
+		goto out;
+	}
+	out = vmalloc(sec->size);
+	if (!out)
+		goto out;
+
+	strm.next_in = in;
+	strm.avail_in = sec->length;
+	strm.next_out = out;
+	strm.avail_out = sec->size;
+	zlib_inflateInit2(&strm, APANIC_ZLIB_WBITS);
+	rc = zlib_inflate(&strm, Z_FINISH);
+	if (rc != Z_STREAM_END)
+		printk(KERN_WARNING "apanic: %s truncated (%d)\n",
+		       sec->name, rc);
+	*len = strm.total_out;
+	zlib_inflateEnd(&strm);
+	if (!*len) {
+		vfree(out);
+		out = NULL;
+	}
+out:
+	vfree(strm.workspace);
+	vfree(in);
+	return out;
+}
+
+static ssize_t apanic_proc_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct apanic_data *ctx = &drv_ctx;
+	int i = (long)PDE(file->f_path.dentry->d_inode)->data;
+	ssize_t rc = 0;
+
+	mutex_lock(&drv_mutex);
+	if (ctx->dump[i])
+		rc = simple_read_from_buffer(buf, count, ppos, ctx->dump[i],
+					     ctx->dump_len[i]);
 	mutex_unlock(&drv_mutex);
+	return rc;
 }
 
-static int apanic_proc_write(struct file *file, const char __user *buffer,
-				unsigned long count, void *data)
+static ssize_t apanic_proc_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
 {
 	schedule_work(&proc_removal_work);
 	return count;
 }
 
-static void mtd_panic_notify_add(struct mtd_info *mtd)
+static const struct file_operations apanic_proc_fops = {
+	.owner	= THIS_MODULE,
+	.read	= apanic_proc_read,
+	.write	= apanic_proc_write,
+};
+
+static void apanic_remove_proc_work(struct work_struct *work)
 {
 	struct apanic_data *ctx = &drv_ctx;
+	char name[32];
+	int i;
+
+	mutex_lock(&drv_mutex);
+	apanic_erase(ctx);
+	for (i = 0; i < APANIC_MAX_SECTIONS; i++) {
+		if (ctx->proc[i]) {
+			snprintf(name, sizeof(name), "apanic_%s",
+				 ctx->curr.section[i].name);
+			remove_proc_entry(name, NULL);
+			ctx->proc[i] = NULL;
+		}
+		vfree(ctx->dump[i]);
+		ctx->dump[i] = NULL;
+	}
+	memset(&ctx->curr, 0, sizeof(struct panic_header));
+	mutex_unlock(&drv_mutex);
+}
+
+/*
+ * Check the header read into ctx->bounce and publish the sections of a
+ * previous dump in /proc.  Called with drv_mutex held.
+ */
+static void apanic_load_dump(struct apanic_data *ctx)
+{
 	struct panic_header *hdr = ctx->bounce;
+	int proc_entry_created = 0;
+	char name[32];
+	int i;
+
+	if (hdr->magic != PANIC_MAGIC) {
+		printk(KERN_INFO "apanic: No panic data available\n");
+		apanic_erase(ctx);
+		return;
+	}
+
+	if (hdr->version != PHDR_VERSION ||
+	    hdr->nr_sections > APANIC_MAX_SECTIONS) {
+		printk(KERN_INFO "apanic: Version mismatch (%d != %d)\n",
+		       hdr->version, PHDR_VERSION);
+		apanic_erase(ctx);
+		return;
+	}
+
+	memcpy(&ctx->curr, hdr, sizeof(struct panic_header));
+
+	for (i = 0; i < ctx->curr.nr_sections; i++) {
+		struct apanic_section *sec = &ctx->curr.section[i];
+
+		sec->name[sizeof(sec->name) - 1] = '\0';
+		printk(KERN_INFO "apanic: %s(%u, %u -> %u)\n", sec->name,
+		       sec->offset, sec->length, sec->size);
+
+		ctx->dump[i] = apanic_inflate(ctx, sec, &ctx->dump_len[i]);
+		if (!ctx->dump[i])
+			continue;
+
+		snprintf(name, sizeof(name), "apanic_%s", sec->name);
+		ctx->proc[i] = proc_create_data(name, S_IFREG | S_IRUGO, NULL,
+						&apanic_proc_fops,
+						(void *)(long)i);
+		if (!ctx->proc[i]) {
+			printk(KERN_ERR "%s: failed creating procfile\n",
+			       __func__);
+			vfree(ctx->dump[i]);
+			ctx->dump[i] = NULL;
+			continue;
+		}
+		ctx->proc[i]->size = ctx->dump_len[i];
+		proc_entry_created = 1;
+	}
+
+	if (!proc_entry_created)
+		apanic_erase(ctx);
+}
+
+static void mtd_panic_notify_add(struct mtd_info *mtd)
+{
+	struct apanic_data *ctx = &drv_ctx;
 	size_t len;
 	int rc;
-	int    proc_entry_created = 0;
 
 	if (strcmp(mtd->name, CONFIG_APANIC_PLABEL))
 		return;
 
+	mutex_lock(&drv_mutex);
+	if (ctx->bdev) {
+		mutex_unlock(&drv_mutex);
+		return;
+	}
+
 	ctx->mtd = mtd;
 
 	alloc_bbt(mtd, apanic_bbt);
@@ -312,6 +550,9 @@ static void mtd_panic_notify_add(struct mtd_info *mtd)
 		goto out_err;
 	}
 
+	ctx->write_size = mtd->writesize;
+	ctx->size = (u64)apanic_good_blocks << mtd->erasesize_shift;
+
 	rc = mtd->read(mtd, phy_offset(mtd, 0), mtd->writesize,
 			&len, ctx->bounce);
 	if (rc && rc == -EBADMSG) {
@@ -329,61 +570,12 @@ static void mtd_panic_notify_add(struct mtd_info *mtd)
 
 	printk(KERN_INFO "apanic: Bound to mtd partition '%s'\n", mtd->name);
 
-	if (hdr->magic != PANIC_MAGIC) {
-		printk(KERN_INFO "apanic: No panic data available\n");
-		mtd_panic_erase();
-		return;
-	}
-
-	if (hdr->version != PHDR_VERSION) {
-		printk(KERN_INFO "apanic: Version mismatch (%d != %d)\n",
-		       hdr->version, PHDR_VERSION);
-		mtd_panic_erase();
-		return;
-	}
-
-	memcpy(&ctx->curr, hdr, sizeof(struct panic_header));
-
-	printk(KERN_INFO "apanic: c(%u, %u) t(%u, %u)\n",
-	       hdr->console_offset, hdr->console_length,
-	       hdr->threads_offset, hdr->threads_length);
-
-	if (hdr->console_length) {
-		ctx->apanic_console = create_proc_entry("apanic_console",
-						      S_IFREG | S_IRUGO, NULL);
-		if (!ctx->apanic_console)
-			printk(KERN_ERR "%s: failed creating procfile\n",
-			       __func__);
-		else {
-			ctx->apanic_console->read_proc = apanic_proc_read;
-			ctx->apanic_console->write_proc = apanic_proc_write;
-			ctx->apanic_console->size = hdr->console_length;
-			ctx->apanic_console->data = (void *) 1;
-			proc_entry_created = 1;
-		}
-	}
-
-	if (hdr->threads_length) {
-		ctx->apanic_threads = create_proc_entry("apanic_threads",
-						       S_IFREG | S_IRUGO, NULL);
-		if (!ctx->apanic_threads)
-			printk(KERN_ERR "%s: failed creating procfile\n",
-			       __func__);
-		else {
-			ctx->apanic_threads->read_proc = apanic_proc_read;
-			ctx->apanic_threads->write_proc = apanic_proc_write;
-			ctx->apanic_threads->size = hdr->threads_length;
-			ctx->apanic_threads->data = (void *) 2;
-			proc_entry_created = 1;
-		}
-	}
-
-	if (!proc_entry_created)
-		mtd_panic_erase();
-
+	apanic_load_dump(ctx);
+	mutex_unlock(&drv_mutex);
 	return;
 out_err:
 	ctx->mtd = NULL;
+	mutex_unlock(&drv_mutex);
 }
 
 static void mtd_panic_notify_remove(struct mtd_info *mtd)
@@ -400,99 +592,206 @@ static struct mtd_notifier mtd_panic_notifier = {
 	.remove	= mtd_panic_notify_remove,
 };
 
-static int in_panic = 0;
+/*
+ * eMMC partitions show up asynchronously and there is no notifier for
+ * them, so look for the dump partition for a while after boot.  It is
+ * matched by its label, or by its name, e.g. "mmcblk0p12".
+ */
+#define APANIC_BIND_TRIES	30
 
-static int apanic_writeflashpage(struct mtd_info *mtd, loff_t to,
-				 const u_char *buf)
+static void apanic_blk_bind_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(apanic_blk_bind, apanic_blk_bind_work);
+static int apanic_blk_bind_tries;
+
+static dev_t apanic_find_blkdev(void)
 {
-	int rc;
-	size_t wlen;
-	int panic = in_interrupt() | in_atomic();
+	struct class_dev_iter iter;
+	struct device *dev;
+	dev_t devt = 0;
+
+	class_dev_iter_init(&iter, &block_class, NULL, &part_type);
+	while ((dev = class_dev_iter_next(&iter))) {
+		struct hd_struct *part = dev_to_part(dev);
+
+		if ((part->info && !strcmp((char *)part->info->volname,
+					   CONFIG_APANIC_PLABEL)) ||
+		    !strcmp(dev_name(dev), CONFIG_APANIC_PLABEL)) {
+			devt = dev->devt;
+			break;
+		}
+	}
+	class_dev_iter_exit(&iter);
 
-	if (panic && !mtd->panic_write) {
-		printk(KERN_EMERG "%s: No panic_write available\n", __func__);
-		return 0;
-	} else if (!panic && !mtd->write) {
-		printk(KERN_EMERG "%s: No write available\n", __func__);
-		return 0;
+	return devt;
+}
+
+static void apanic_blk_bind_work(struct work_struct *work)
+{
+	struct apanic_data *ctx = &drv_ctx;
+	struct block_device *bdev;
+	dev_t devt;
+
+	mutex_lock(&drv_mutex);
+	if (ctx->mtd)
+		goto out;
+
+	devt = apanic_find_blkdev();
+	if (!devt) {
+		if (++apanic_blk_bind_tries < APANIC_BIND_TRIES)
+			schedule_delayed_work(&apanic_blk_bind, HZ);
+		goto out;
 	}
 
-	to = phy_offset(mtd, to);
-	if (to == APANIC_INVALID_OFFSET) {
-		printk(KERN_EMERG "apanic: write to invalid address\n");
-		return 0;
+	bdev = blkdev_get_by_dev(devt, FMODE_READ | FMODE_WRITE, NULL);
+	if (IS_ERR(bdev)) {
+		printk(KERN_ERR "apanic: Failed to open %s (%ld)\n",
+		       CONFIG_APANIC_PLABEL, PTR_ERR(bdev));
+		goto out;
+	}
+	if (!bdev->bd_disk->fops->panic_write ||
+	    set_blocksize(bdev, PAGE_SIZE)) {
+		printk(KERN_ERR "apanic: %s can't be written at panic time\n",
+		       CONFIG_APANIC_PLABEL);
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE);
+		goto out;
 	}
 
-	if (panic)
-		rc = mtd->panic_write(mtd, to, mtd->writesize, &wlen, buf);
-	else
-		rc = mtd->write(mtd, to, mtd->writesize, &wlen, buf);
+	ctx->bdev = bdev;
+	ctx->write_size = PAGE_SIZE;
+	ctx->size = i_size_read(bdev->bd_inode);
+	printk(KERN_INFO "apanic: Bound to block device '%s'\n",
+	       CONFIG_APANIC_PLABEL);
 
-	if (rc) {
-		printk(KERN_EMERG
-		       "%s: Error writing data to flash (%d)\n",
-		       __func__, rc);
-		return rc;
+	if (apanic_read(ctx, 0, ctx->bounce, ctx->write_size)) {
+		printk(KERN_ERR "apanic: Error reading header\n");
+		goto out;
 	}
-
-	return wlen;
+	apanic_load_dump(ctx);
+out:
+	mutex_unlock(&drv_mutex);
 }
 
 extern int log_buf_copy(char *dest, int idx, int len);
 extern void log_buf_clear(void);
 
+static struct apanic_section *apanic_begin_section(struct apanic_data *ctx,
+						   const char *name)
+{
+	struct apanic_section *sec;
+
+	if (ctx->hdr.nr_sections == APANIC_MAX_SECTIONS)
+		return NULL;
+
+	sec = &ctx->hdr.section[ctx->hdr.nr_sections];
+	strlcpy(sec->name, name, sizeof(sec->name));
+	sec->offset = ctx->off;
+	zlib_deflateReset(&ctx->zstream);
+	ctx->zstream.next_out = ctx->out;
+	ctx->zstream.avail_out = APANIC_OUT_SIZE;
+	return sec;
+}
+
 /*
- * Writes the contents of the console to the specified offset in flash.
- * Returns number of bytes written
+ * Compress len bytes of data into the current section, writing out the
+ * output buffer whenever it fills up.  Z_FINISH ends the section.
  */
-static int apanic_write_console(struct mtd_info *mtd, unsigned int off)
+static int apanic_compress(struct apanic_data *ctx, const void *data,
+			   size_t len, int flush)
 {
-	struct apanic_data *ctx = &drv_ctx;
+	z_stream *strm = &ctx->zstream;
+	int rc;
+
+	strm->next_in = data;
+	strm->avail_in = len;
+	do {
+		rc = zlib_deflate(strm, flush);
+		if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+			return -EIO;
+		if (!strm->avail_out || rc == Z_STREAM_END) {
+			size_t out = APANIC_OUT_SIZE - strm->avail_out;
+			size_t padded = ALIGN(out, ctx->write_size);
+			int err;
+
+			memset(ctx->out + out, 0, padded - out);
+			err = apanic_write(ctx, ctx->off, ctx->out, padded);
+			if (err)
+				return err;
+			ctx->off += padded;
+			strm->next_out = ctx->out;
+			strm->avail_out = APANIC_OUT_SIZE;
+		}
+	} while (strm->avail_in || (flush == Z_FINISH && rc != Z_STREAM_END));
+
+	return 0;
+}
+
+static void apanic_end_section(struct apanic_data *ctx,
+			       struct apanic_section *sec, int err)
+{
+	if (!err)
+		err = apanic_compress(ctx, NULL, 0, Z_FINISH);
+	if (err)
+		printk(KERN_EMERG "apanic: Error writing %s (%d)\n",
+		       sec->name, err);
+
+	/* what made it out of a failed section can still be inflated */
+	sec->length = err ? ctx->off - sec->offset : ctx->zstream.total_out;
+	sec->size = ctx->zstream.total_in;
+	if (sec->length)
+		ctx->hdr.nr_sections++;
+}
+
+/*
+ * Compresses the contents of the console into a new section.
+ */
+static void apanic_write_console(struct apanic_data *ctx, const char *name)
+{
+	struct apanic_section *sec;
 	int saved_oip;
 	int idx = 0;
-	int rc, rc2;
-	unsigned int last_chunk = 0;
+	int rc, err = 0;
+
+	sec = apanic_begin_section(ctx, name);
+	if (!sec)
+		return;
 
-	while (!last_chunk) {
+	for (;;) {
 		saved_oip = oops_in_progress;
 		oops_in_progress = 1;
-		rc = log_buf_copy(ctx->bounce, idx, mtd->writesize);
-		if (rc < 0)
-			break;
-
-		if (rc != mtd->writesize)
-			last_chunk = rc;
-
+		rc = log_buf_copy(ctx->bounce, idx, PAGE_SIZE);
 		oops_in_progress = saved_oip;
 		if (rc <= 0)
 			break;
-		if (rc != mtd->writesize)
-			memset(ctx->bounce + rc, 0, mtd->writesize - rc);
-
-		rc2 = apanic_writeflashpage(mtd, off, ctx->bounce);
-		if (rc2 <= 0) {
-			printk(KERN_EMERG
-			       "apanic: Flash write failed (%d)\n", rc2);
-			return idx;
-		}
-		if (!last_chunk)
-			idx += rc2;
-		else
-			idx += last_chunk;
-		off += rc2;
+
+		err = apanic_compress(ctx, ctx->bounce, rc, Z_NO_FLUSH);
+		if (err)
+			break;
+		idx += rc;
+		if (rc != PAGE_SIZE)
+			break;
+	}
+	apanic_end_section(ctx, sec, err);
+}
+
+static void apanic_write_regions(struct apanic_data *ctx)
+{
+	struct apanic_region *region;
+	struct apanic_section *sec;
+
+	list_for_each_entry(region, &apanic_regions, list) {
+		sec = apanic_begin_section(ctx, region->name);
+		if (!sec)
+			return;
+		apanic_end_section(ctx, sec,
+			apanic_compress(ctx, region->data, region->size,
+					Z_NO_FLUSH));
 	}
-	return idx;
 }
 
 static int apanic(struct notifier_block *this, unsigned long event,
 			void *ptr)
 {
 	struct apanic_data *ctx = &drv_ctx;
-	struct panic_header *hdr = (struct panic_header *) ctx->bounce;
-	int console_offset = 0;
-	int console_len = 0;
-	int threads_offset = 0;
-	int threads_len = 0;
 	int rc;
 
 	if (in_panic)
@@ -504,59 +803,46 @@ static int apanic(struct notifier_block *this, unsigned long event,
 #endif
 	touch_softlockup_watchdog();
 
-	if (!ctx->mtd)
+	if (!ctx->mtd && !ctx->bdev)
 		goto out;
 
 	if (ctx->curr.magic) {
 		printk(KERN_EMERG "Crash partition in use!\n");
 		goto out;
 	}
-	console_offset = ctx->mtd->writesize;
+
+	memset(&ctx->hdr, 0, sizeof(ctx->hdr));
+	ctx->off = ctx->write_size;
 
 	/*
 	 * Write out the console
 	 */
-	console_len = apanic_write_console(ctx->mtd, console_offset);
-	if (console_len < 0) {
-		printk(KERN_EMERG "Error writing console to panic log! (%d)\n",
-		       console_len);
-		console_len = 0;
-	}
+	apanic_write_console(ctx, "console");
 
 	/*
 	 * Write out all threads
 	 */
-	threads_offset = ALIGN(console_offset + console_len,
-			       ctx->mtd->writesize);
-	if (!threads_offset)
-		threads_offset = ctx->mtd->writesize;
-
 	ram_console_enable_console(0);
 
 	log_buf_clear();
 	show_state_filter(0);
-	threads_len = apanic_write_console(ctx->mtd, threads_offset);
-	if (threads_len < 0) {
-		printk(KERN_EMERG "Error writing threads to panic log! (%d)\n",
-		       threads_len);
-		threads_len = 0;
-	}
+	apanic_write_console(ctx, "threads");
 
 	/*
-	 * Finally write the panic header
+	 * Write out the registered memory regions
 	 */
-	memset(ctx->bounce, 0, PAGE_SIZE);
-	hdr->magic = PANIC_MAGIC;
-	hdr->version = PHDR_VERSION;
-
-	hdr->console_offset = console_offset;
-	hdr->console_length = console_len;
+	apanic_write_regions(ctx);
 
-	hdr->threads_offset = threads_offset;
-	hdr->threads_length = threads_len;
+	/*
+	 * Finally write the panic header
+	 */
+	memset(ctx->bounce, 0, ctx->write_size);
+	ctx->hdr.magic = PANIC_MAGIC;
+	ctx->hdr.version = PHDR_VERSION;
+	memcpy(ctx->bounce, &ctx->hdr, sizeof(ctx->hdr));
 
-	rc = apanic_writeflashpage(ctx->mtd, 0, ctx->bounce);
-	if (rc <= 0) {
+	rc = apanic_write(ctx, 0, ctx->bounce, ctx->write_size);
+	if (rc) {
 		printk(KERN_EMERG "apanic: Header write failed (%d)\n",
 		       rc);
 		goto out;
@@ -590,17 +876,63 @@ static int panic_dbg_set(void *data, u64 val)
 
 DEFINE_SIMPLE_ATTRIBUTE(panic_dbg_fops, panic_dbg_get, panic_dbg_set, "%llu\n");
 
+/**
+ * apanic_register_region - save a memory region in panic dumps
+ * @region: region to save, which must stay valid
+ *
+ * The region is saved in a section of its own, shown in
+ * /proc/apanic_<name> after the next boot.
+ */
+int apanic_register_region(struct apanic_region *region)
+{
+	if (strlen(region->name) >= sizeof(((struct apanic_section *)0)->name))
+		return -EINVAL;
+
+	mutex_lock(&drv_mutex);
+	list_add_tail(&region->list, &apanic_regions);
+	mutex_unlock(&drv_mutex);
+	return 0;
+}
+
 int __init apanic_init(void)
 {
+	void *workspace;
+
+	BUILD_BUG_ON(sizeof(struct panic_header) > 512);
+
+	memset(&drv_ctx, 0, sizeof(drv_ctx));
+	drv_ctx.bounce = (void *) __get_free_page(GFP_KERNEL);
+	drv_ctx.out = kmalloc(APANIC_OUT_SIZE, GFP_KERNEL);
+	/* nothing can be allocated at panic time */
+	workspace = vmalloc(zlib_deflate_workspacesize(APANIC_ZLIB_WBITS,
+						       APANIC_ZLIB_MEMLEVEL));
+	if (!drv_ctx.bounce || !drv_ctx.out || !workspace) {
+		printk(KERN_ERR "apanic: Failed to allocate buffers\n");
+		goto err_free;
+	}
+	drv_ctx.zstream.workspace = workspace;
+	if (zlib_deflateInit2(&drv_ctx.zstream, Z_DEFAULT_COMPRESSION,
+			      Z_DEFLATED, APANIC_ZLIB_WBITS,
+			      APANIC_ZLIB_MEMLEVEL,
+			      Z_DEFAULT_STRATEGY) != Z_OK) {
+		printk(KERN_ERR "apanic: Failed to set up compression\n");
+		goto err_free;
+	}
+
 	register_mtd_user(&mtd_panic_notifier);
+	schedule_delayed_work(&apanic_blk_bind, 0);
 	atomic_notifier_chain_register(&panic_notifier_list, &panic_blk);
 	debugfs_create_file("apanic", 0644, NULL, NULL, &panic_dbg_fops);
-	memset(&drv_ctx, 0, sizeof(drv_ctx));
-	drv_ctx.bounce = (void *) __get_free_page(GFP_KERNEL);
 	INIT_WORK(&proc_removal_work, apanic_remove_proc_work);
 	printk(KERN_INFO "Android kernel panic handler initialized (bind=%s)\n",
 	       CONFIG_APANIC_PLABEL);
 	return 0;
+
+err_free:
+	vfree(workspace);
+	kfree(drv_ctx.out);
+	free_page((unsigned long)drv_ctx.bounce);
+	return -ENOMEM;
 }
 
 module_init(apanic_init);
@@ -19,6 +19,12 @@
 #include <linux/uaccess.h>
 #include <linux/mman.h>
 #include <linux/io.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
+#include <linux/scatterlist.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <crypto/hash.h>
 
 #include <mach/mloader-dbx500.h>
 #include <linux/mloader.h>
@@ -26,6 +32,39 @@
 
 #define DEVICE_NAME "dbx500_mloader_fw"
 
+/*
+ * Firmwares are copied and digested MLOADER_CHUNK_PAGES at a time: while
+ * the DMA engine copies chunk n, the CPU (or hash engine) digests it, and
+ * chunk n - 1 is reaped, so the digest costs no extra pass over the image.
+ */
+#define MLOADER_CHUNK_PAGES	32
+#define MLOADER_DMA_TIMEOUT	msecs_to_jiffies(1000)
+#define MLOADER_MAX_DIGEST	64
+
+struct mloader_chunk {
+	struct scatterlist src[MLOADER_CHUNK_PAGES];
+	struct scatterlist dst[MLOADER_CHUNK_PAGES];
+	unsigned int nents;
+	size_t offset;
+	size_t len;
+	bool mapped;
+	struct completion done;
+};
+
+struct mloader_load {
+	const struct firmware *fw;
+	struct dbx500_ml_fw *fw_info;
+	void __iomem *ioaddr;
+	struct mloader_chunk chunk[2];
+	struct ahash_request *req;
+	struct completion hash_done;
+	int hash_err;
+	int hash_ret;
+	u8 digest[MLOADER_MAX_DIGEST];
+	const struct firmware *sum;
+	struct completion sum_done;
+};
+
 struct mloader_priv {
 	struct platform_device *pdev;
 	struct dbx500_mloader_pdata *pdata;
@@ -33,53 +72,362 @@ struct mloader_priv {
 	u32 aeras_size;
 	void __iomem *uid_base;
 	u8 size;
+	struct dma_chan *dma_chan;
+	struct crypto_ahash *tfm;
+	unsigned int uploads;
 };
 
 static struct mloader_priv *mloader_priv;
 
+static void mloader_dma_done(void *data)
+{
+	struct mloader_chunk *chunk = data;
+
+	complete(&chunk->done);
+}
+
+static void mloader_chunk_unmap(struct mloader_chunk *chunk)
+{
+	if (!chunk->mapped)
+		return;
+	dma_unmap_sg(mloader_priv->dma_chan->device->dev, chunk->src,
+			chunk->nents, DMA_TO_DEVICE);
+	chunk->mapped = false;
+}
+
+/* describe bytes [offset, offset + len) of the image, one entry per page */
+static void mloader_chunk_init(struct mloader_load *ld,
+		struct mloader_chunk *chunk, size_t offset, size_t len)
+{
+	const struct firmware *fw = ld->fw;
+	size_t pos, seg;
+	unsigned int i;
+
+	chunk->offset = offset;
+	chunk->len = len;
+	chunk->nents = DIV_ROUND_UP(len, PAGE_SIZE);
+	sg_init_table(chunk->src, chunk->nents);
+	for (i = 0, pos = offset; i < chunk->nents; i++, pos += seg) {
+		seg = min_t(size_t, PAGE_SIZE, offset + len - pos);
+		/* builtin firmwares are not backed by pages */
+		if (fw->pages)
+			sg_set_page(&chunk->src[i], fw->pages[pos >> PAGE_SHIFT],
+					seg, 0);
+		else
+			sg_set_buf(&chunk->src[i], fw->data + pos, seg);
+	}
+}
+
+static int mloader_chunk_copy(struct mloader_load *ld,
+		struct mloader_chunk *chunk)
+{
+	struct dma_chan *chan = mloader_priv->dma_chan;
+	struct dma_async_tx_descriptor *desc;
+	dma_addr_t dst;
+	unsigned int i;
+
+	if (!chan) {
+		memcpy_toio(ld->ioaddr + chunk->offset,
+				ld->fw->data + chunk->offset, chunk->len);
+		return 0;
+	}
+
+	if (dma_map_sg(chan->device->dev, chunk->src, chunk->nents,
+				DMA_TO_DEVICE) != chunk->nents)
+		return -ENOMEM;
+	chunk->mapped = true;
+
+	/* the modem area is not kernel memory, its bus address is physical */
+	dst = ld->fw_info->area->start + ld->fw_info->offset + chunk->offset;
+	sg_init_table(chunk->dst, chunk->nents);
+	for (i = 0; i < chunk->nents; i++) {
+		sg_dma_address(&chunk->dst[i]) = dst;
+		sg_dma_len(&chunk->dst[i]) = sg_dma_len(&chunk->src[i]);
+		dst += sg_dma_len(&chunk->src[i]);
+	}
+
+	desc = chan->device->device_prep_dma_sg(chan,
+			chunk->dst, chunk->nents, chunk->src, chunk->nents,
+			DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!desc)
+		return -EBUSY;
+
+	INIT_COMPLETION(chunk->done);
+	desc->callback = mloader_dma_done;
+	desc->callback_param = chunk;
+	if (dma_submit_error(desc->tx_submit(desc)))
+		return -EIO;
+	dma_async_issue_pending(chan);
+
+	return 0;
+}
+
+static int mloader_chunk_reap(struct mloader_chunk *chunk)
+{
+	int ret = 0;
+
+	if (!chunk->mapped)
+		return 0;
+	if (!wait_for_completion_timeout(&chunk->done, MLOADER_DMA_TIMEOUT)) {
+		dmaengine_terminate_all(mloader_priv->dma_chan);
+		ret = -ETIMEDOUT;
+	}
+	mloader_chunk_unmap(chunk);
+
+	return ret;
+}
+
+static void mloader_hash_done(struct crypto_async_request *areq, int err)
+{
+	struct mloader_load *ld = areq->data;
+
+	if (err == -EINPROGRESS)
+		return;
+	ld->hash_err = err;
+	complete(&ld->hash_done);
+}
+
+/* wait for the last hash operation, which may still be running */
+static int mloader_hash_wait(struct mloader_load *ld)
+{
+	int ret = ld->hash_ret;
+
+	if (ret == -EINPROGRESS || ret == -EBUSY) {
+		wait_for_completion(&ld->hash_done);
+		INIT_COMPLETION(ld->hash_done);
+		ret = ld->hash_err;
+	}
+	ld->hash_ret = 0;
+
+	return ret;
+}
+
+static int mloader_hash_update(struct mloader_load *ld,
+		struct mloader_chunk *chunk)
+{
+	int ret;
+
+	if (!ld->req)
+		return 0;
+	ret = mloader_hash_wait(ld);
+	if (ret)
+		return ret;
+	ahash_request_set_crypt(ld->req, chunk->src, NULL, chunk->len);
+	ld->hash_ret = crypto_ahash_update(ld->req);
+	if (ld->hash_ret == -EINPROGRESS || ld->hash_ret == -EBUSY)
+		return 0;
+
+	return ld->hash_ret;
+}
+
+static void mloader_sum_loaded(const struct firmware *fw, void *context)
+{
+	struct mloader_load *ld = context;
+
+	ld->sum = fw;
+	complete(&ld->sum_done);
+}
+
+/* the digest file is looked up while the image is being copied */
+static int mloader_hash_start(struct mloader_load *ld)
+{
+	struct device *dev = &mloader_priv->pdev->dev;
+	char *name;
+	int ret;
+
+	ld->req = ahash_request_alloc(mloader_priv->tfm, GFP_KERNEL);
+	if (!ld->req)
+		return -ENOMEM;
+	init_completion(&ld->hash_done);
+	ahash_request_set_callback(ld->req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+			mloader_hash_done, ld);
+	ld->hash_ret = crypto_ahash_init(ld->req);
+	ret = mloader_hash_wait(ld);
+	if (ret)
+		return ret;
+
+	init_completion(&ld->sum_done);
+	name = kasprintf(GFP_KERNEL, "%s.%s", ld->fw_info->name,
+			mloader_priv->pdata->hash_alg);
+	if (!name ||
+	    request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG, name,
+			dev, GFP_KERNEL, ld, mloader_sum_loaded))
+		complete(&ld->sum_done);
+	kfree(name);
+
+	return 0;
+}
+
+static int mloader_hash_check(struct mloader_load *ld)
+{
+	struct device *dev = &mloader_priv->pdev->dev;
+	unsigned int ds = crypto_ahash_digestsize(mloader_priv->tfm);
+	u8 expected[MLOADER_MAX_DIGEST];
+	char hex[2 * MLOADER_MAX_DIGEST + 1], *p = hex;
+	unsigned int i;
+	int ret;
+
+	ret = mloader_hash_wait(ld);
+	if (!ret) {
+		ahash_request_set_crypt(ld->req, NULL, ld->digest, 0);
+		ld->hash_ret = crypto_ahash_final(ld->req);
+		ret = mloader_hash_wait(ld);
+	}
+
+	wait_for_completion(&ld->sum_done);
+	if (ret) {
+		dev_err(dev, "fw:%s digest failed, %d\n", ld->fw_info->name, ret);
+		goto out;
+	}
+
+	if (!ld->sum) {
+		for (i = 0; i < ds; i++)
+			p = pack_hex_byte(p, ld->digest[i]);
+		*p = '\0';
+		dev_dbg(dev, "fw:%s %s %s\n", ld->fw_info->name,
+				mloader_priv->pdata->hash_alg, hex);
+		goto out;
+	}
+	if (ld->sum->size < 2 * ds) {
+		dev_err(dev, "fw:%s digest file is too short\n",
+				ld->fw_info->name);
+		ret = -EINVAL;
+		goto out;
+	}
+	hex2bin(expected, (const char *)ld->sum->data, ds);
+	if (memcmp(expected, ld->digest, ds)) {
+		dev_err(dev, "fw:%s %s mismatch\n", ld->fw_info->name,
+				mloader_priv->pdata->hash_alg);
+		ret = -EBADMSG;
+	}
+
+out:
+	release_firmware(ld->sum);
+	return ret;
+}
+
+static int mloader_fw_copy(struct mloader_load *ld)
+{
+	size_t size = ld->fw->size;
+	size_t chunk_size = MLOADER_CHUNK_PAGES * PAGE_SIZE;
+	size_t offset;
+	struct mloader_chunk *chunk, *prev = NULL;
+	int i, ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(ld->chunk); i++)
+		init_completion(&ld->chunk[i].done);
+
+	for (i = 0, offset = 0; offset < size; i++, offset += chunk_size) {
+		chunk = &ld->chunk[i & 1];
+		mloader_chunk_init(ld, chunk,
+				offset, min(chunk_size, size - offset));
+
+		ret = mloader_chunk_copy(ld, chunk);
+		if (ret)
+			break;
+		ret = mloader_hash_update(ld, chunk);
+		if (ret)
+			break;
+		if (prev) {
+			ret = mloader_chunk_reap(prev);
+			if (ret)
+				break;
+		}
+		prev = chunk;
+	}
+
+	if (!ret && prev)
+		return mloader_chunk_reap(prev);
+
+	if (mloader_priv->dma_chan)
+		dmaengine_terminate_all(mloader_priv->dma_chan);
+	for (i = 0; i < ARRAY_SIZE(ld->chunk); i++)
+		mloader_chunk_unmap(&ld->chunk[i]);
+	return ret;
+}
+
 static int mloader_fw_send(struct dbx500_ml_fw *fw_info)
 {
-	const struct firmware *fw;
+	struct device *dev = &mloader_priv->pdev->dev;
+	struct mloader_load *ld;
 	unsigned long size;
 	unsigned long phys_start;
-	void *fw_data;
-	void *vaddr;
-	void __iomem *ioaddr;
+	void __iomem *ioaddr = NULL;
+	ktime_t start, loaded, copied;
 	int ret;
 
-	ret = request_firmware(&fw, fw_info->name, &mloader_priv->pdev->dev);
+	ld = kzalloc(sizeof(*ld), GFP_KERNEL);
+	if (!ld)
+		return -ENOMEM;
+	ld->fw_info = fw_info;
+
+	start = ktime_get();
+	ret = request_firmware(&ld->fw, fw_info->name, dev);
 	if (ret) {
-		dev_err(&mloader_priv->pdev->dev, "request firmware failed\n");
+		dev_err(dev, "request firmware failed\n");
 		goto out;
 	}
+	loaded = ktime_get();
 
-	if (fw->size > (fw_info->area->size - fw_info->offset)) {
-		dev_err(&mloader_priv->pdev->dev,
-				"fw:%s is too big for:%s\n",
+	if (ld->fw->size > (fw_info->area->size - fw_info->offset)) {
+		dev_err(dev, "fw:%s is too big for:%s\n",
 				fw_info->name, fw_info->area->name);
 		ret = -EINVAL;
 		goto err_fw;
 	}
 
-	size = PAGE_ALIGN(fw->size);
-	phys_start = fw_info->area->start + fw_info->offset;
-	phys_start &= PAGE_MASK;
-	ioaddr = ioremap(phys_start, size);
-	if (!ioaddr) {
-		dev_err(&mloader_priv->pdev->dev,
-				"failed remap memory region.\n");
-		ret = -EINVAL;
-		goto err_fw;
+	if (!mloader_priv->dma_chan) {
+		size = PAGE_ALIGN(ld->fw->size);
+		phys_start = fw_info->area->start + fw_info->offset;
+		phys_start &= PAGE_MASK;
+		ioaddr = ioremap(phys_start, size);
+		if (!ioaddr) {
+			dev_err(dev, "failed remap memory region.\n");
+			ret = -EINVAL;
+			goto err_fw;
+		}
+		ld->ioaddr = ioaddr + (fw_info->offset & ~PAGE_MASK);
 	}
 
-	vaddr = ioaddr + (fw_info->offset & ~PAGE_MASK);
-	fw_data = (void *)fw->data;
-	memcpy_toio(vaddr, fw_data, fw->size);
-	iounmap(ioaddr);
+	if (mloader_priv->tfm) {
+		ret = mloader_hash_start(ld);
+		if (ret) {
+			dev_err(dev, "fw:%s digest init failed, %d\n",
+					fw_info->name, ret);
+			goto err_unmap;
+		}
+	}
+
+	ret = mloader_fw_copy(ld);
+	if (ret)
+		dev_err(dev, "fw:%s copy failed, %d\n", fw_info->name, ret);
+	copied = ktime_get();
+
+	if (ld->req) {
+		int err = mloader_hash_check(ld);
 
+		if (!ret)
+			ret = err;
+	}
+
+	if (!ret)
+		dev_info(dev, "fw:%s %zu bytes in %lld us (request %lld us, "
+				"%s copy %lld us, digest tail %lld us)\n",
+				fw_info->name, ld->fw->size,
+				ktime_us_delta(ktime_get(), start),
+				ktime_us_delta(loaded, start),
+				mloader_priv->dma_chan ? "dma" : "cpu",
+				ktime_us_delta(copied, loaded),
+				ld->req ? ktime_us_delta(ktime_get(), copied) : 0);
+
+err_unmap:
+	ahash_request_free(ld->req);
+	if (ioaddr)
+		iounmap(ioaddr);
 err_fw:
-	release_firmware(fw);
+	release_firmware(ld->fw);
 out:
+	kfree(ld);
 	return ret;
 }
 
@@ -87,6 +435,22 @@ static int mloader_fw_upload(void)
 {
 	int i, ret;
 	struct dbx500_mloader_pdata *pdata = mloader_priv->pdata;
+	struct device *dev = &mloader_priv->pdev->dev;
+	ktime_t start = ktime_get();
+
+	/* the hash driver may have registered after we probed */
+	if (pdata->hash_alg && !mloader_priv->tfm) {
+		struct crypto_ahash *tfm = crypto_alloc_ahash(pdata->hash_alg,
+				0, 0);
+
+		if (IS_ERR(tfm))
+			dev_warn(dev, "no %s, firmwares are not verified\n",
+					pdata->hash_alg);
+		else if (crypto_ahash_digestsize(tfm) > MLOADER_MAX_DIGEST)
+			crypto_free_ahash(tfm);
+		else
+			mloader_priv->tfm = tfm;
+	}
 
 	for (i = 0; i < pdata->nr_fws; i++) {
 		ret = mloader_fw_send(&pdata->fws[i]);
@@ -94,6 +458,13 @@ static int mloader_fw_upload(void)
 			goto err;
 	}
 
+	/* the first upload is the boot one, later ones follow modem resets */
+	dev_info(dev, "%s upload %u done in %lld us\n",
+			mloader_priv->uploads ? "reset" : "boot",
+			mloader_priv->uploads,
+			ktime_us_delta(ktime_get(), start));
+	mloader_priv->uploads++;
+
 	return 0;
 err:
 	dev_err(&mloader_priv->pdev->dev,
@@ -273,6 +644,17 @@ static int __devinit mloader_fw_probe(struct platform_device *pdev)
 
 	dev_info(&mloader_priv->pdev->dev, "mloader device register\n");
 
+	if (mloader_priv->pdata->use_dma) {
+		dma_cap_mask_t mask;
+
+		dma_cap_zero(mask);
+		dma_cap_set(DMA_SG, mask);
+		mloader_priv->dma_chan = dma_request_channel(mask, NULL, NULL);
+		if (!mloader_priv->dma_chan)
+			dev_warn(&pdev->dev,
+				"no dma channel, firmwares are copied by cpu\n");
+	}
+
 	for (i = 0 ; i < mloader_priv->pdata->nr_areas ; i++) {
 		dev_dbg(&mloader_priv->pdev->dev,
 				"Area:%d (name:%s start:%x size:%x)\n",
@@ -308,6 +690,10 @@ static int __devexit mloader_fw_remove(struct platform_device *pdev)
 	if (err < 0)
 		dev_err(&pdev->dev, "can't misc_deregister, %d\n", err);
 
+	if (mloader_priv->dma_chan)
+		dma_release_channel(mloader_priv->dma_chan);
+	if (mloader_priv->tfm)
+		crypto_free_ahash(mloader_priv->tfm);
 	kfree(mloader_priv);
 
 	return err;
@@ -584,6 +584,21 @@ static int mmc_blk_compat_ioctl(struct block_device *bdev, fmode_t mode,
 }
 #endif
 
+static int mmc_blk_panic_write(struct block_device *bdev, sector_t sector,
+			       void *buf, unsigned int nr_sects)
+{
+	struct mmc_blk_data *md = bdev->bd_disk->private_data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_data *main_md = mmc_get_drvdata(card);
+
+	/* switching the eMMC partition would mean sleeping */
+	if (main_md->part_curr != md->part_type)
+		return -EBUSY;
+
+	return mmc_panic_write(card, sector + get_start_sect(bdev), buf,
+			       nr_sects);
+}
+
 static const struct block_device_operations mmc_bdops = {
 	.open			= mmc_blk_open,
 	.release		= mmc_blk_release,
@@ -593,6 +608,7 @@ static const struct block_device_operations mmc_bdops = {
 #ifdef CONFIG_COMPAT
 	.compat_ioctl		= mmc_blk_compat_ioctl,
 #endif
+	.panic_write		= mmc_blk_panic_write,
 };
 
 static inline int mmc_blk_part_switch(struct mmc_card *card,
@@ -477,6 +477,110 @@ int mmc_wait_for_cmd(struct mmc_host *host, struct mmc_command *cmd, int retries
 
 EXPORT_SYMBOL(mmc_wait_for_cmd);
 
+static int mmc_panic_wait_ready(struct mmc_card *card)
+{
+	struct mmc_host *host = card->host;
+	struct mmc_request mrq = {NULL};
+	struct mmc_command cmd = {0};
+	int timeout = 1000000;	/* us */
+	int err;
+
+	cmd.opcode = MMC_SEND_STATUS;
+	cmd.arg = card->rca << 16;
+	cmd.flags = MMC_RSP_SPI_R2 | MMC_RSP_R1 | MMC_CMD_AC;
+	mrq.cmd = &cmd;
+	cmd.mrq = &mrq;
+
+	do {
+		cmd.error = 0;
+		err = host->ops->panic_request(host, &mrq);
+		if (!err)
+			err = cmd.error;
+		if (err)
+			return err;
+		if ((cmd.resp[0] & R1_READY_FOR_DATA) &&
+		    R1_CURRENT_STATE(cmd.resp[0]) != R1_STATE_PRG)
+			return 0;
+		udelay(10);
+		timeout -= 10;
+	} while (timeout > 0);
+
+	return -ETIMEDOUT;
+}
+
+/**
+ *	mmc_panic_write - write blocks from panic context
+ *	@card: card to write to
+ *	@sector: first 512 byte sector to write
+ *	@buf: data to write, in lowmem
+ *	@blocks: number of sectors to write
+ *
+ *	Write to the card without sleeping or using interrupts, through
+ *	the host's panic_request method.  The host is not claimed: this
+ *	is only for writing crash dumps once nothing else is running.
+ */
+int mmc_panic_write(struct mmc_card *card, unsigned int sector, void *buf,
+		    unsigned int blocks)
+{
+	struct mmc_host *host = card->host;
+	unsigned int max_blocks;
+	int err;
+
+	if (!host->ops->panic_request)
+		return -EOPNOTSUPP;
+
+	max_blocks = min(host->max_blk_count, host->max_req_size >> 9);
+
+	while (blocks) {
+		struct mmc_request mrq = {NULL};
+		struct mmc_command cmd = {0};
+		struct mmc_command stop = {0};
+		struct mmc_data data = {0};
+		struct scatterlist sg;
+		unsigned int nr = min(blocks, max_blocks);
+
+		cmd.opcode = nr > 1 ? MMC_WRITE_MULTIPLE_BLOCK : MMC_WRITE_BLOCK;
+		cmd.arg = mmc_card_blockaddr(card) ? sector : sector << 9;
+		cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+		stop.opcode = MMC_STOP_TRANSMISSION;
+		stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+		data.blksz = 512;
+		data.blocks = nr;
+		data.flags = MMC_DATA_WRITE;
+		data.sg = &sg;
+		data.sg_len = 1;
+		sg_init_one(&sg, buf, nr << 9);
+		mmc_set_data_timeout(&data, card);
+
+		mrq.cmd = &cmd;
+		mrq.data = &data;
+		if (nr > 1)
+			mrq.stop = &stop;
+		cmd.mrq = &mrq;
+		cmd.data = &data;
+		data.mrq = &mrq;
+		data.stop = mrq.stop;
+		stop.mrq = &mrq;
+
+		err = host->ops->panic_request(host, &mrq);
+		if (!err)
+			err = cmd.error ? cmd.error : data.error;
+		if (!err && mrq.stop)
+			err = stop.error;
+		if (!err)
+			err = mmc_panic_wait_ready(card);
+		if (err)
+			return err;
+
+		sector += nr;
+		buf += nr << 9;
+		blocks -= nr;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(mmc_panic_write);
+
 /**
  *	mmc_set_data_timeout - set the timeout for a data command
  *	@data: data phase for command
@@ -23,6 +23,7 @@
 #include <linux/mmc/pm.h>
 #include <linux/mmc/host.h>
 #include <linux/mmc/card.h>
+#include <linux/mmc/mmc.h>
 #include <linux/amba/bus.h>
 #include <linux/clk.h>
 #include <linux/scatterlist.h>
@@ -1392,6 +1393,158 @@ static void mmci_request_expiry(unsigned long arg)
 	BUG();
 }
 
+/*
+ * Polled request handling for mmc_panic_write().  Interrupts are masked
+ * and the controller is driven directly; whatever request was in flight
+ * is dropped.  The controller is left in that state, since only a
+ * reboot follows.
+ */
+#define MMCI_PANIC_TIMEOUT	1000000	/* us */
+
+#ifdef CONFIG_PM_RUNTIME
+static int mmci_runtime_resume(struct device *dev);
+#endif
+
+static int mmci_panic_poll(struct mmci_host *host, u32 mask, u32 *status)
+{
+	int timeout = MMCI_PANIC_TIMEOUT;
+
+	do {
+		*status = readl(host->base + MMCISTATUS);
+		if (*status & mask)
+			return 0;
+		udelay(1);
+	} while (--timeout);
+
+	return -ETIMEDOUT;
+}
+
+static int mmci_panic_command(struct mmci_host *host, struct mmc_command *cmd)
+{
+	void __iomem *base = host->base;
+	u32 status, mask;
+	int ret;
+
+	if (cmd->flags & MMC_RSP_PRESENT)
+		mask = MCI_CMDCRCFAIL | MCI_CMDTIMEOUT | MCI_CMDRESPEND;
+	else
+		mask = MCI_CMDTIMEOUT | MCI_CMDSENT;
+
+	mmci_start_command(host, cmd, 0);
+	ret = mmci_panic_poll(host, mask, &status);
+	writel(MCI_CMDCRCFAILCLR | MCI_CMDTIMEOUTCLR | MCI_CMDRESPENDCLR |
+	       MCI_CMDSENTCLR, base + MMCICLEAR);
+	writel(0, base + MMCICOMMAND);
+	host->cmd = NULL;
+
+	if (host->plat->levelshifter && (host->cclk_desired > host->cclk))
+		mmci_set_clkreg(host, host->cclk_desired);
+
+	if (ret)
+		cmd->error = ret;
+	else if (status & MCI_CMDTIMEOUT)
+		cmd->error = -ETIMEDOUT;
+	else if (status & MCI_CMDCRCFAIL && cmd->flags & MMC_RSP_CRC)
+		cmd->error = -EILSEQ;
+	else {
+		cmd->resp[0] = readl(base + MMCIRESPONSE0);
+		cmd->resp[1] = readl(base + MMCIRESPONSE1);
+		cmd->resp[2] = readl(base + MMCIRESPONSE2);
+		cmd->resp[3] = readl(base + MMCIRESPONSE3);
+	}
+	return cmd->error;
+}
+
+static int mmci_panic_write_data(struct mmci_host *host,
+				 struct mmc_data *data)
+{
+	void __iomem *base = host->base;
+	char *buffer = sg_virt(data->sg);
+	unsigned int remain = data->blksz * data->blocks;
+	int timeout = MMCI_PANIC_TIMEOUT;
+	u32 status;
+
+	mmci_setup_datactrl(host, data);
+
+	do {
+		status = readl(base + MMCISTATUS);
+		if (status & (MCI_DATACRCFAIL | MCI_DATATIMEOUT |
+			      MCI_STARTBITERR | MCI_TXUNDERRUN)) {
+			data->error = status & MCI_DATATIMEOUT ?
+				-ETIMEDOUT : -EIO;
+			break;
+		}
+		if (!remain && (status & MCI_DATAEND)) {
+			data->bytes_xfered = data->blksz * data->blocks;
+			break;
+		}
+		if (remain && (status & MCI_TXFIFOHALFEMPTY)) {
+			unsigned int len;
+
+			len = mmci_pio_write(host, buffer, remain, status);
+			buffer += len;
+			remain -= len;
+			continue;
+		}
+		udelay(1);
+	} while (--timeout);
+
+	if (!timeout)
+		data->error = -ETIMEDOUT;
+
+	writel(MCI_DATACRCFAILCLR | MCI_DATATIMEOUTCLR | MCI_TXUNDERRUNCLR |
+	       MCI_RXOVERRUNCLR | MCI_DATAENDCLR | MCI_STARTBITERRCLR |
+	       MCI_DATABLOCKENDCLR, base + MMCICLEAR);
+	mmci_stop_data(host);
+	return data->error;
+}
+
+static int mmci_panic_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct mmci_host *host = mmc_priv(mmc);
+	void __iomem *base = host->base;
+	struct mmc_data *data = mrq->data;
+
+	if (data && (data->sg_len != 1 || data->flags & MMC_DATA_READ))
+		return -EINVAL;
+
+#ifdef CONFIG_PM_RUNTIME
+	/* best effort, this may take the clock and regulator locks */
+	if (pm_runtime_suspended(mmc_dev(mmc)))
+		mmci_runtime_resume(mmc_dev(mmc));
+#endif
+
+	writel(0, base + MMCIMASK0);
+	mmci_set_mask1(host, 0);
+
+	if (host->mrq) {
+		struct mmc_command stop = {0};
+
+		del_timer(&host->req_expiry);
+		if (dma_inprogress(host))
+			mmci_dma_data_error(host, host->mrq->data);
+		writel(0, base + MMCIDATACTRL);
+		writel(0, base + MMCICOMMAND);
+		host->mrq = NULL;
+		host->cmd = NULL;
+		host->data = NULL;
+
+		/* take the card out of a data transfer, if it was in one */
+		stop.opcode = MMC_STOP_TRANSMISSION;
+		stop.flags = MMC_RSP_R1B | MMC_CMD_AC;
+		mmci_panic_command(host, &stop);
+	}
+
+	if (mmci_panic_command(host, mrq->cmd))
+		return 0;
+	if (data) {
+		mmci_panic_write_data(host, data);
+		if (data->stop)
+			mmci_panic_command(host, data->stop);
+	}
+	return 0;
+}
+
 static const struct mmc_host_ops mmci_ops = {
 	.request	= mmci_request,
 	.pre_req	= mmci_pre_request,
@@ -1400,6 +1553,7 @@ static const struct mmc_host_ops mmci_ops = {
 	.get_ro		= mmci_get_ro,
 	.get_cd		= mmci_get_cd,
 	.start_signal_voltage_switch = mmci_sig_volt_switch,
+	.panic_request	= mmci_panic_request,
 };
 
 static int __devinit mmci_probe(struct amba_device *dev,
@@ -37,17 +37,30 @@ static struct hrtimer timer;
 /* debug functionality */
 #define ISA_DEBUG 0
 
-#define PHONET_TASKLET
-#define MAX_RCV_LEN	2048
+/*
+ * Copy a message from the modem FIFO into the ring of a message queue.
+ * Called with q->update_lock held.
+ */
+static void copy_l2msg_to_queue(struct message_queue *q,
+					struct shrm_l2msg *msg)
+{
+	u32 size;
 
-static void do_phonet_rcv_tasklet(unsigned long unused);
-struct tasklet_struct phonet_rcv_tasklet;
+	if ((q->writeptr + msg->size) >= q->size) {
+		size = (q->size-q->writeptr);
+		/* Copy First Part of msg */
+		shrm_l2msg_read(msg, 0, q->fifo_base + q->writeptr, size);
+		/* Copy Second Part of msg at the top of fifo */
+		shrm_l2msg_read(msg, size, q->fifo_base, msg->size - size);
+	} else {
+		shrm_l2msg_read(msg, 0, q->fifo_base + q->writeptr, msg->size);
+	}
+}
 
 /**
  * audio_receive() - Receive audio channel completion callback
  * @shrm:	pointer to shrm device information structure
- * @data:	message pointer
- * @n_bytes:	message size
+ * @msg:	message in the modem FIFO
  * @l2_header:	L2 header/device ID 2->audio, 5->audio_loopback
  *
  * This fucntion is called from the audio receive handler. Copies the audio
@@ -55,13 +68,11 @@ struct tasklet_struct phonet_rcv_tasklet;
  * this queue to the user buffer through the char or net interface read
  * operation.
  */
-static int audio_receive(struct shrm_dev *shrm, void *data,
-					u32 n_bytes, u8 l2_header)
+static int audio_receive(struct shrm_dev *shrm, struct shrm_l2msg *msg,
+					u8 l2_header)
 {
-	u32 size = 0;
 	int ret = 0;
 	int idx;
-	u8 *psrc;
 	struct message_queue *q;
 	struct isadev_context *audiodev;
 
@@ -73,21 +84,12 @@ static int audio_receive(struct shrm_dev *shrm, void *data,
 	}
 	audiodev = &shrm->isa_context->isadev[idx];
 	q = &audiodev->dl_queue;
-	spin_lock(&q->update_lock);
+	/* runs on the audio kthread, not in softirq context */
+	spin_lock_bh(&q->update_lock);
 	/* Memcopy RX data first */
-	if ((q->writeptr+n_bytes) >= q->size) {
-		psrc = (u8 *)data;
-		size = (q->size-q->writeptr);
-		/* Copy First Part of msg */
-		memcpy((q->fifo_base+q->writeptr), psrc, size);
-		psrc += size;
-		/* Copy Second Part of msg at the top of fifo */
-		memcpy(q->fifo_base, psrc, (n_bytes-size));
-	} else {
-		memcpy((q->fifo_base+q->writeptr), data, n_bytes);
-	}
-	ret = add_msg_to_queue(q, n_bytes);
-	spin_unlock(&q->update_lock);
+	copy_l2msg_to_queue(q, msg);
+	ret = add_msg_to_queue(q, msg->size);
+	spin_unlock_bh(&q->update_lock);
 	if (ret < 0)
 		dev_err(shrm->dev, "Adding a msg to message queue failed");
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
@@ -97,21 +99,20 @@ static int audio_receive(struct shrm_dev *shrm, void *data,
 /**
  * common_receive() - Receive common channel completion callback
  * @shrm:	pointer to the shrm device information structure
- * @data:	message pointer
- * @n_bytes:	message size
+ * @msg:	message in the modem FIFO
  * @l2_header:	L2 header / device ID
  *
  * This function is called from the receive handler to copy the respective
  * ISI, RPC, SECURITY message to its respective queue. The message is then
  * copied from queue to the user buffer on char net interface read operation.
+ * While the network interface is up and has nothing queued, ISI messages
+ * are copied straight into an skb instead.
  */
-static int common_receive(struct shrm_dev *shrm, void *data,
-					u32 n_bytes, u8 l2_header)
+static int common_receive(struct shrm_dev *shrm, struct shrm_l2msg *msg,
+					u8 l2_header)
 {
-	u32 size = 0;
 	int ret = 0;
 	int idx;
-	u8 *psrc;
 	struct message_queue *q;
 	struct isadev_context *isa_dev;
 
@@ -124,20 +125,17 @@ static int common_receive(struct shrm_dev *shrm, void *data,
 	isa_dev = &shrm->isa_context->isadev[idx];
 	q = &isa_dev->dl_queue;
 	spin_lock(&q->update_lock);
-	/* Memcopy RX data first */
-	if ((q->writeptr+n_bytes) >= q->size) {
-		dev_dbg(shrm->dev, "Inside Loop Back\n");
-		psrc = (u8 *)data;
-		size = (q->size-q->writeptr);
-		/* Copy First Part of msg */
-		memcpy((q->fifo_base+q->writeptr), psrc, size);
-		psrc += size;
-		/* Copy Second Part of msg at the top of fifo */
-		memcpy(q->fifo_base, psrc, (n_bytes-size));
-	} else {
-		memcpy((q->fifo_base+q->writeptr), data, n_bytes);
+	if (l2_header == ISI_MESSAGING && shrm->netdev_flag_up &&
+			list_empty(&q->msg_list)) {
+		spin_unlock(&q->update_lock);
+		/* drops are accounted in the netdev stats */
+		shrm_net_receive_l2msg(shrm->ndev, msg);
+		dev_dbg(shrm->dev, "%s OUT\n", __func__);
+		return 0;
 	}
-	ret = add_msg_to_queue(q, n_bytes);
+	/* Memcopy RX data first */
+	copy_l2msg_to_queue(q, msg);
+	ret = add_msg_to_queue(q, msg->size);
 	spin_unlock(&q->update_lock);
 	if (ret < 0) {
 		dev_err(shrm->dev, "Adding a msg to message queue failed");
@@ -145,16 +143,8 @@ static int common_receive(struct shrm_dev *shrm, void *data,
 	}
 
 
-	if (l2_header == ISI_MESSAGING) {
-		if (shrm->netdev_flag_up) {
-			dev_dbg(shrm->dev,
-				"scheduling the phonet tasklet from %s!\n",
-				__func__);
-			tasklet_schedule(&phonet_rcv_tasklet);
-		}
-		dev_dbg(shrm->dev,
-				"Out of phonet tasklet %s!!!\n", __func__);
-	}
+	if (l2_header == ISI_MESSAGING && shrm->netdev_flag_up)
+		shrm_net_rx_schedule(shrm->ndev);
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
 	return ret;
 }
@@ -162,21 +152,20 @@ static int common_receive(struct shrm_dev *shrm, void *data,
 /**
  * rx_common_l2msg_handler() - common channel receive handler
  * @l2_header:		L2 header
- * @msg:		pointer to the receive buffer
- * @length:		length of the msg to read
+ * @msg:		message in the modem FIFO
  * @shrm:		pointer to shrm device information structure
  *
  * This function is called to receive the message from CaMsgPendingNotification
  * interrupt handler.
  */
 static void rx_common_l2msg_handler(u8 l2_header,
-				 void *msg, u32 length,
+				 struct shrm_l2msg *msg,
 				 struct shrm_dev *shrm)
 {
 	int ret = 0;
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
 
-	ret = common_receive(shrm, msg, length, l2_header);
+	ret = common_receive(shrm, msg, l2_header);
 	if (ret < 0)
 		dev_err(shrm->dev,
 			"common receive with l2 header %d failed\n", l2_header);
@@ -187,21 +176,20 @@ static void rx_common_l2msg_handler(u8 l2_header,
 /**
  * rx_audio_l2msg_handler() - audio channel receive handler
  * @l2_header:		L2 header
- * @msg:		pointer to the receive buffer
- * @length:		length of the msg to read
+ * @msg:		message in the modem FIFO
  * @shrm:		pointer to shrm device information structure
  *
  * This function is called to receive the message from CaMsgPendingNotification
  * interrupt handler.
  */
 static void rx_audio_l2msg_handler(u8 l2_header,
-				void *msg, u32 length,
+				struct shrm_l2msg *msg,
 				struct shrm_dev *shrm)
 {
 	int ret = 0;
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
-	ret = audio_receive(shrm, msg, length, l2_header);
+	ret = audio_receive(shrm, msg, l2_header);
 	if (ret < 0)
 		dev_err(shrm->dev, "audio receive failed\n");
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
@@ -297,26 +285,6 @@ static enum hrtimer_restart callback(struct hrtimer *timer)
 }
 #endif
 
-void do_phonet_rcv_tasklet(unsigned long unused)
-{
-	ssize_t ret;
-	struct shrm_dev *shrm = (struct shrm_dev *)unused;
-
-	dev_dbg(shrm->dev, "%s IN\n", __func__);
-	for (;;) {
-		ret = shrm_net_receive(shrm->ndev);
-		if (ret == 0) {
-			dev_dbg(shrm->dev, "len is zero, queue empty\n");
-			break;
-		}
-		if (ret < 0) {
-			dev_err(shrm->dev, "len < 0 !!! error!!!\n");
-			break;
-		}
-	}
-	dev_dbg(shrm->dev, "%s OUT\n", __func__);
-}
-
 static int shrm_probe(struct platform_device *pdev)
 {
 	int err = 0;
@@ -531,9 +499,6 @@ static int shrm_probe(struct platform_device *pdev)
 	if (err < 0)
 		goto rollback_irq;
 
-	tasklet_init(&phonet_rcv_tasklet, do_phonet_rcv_tasklet, 0);
-	phonet_rcv_tasklet.data = (unsigned long)shrm;
-
 	platform_set_drvdata(pdev, shrm);
 
 	return err;
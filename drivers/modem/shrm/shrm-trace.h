@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2012
+ *
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * SHRM link tracing
+ */
+
+#if !defined(_TRACE_SHRM_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_SHRM_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM shrm
+#define TRACE_INCLUDE_FILE shrm-trace
+
+DECLARE_EVENT_CLASS(shrm_msg,
+
+	TP_PROTO(u8 l2_header, u32 len),
+
+	TP_ARGS(l2_header, len),
+
+	TP_STRUCT__entry(
+		__field(u8, l2_header)
+		__field(u32, len)
+	),
+
+	TP_fast_assign(
+		__entry->l2_header = l2_header;
+		__entry->len = len;
+	),
+
+	TP_printk("l2_header=0x%02x len=%u", __entry->l2_header, __entry->len)
+);
+
+DEFINE_EVENT(shrm_msg, shrm_tx_msg,
+
+	TP_PROTO(u8 l2_header, u32 len),
+
+	TP_ARGS(l2_header, len)
+);
+
+DEFINE_EVENT(shrm_msg, shrm_rx_msg,
+
+	TP_PROTO(u8 l2_header, u32 len),
+
+	TP_ARGS(l2_header, len)
+);
+
+TRACE_EVENT(shrm_handshake,
+
+	TP_PROTO(const char *name, u32 usecs),
+
+	TP_ARGS(name, usecs),
+
+	TP_STRUCT__entry(
+		__field(const char *, name)
+		__field(u32, usecs)
+	),
+
+	TP_fast_assign(
+		__entry->name = name;
+		__entry->usecs = usecs;
+	),
+
+	TP_printk("%s took %u us", __entry->name, __entry->usecs)
+);
+
+TRACE_EVENT(shrm_fifo_full,
+
+	TP_PROTO(u8 channel),
+
+	TP_ARGS(channel),
+
+	TP_STRUCT__entry(
+		__field(u8, channel)
+	),
+
+	TP_fast_assign(
+		__entry->channel = channel;
+	),
+
+	TP_printk("channel=%d", __entry->channel)
+);
+
+TRACE_EVENT(shrm_fifo_drained,
+
+	TP_PROTO(u32 usecs),
+
+	TP_ARGS(usecs),
+
+	TP_STRUCT__entry(
+		__field(u32, usecs)
+	),
+
+	TP_fast_assign(
+		__entry->usecs = usecs;
+	),
+
+	TP_printk("stalled for %u us", __entry->usecs)
+);
+
+TRACE_EVENT(shrm_audio_rx,
+
+	TP_PROTO(u32 usecs),
+
+	TP_ARGS(usecs),
+
+	TP_STRUCT__entry(
+		__field(u32, usecs)
+	),
+
+	TP_fast_assign(
+		__entry->usecs = usecs;
+	),
+
+	TP_printk("delivered %u us after the interrupt", __entry->usecs)
+);
+
+#endif /* _TRACE_SHRM_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/modem/shrm/
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
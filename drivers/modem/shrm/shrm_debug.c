@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2012
+ *
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * SHRM link statistics: per L2 channel traffic, FIFO high-water marks,
+ * FIFO full stalls, wake/sleep handshake latencies and audio delivery
+ * latency, exported through debugfs and tracepoints.
+ *
+ * Counters are plain words bumped from the (serialized) context that owns
+ * the channel, and latencies go into fixed log2 histograms, so that all of
+ * it can stay enabled on production devices.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/modem/shrm/shrm_driver.h>
+#include <linux/modem/shrm/shrm_private.h>
+
+#define CREATE_TRACE_POINTS
+#include "shrm-trace.h"
+
+/* bucket n counts samples in [2^(n-1), 2^n) us, the last one the rest */
+#define SHRM_HIST_BUCKETS	16
+
+/* voice frames are expected to reach their queue within this */
+#define SHRM_AUDIO_RX_BUDGET_US	1000
+
+struct shrm_hist {
+	u32 bucket[SHRM_HIST_BUCKETS];
+	u32 count;
+	u32 max_us;
+};
+
+enum {
+	SHRM_L2_ISI,
+	SHRM_L2_RPC,
+	SHRM_L2_AUDIO,
+	SHRM_L2_SECURITY,
+	SHRM_L2_COMMON_LOOPBACK,
+	SHRM_L2_AUDIO_LOOPBACK,
+	SHRM_L2_CIQ,
+	SHRM_L2_RTC_CAL,
+	SHRM_L2_OTHER,
+	SHRM_NR_L2
+};
+
+static const char * const shrm_l2_names[SHRM_NR_L2] = {
+	[SHRM_L2_ISI]			= "isi",
+	[SHRM_L2_RPC]			= "rpc",
+	[SHRM_L2_AUDIO]			= "audio",
+	[SHRM_L2_SECURITY]		= "security",
+	[SHRM_L2_COMMON_LOOPBACK]	= "common_loopback",
+	[SHRM_L2_AUDIO_LOOPBACK]	= "audio_loopback",
+	[SHRM_L2_CIQ]			= "ciq",
+	[SHRM_L2_RTC_CAL]		= "rtc_cal",
+	[SHRM_L2_OTHER]			= "other",
+};
+
+static const char * const shrm_fifo_names[SHRM_NR_FIFOS] = {
+	[SHRM_AC_COMMON_FIFO]	= "ac_common",
+	[SHRM_AC_AUDIO_FIFO]	= "ac_audio",
+	[SHRM_CA_COMMON_FIFO]	= "ca_common",
+	[SHRM_CA_AUDIO_FIFO]	= "ca_audio",
+};
+
+static const char * const shrm_handshake_names[SHRM_NR_HANDSHAKES] = {
+	[SHRM_AC_WAKE]	= "ac_wake",
+	[SHRM_AC_SLEEP]	= "ac_sleep",
+	[SHRM_CA_WAKE]	= "ca_wake",
+	[SHRM_CA_SLEEP]	= "ca_sleep",
+};
+
+struct shrm_l2_stats {
+	unsigned long tx_msgs;
+	unsigned long tx_bytes;
+	unsigned long rx_msgs;
+	unsigned long rx_bytes;
+};
+
+static struct shrm_stats {
+	struct shrm_l2_stats l2[SHRM_NR_L2];
+	u32 fifo_hwm[SHRM_NR_FIFOS];
+	unsigned long fifo_full[2];
+	ktime_t fifo_full_start;
+	struct shrm_hist fifo_full_stall;
+	struct shrm_hist handshake[SHRM_NR_HANDSHAKES];
+	struct shrm_hist audio_rx;
+	unsigned long audio_rx_late;
+} shrm_stats;
+
+static struct dentry *shrm_debugfs_dir;
+
+static int shrm_l2_index(u8 l2_header)
+{
+	switch (l2_header) {
+	case ISI_MESSAGING:
+		return SHRM_L2_ISI;
+	case RPC_MESSAGING:
+		return SHRM_L2_RPC;
+	case AUDIO_MESSAGING:
+		return SHRM_L2_AUDIO;
+	case SECURITY_MESSAGING:
+		return SHRM_L2_SECURITY;
+	case COMMON_LOOPBACK_MESSAGING:
+	case COMMON_LOOPBACK_MESSAGING + 1:
+		return SHRM_L2_COMMON_LOOPBACK;
+	case AUDIO_LOOPBACK_MESSAGING:
+	case AUDIO_LOOPBACK_MESSAGING + 1:
+		return SHRM_L2_AUDIO_LOOPBACK;
+	case CIQ_MESSAGING:
+		return SHRM_L2_CIQ;
+	case RTC_CAL_MESSAGING:
+		return SHRM_L2_RTC_CAL;
+	default:
+		return SHRM_L2_OTHER;
+	}
+}
+
+static u32 shrm_hist_add(struct shrm_hist *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	u32 val = us < 0 ? 0 : (u32)min_t(s64, us, ~0U);
+
+	hist->bucket[min(fls(val), SHRM_HIST_BUCKETS - 1)]++;
+	hist->count++;
+	if (val > hist->max_us)
+		hist->max_us = val;
+	return val;
+}
+
+void shrm_stats_tx(u8 l2_header, u32 len)
+{
+	struct shrm_l2_stats *l2 = &shrm_stats.l2[shrm_l2_index(l2_header)];
+
+	l2->tx_msgs++;
+	l2->tx_bytes += len;
+	trace_shrm_tx_msg(l2_header, len);
+}
+
+void shrm_stats_rx(u8 l2_header, u32 len)
+{
+	struct shrm_l2_stats *l2 = &shrm_stats.l2[shrm_l2_index(l2_header)];
+
+	l2->rx_msgs++;
+	l2->rx_bytes += len;
+	trace_shrm_rx_msg(l2_header, len);
+}
+
+void shrm_stats_fifo_level(enum shrm_stat_fifo fifo, u32 words)
+{
+	if (words > shrm_stats.fifo_hwm[fifo])
+		shrm_stats.fifo_hwm[fifo] = words;
+}
+
+/* called once per stall, when the fifo_full timer gets armed */
+void shrm_stats_fifo_full(u8 channel)
+{
+	shrm_stats.fifo_full[channel ? 1 : 0]++;
+	shrm_stats.fifo_full_start = ktime_get();
+	trace_shrm_fifo_full(channel);
+}
+
+/* called when a read notification ends a stall */
+void shrm_stats_fifo_drained(void)
+{
+	trace_shrm_fifo_drained(shrm_hist_add(&shrm_stats.fifo_full_stall,
+					shrm_stats.fifo_full_start));
+}
+
+void shrm_stats_handshake(enum shrm_stat_handshake hs, ktime_t start)
+{
+	trace_shrm_handshake(shrm_handshake_names[hs],
+			shrm_hist_add(&shrm_stats.handshake[hs], start));
+}
+
+/* called when the first audio message of an interrupt has been queued */
+void shrm_stats_audio_rx(ktime_t irq_stamp)
+{
+	u32 us = shrm_hist_add(&shrm_stats.audio_rx, irq_stamp);
+
+	if (us > SHRM_AUDIO_RX_BUDGET_US)
+		shrm_stats.audio_rx_late++;
+	trace_shrm_audio_rx(us);
+}
+
+static void shrm_hist_show(struct seq_file *s, const char *name,
+					struct shrm_hist *hist)
+{
+	int i;
+
+	seq_printf(s, "%-16s %8u %8u ", name, hist->count, hist->max_us);
+	for (i = 0; i < SHRM_HIST_BUCKETS; i++)
+		seq_printf(s, " %u", hist->bucket[i]);
+	seq_putc(s, '\n');
+}
+
+static int shrm_stats_show(struct seq_file *s, void *data)
+{
+	struct shrm_dev *shrm = s->private;
+	int i;
+
+	seq_printf(s, "%-16s %10s %12s %10s %12s\n", "channel",
+			"tx_msgs", "tx_bytes", "rx_msgs", "rx_bytes");
+	for (i = 0; i < SHRM_NR_L2; i++)
+		seq_printf(s, "%-16s %10lu %12lu %10lu %12lu\n",
+				shrm_l2_names[i],
+				shrm_stats.l2[i].tx_msgs,
+				shrm_stats.l2[i].tx_bytes,
+				shrm_stats.l2[i].rx_msgs,
+				shrm_stats.l2[i].rx_bytes);
+
+	seq_printf(s, "\n%-16s %10s\n", "fifo", "hwm_words");
+	for (i = 0; i < SHRM_NR_FIFOS; i++)
+		seq_printf(s, "%-16s %10u\n", shrm_fifo_names[i],
+				shrm_stats.fifo_hwm[i]);
+
+	seq_printf(s, "\nfifo_full common %lu audio %lu\n",
+			shrm_stats.fifo_full[0], shrm_stats.fifo_full[1]);
+	seq_printf(s, "doorbells common %lu/%lu msgs audio %lu/%lu msgs\n",
+			shrm->tx_common_doorbells, shrm->tx_common_msgs,
+			shrm->tx_audio_doorbells, shrm->tx_audio_msgs);
+	seq_printf(s, "rx_irqs common %lu read_notifs %lu\n",
+			shrm->rx_common_irqs, shrm->rx_common_read_notifs);
+
+	seq_printf(s, "\n%-16s %8s %8s  log2(us) buckets\n", "latency",
+			"count", "max_us");
+	for (i = 0; i < SHRM_NR_HANDSHAKES; i++)
+		shrm_hist_show(s, shrm_handshake_names[i],
+				&shrm_stats.handshake[i]);
+	shrm_hist_show(s, "fifo_full_stall", &shrm_stats.fifo_full_stall);
+	shrm_hist_show(s, "audio_rx", &shrm_stats.audio_rx);
+	seq_printf(s, "audio_rx over %u us: %lu\n", SHRM_AUDIO_RX_BUDGET_US,
+			shrm_stats.audio_rx_late);
+	return 0;
+}
+
+static int shrm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, shrm_stats_show, inode->i_private);
+}
+
+/* any write clears the statistics */
+static ssize_t shrm_stats_write(struct file *file, const char __user *buf,
+					size_t len, loff_t *ppos)
+{
+	memset(&shrm_stats, 0, sizeof(shrm_stats));
+	return len;
+}
+
+static const struct file_operations shrm_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = shrm_stats_open,
+	.read = seq_read,
+	.write = shrm_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void shrm_debugfs_init(struct shrm_dev *shrm)
+{
+	shrm_debugfs_dir = debugfs_create_dir("shrm", NULL);
+	if (IS_ERR_OR_NULL(shrm_debugfs_dir)) {
+		shrm_debugfs_dir = NULL;
+		return;
+	}
+	if (!debugfs_create_file("stats", S_IRUGO | S_IWUSR,
+				shrm_debugfs_dir, shrm, &shrm_stats_fops))
+		dev_err(shrm->dev, "failed to create debugfs stats file\n");
+}
+
+void shrm_debugfs_exit(void)
+{
+	debugfs_remove_recursive(shrm_debugfs_dir);
+	shrm_debugfs_dir = NULL;
+}
@@ -69,52 +69,51 @@ rx_cb common_rx;
 rx_cb audio_rx;
 
 
-static int isi_receive(struct shrm_dev *shrm, void *data, u32 n_bytes);
-static int rpc_receive(struct shrm_dev *shrm, void *data, u32 n_bytes);
-static int audio_receive(struct shrm_dev *shrm, void *data, u32 n_bytes);
-static int security_receive(struct shrm_dev *shrm,
-						void *data, u32 n_bytes);
+static int isi_receive(struct shrm_dev *shrm, struct shrm_l2msg *msg);
+static int rpc_receive(struct shrm_dev *shrm, struct shrm_l2msg *msg);
+static int audio_receive(struct shrm_dev *shrm, struct shrm_l2msg *msg);
+static int security_receive(struct shrm_dev *shrm, struct shrm_l2msg *msg);
 
 static void rx_common_l2msg_handler(u8 l2_header,
-				 void *msg, u32 length,
+				 struct shrm_l2msg *msg,
 				 struct shrm_dev *shrm)
 {
 	int ret = 0;
 #ifdef CONFIG_U8500_SHRM_LOOP_BACK
-	u8 *pdata;
+	u8 data;
 #endif
      dev_dbg(shrm->dev, "%s IN\n", __func__);
 
 	switch (l2_header) {
 	case ISI_MESSAGING:
-		ret = isi_receive(shrm, msg, length);
+		ret = isi_receive(shrm, msg);
 		if (ret < 0)
 			dev_err(shrm->dev, "isi receive failed\n");
 		break;
 	case RPC_MESSAGING:
-		ret  = rpc_receive(shrm, msg, length);
+		ret  = rpc_receive(shrm, msg);
 		if (ret < 0)
 			dev_err(shrm->dev, "rpc receive failed\n");
 		break;
 	case SECURITY_MESSAGING:
-		ret = security_receive(shrm, msg, length);
+		ret = security_receive(shrm, msg);
 		if (ret < 0)
 			dev_err(shrm->dev,
 					"security receive failed\n");
 		break;
 #ifdef CONFIG_U8500_SHRM_LOOP_BACK
 	case COMMMON_LOOPBACK_MESSAGING:
-		pdata = (u8 *)msg;
-		if ((*pdata == 0x50) || (*pdata == 0xAF)) {
-			ret = isi_receive(shrm, msg, length);
+		shrm_l2msg_read(msg, 0, &data, 1);
+		if ((data == 0x50) || (data == 0xAF)) {
+			ret = isi_receive(shrm, msg);
 			if (ret < 0)
 				dev_err(shrm->dev, "isi receive failed\n");
-		} else if ((*pdata == 0x0A) || (*pdata == 0xF5)) {
-			ret = rpc_receive(shrm, msg, length);
+		} else if ((data == 0x0A) || (data == 0xF5)) {
+			ret = rpc_receive(shrm, msg);
 			if (ret < 0)
 				dev_err(shrm->dev, "rpc receive failed\n");
-		} else if ((*pdata == 0xFF) || (*pdata == 0x00)) {
-			ret = security_receive(shrm, msg, length);
+		} else if ((data == 0xFF) || (data == 0x00)) {
+			ret = security_receive(shrm, msg);
 			if (ret < 0)
 				dev_err(shrm->dev,
 						"security receive failed\n");
@@ -128,13 +127,13 @@ static void rx_common_l2msg_handler(u8 l2_header,
 }
 
 static void rx_audio_l2msg_handler(u8 l2_header,
-				void *msg, u32 length,
+				struct shrm_l2msg *msg,
 				struct shrm_dev *shrm)
 {
 	int ret = 0;
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
-	audio_receive(shrm, msg, length);
+	audio_receive(shrm, msg);
 	if (ret < 0)
 		dev_err(shrm->dev, "audio receive failed\n");
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
@@ -386,21 +385,38 @@ int get_size_of_new_msg(struct message_queue *q)
 	return new_msg->size;
 }
 
+/*
+ * Copy a message from the modem FIFO into the ring of a message queue.
+ * Called with q->update_lock held.
+ */
+static void copy_l2msg_to_queue(struct message_queue *q,
+					struct shrm_l2msg *msg)
+{
+	u32 size;
+
+	if ((q->writeptr + msg->size) >= q->size) {
+		size = (q->size-q->writeptr);
+		/* Copy First Part of msg */
+		shrm_l2msg_read(msg, 0, q->fifo_base + q->writeptr, size);
+		/* Copy Second Part of msg at the top of fifo */
+		shrm_l2msg_read(msg, size, q->fifo_base, msg->size - size);
+	} else {
+		shrm_l2msg_read(msg, 0, q->fifo_base + q->writeptr, msg->size);
+	}
+}
+
 /**
  * isi_receive() - Rx Completion callback
  *
- * @data:message pointer
- * @n_bytes:message size
+ * @msg:message in the modem FIFO
  *
  * This function is a callback to indicate ISI message reception is complete.
  * It updates Writeptr of the Fifo
  */
 static int isi_receive(struct shrm_dev *shrm,
-					void *data, u32 n_bytes)
+					struct shrm_l2msg *msg)
 {
-	u32 size = 0;
 	int ret = 0;
-	u8 *psrc;
 	struct message_queue *q;
 	struct isadev_context *isidev = &shrm->isa_context->isadev[0];
 
@@ -408,19 +424,8 @@ static int isi_receive(struct shrm_dev *shrm,
 	q = &isidev->dl_queue;
 	spin_lock(&q->update_lock);
 	/* Memcopy RX data first */
-	if ((q->writeptr+n_bytes) >= q->size) {
-		dev_dbg(shrm->dev, "Inside Loop Back\n");
-		psrc = (u8 *)data;
-		size = (q->size-q->writeptr);
-		/* Copy First Part of msg */
-		memcpy((q->fifo_base+q->writeptr), psrc, size);
-		psrc += size;
-		/* Copy Second Part of msg at the top of fifo */
-		memcpy(q->fifo_base, psrc, (n_bytes-size));
-	} else {
-		memcpy((q->fifo_base+q->writeptr), data, n_bytes);
-	}
-	ret = add_msg_to_queue(q, n_bytes);
+	copy_l2msg_to_queue(q, msg);
+	ret = add_msg_to_queue(q, msg->size);
 	if (ret < 0)
 		dev_err(shrm->dev, "Adding msg to message queue failed\n");
 	spin_unlock(&q->update_lock);
@@ -431,18 +436,15 @@ static int isi_receive(struct shrm_dev *shrm,
 /**
  * rpc_receive() - Rx Completion callback
  *
- * @data:message pointer
- * @n_bytes:message size
+ * @msg:message in the modem FIFO
  *
  * This function is a callback to indicate RPC message reception is complete.
  * It updates Writeptr of the Fifo
  */
 static int rpc_receive(struct shrm_dev *shrm,
-					void *data, u32 n_bytes)
+					struct shrm_l2msg *msg)
 {
-	u32 size = 0;
 	int ret = 0;
-	u8 *psrc;
 	struct message_queue *q;
 	struct isadev_context *rpcdev = &shrm->isa_context->isadev[1];
 
@@ -450,19 +452,8 @@ static int rpc_receive(struct shrm_dev *shrm,
 	q = &rpcdev->dl_queue;
 	spin_lock(&q->update_lock);
 	/* Memcopy RX data first */
-	if ((q->writeptr+n_bytes) >= q->size) {
-		psrc = (u8 *)data;
-		size = (q->size-q->writeptr);
-		/* Copy First Part of msg */
-		memcpy((q->fifo_base+q->writeptr), psrc, size);
-		psrc += size;
-		/* Copy Second Part of msg at the top of fifo */
-		memcpy(q->fifo_base, psrc, (n_bytes-size));
-	} else {
-		memcpy((q->fifo_base+q->writeptr), data, n_bytes);
-	}
-
-	ret = add_msg_to_queue(q, n_bytes);
+	copy_l2msg_to_queue(q, msg);
+	ret = add_msg_to_queue(q, msg->size);
 	if (ret < 0)
 		dev_err(shrm->dev, "Adding msg to message queue failed\n");
 	spin_unlock(&q->update_lock);
@@ -473,18 +464,15 @@ static int rpc_receive(struct shrm_dev *shrm,
 /**
  * audio_receive() - Rx Completion callback
  *
- * @data:message pointer
- * @n_bytes:message size
+ * @msg:message in the modem FIFO
  *
  * This function is a callback to indicate audio message reception is complete.
  * It updates Writeptr of the Fifo
  */
 static int audio_receive(struct shrm_dev *shrm,
-					void *data, u32 n_bytes)
+					struct shrm_l2msg *msg)
 {
-	u32 size = 0;
 	int ret = 0;
-	u8 *psrc;
 	struct message_queue *q;
 	struct isadev_context *audiodev = &shrm->isa_context->isadev[2];
 
@@ -492,18 +480,8 @@ static int audio_receive(struct shrm_dev *shrm,
 	q = &audiodev->dl_queue;
 	spin_lock(&q->update_lock);
 	/* Memcopy RX data first */
-	if ((q->writeptr+n_bytes) >= q->size) {
-		psrc = (u8 *)data;
-		size = (q->size-q->writeptr);
-		/* Copy First Part of msg */
-		memcpy((q->fifo_base+q->writeptr), psrc, size);
-		psrc += size;
-		/* Copy Second Part of msg at the top of fifo */
-		memcpy(q->fifo_base, psrc, (n_bytes-size));
-	} else {
-		memcpy((q->fifo_base+q->writeptr), data, n_bytes);
-	}
-	ret = add_msg_to_queue(q, n_bytes);
+	copy_l2msg_to_queue(q, msg);
+	ret = add_msg_to_queue(q, msg->size);
 	if (ret < 0)
 		dev_err(shrm->dev, "Adding msg to message queue failed\n");
 	spin_unlock(&q->update_lock);
@@ -514,18 +492,15 @@ static int audio_receive(struct shrm_dev *shrm,
 /**
  * security_receive() - Rx Completion callback
  *
- * @data:message pointer
- * @n_bytes: message size
+ * @msg:message in the modem FIFO
  *
  * This function is a callback to indicate security message reception
  * is complete.It updates Writeptr of the Fifo
  */
 static int security_receive(struct shrm_dev *shrm,
-					void *data, u32 n_bytes)
+					struct shrm_l2msg *msg)
 {
-	u32 size = 0;
 	int ret = 0;
-	u8 *psrc;
 	struct message_queue *q;
 	struct isadev_context *secdev = &shrm->isa_context->isadev[3];
 
@@ -533,18 +508,8 @@ static int security_receive(struct shrm_dev *shrm,
 	q = &secdev->dl_queue;
 	spin_lock(&q->update_lock);
 	/* Memcopy RX data first */
-	if ((q->writeptr+n_bytes) >= q->size) {
-		psrc = (u8 *)data;
-		size = (q->size-q->writeptr);
-		/* Copy First Part of msg */
-		memcpy((q->fifo_base+q->writeptr), psrc, size);
-		psrc += size;
-		/* Copy Second Part of msg at the top of fifo */
-		memcpy(q->fifo_base, psrc, (n_bytes-size));
-	} else {
-		memcpy((q->fifo_base+q->writeptr), data, n_bytes);
-	}
-	ret = add_msg_to_queue(q, n_bytes);
+	copy_l2msg_to_queue(q, msg);
+	ret = add_msg_to_queue(q, msg->size);
 	if (ret < 0)
 		dev_err(shrm->dev, "Adding msg to message queue failed\n");
 	spin_unlock(&q->update_lock);
@@ -53,10 +53,8 @@ void shm_fifo_init(struct shrm_dev *shrm)
 	*((u32 *)shrm->ac_common_shared_rptr) = 0;
 	ape_shm_fifo_0.shared_wptr		= 0;
 	ape_shm_fifo_0.shared_rptr		= 0;
-	ape_shm_fifo_0.availablesize = shrm->ape_common_fifo_size;
 	ape_shm_fifo_0.end_addr_fifo    = shrm->ape_common_fifo_size;
 	ape_shm_fifo_0.fifo_virtual_addr = shrm->ape_common_fifo_base;
-	spin_lock_init(&ape_shm_fifo_0.fifo_update_lock);
 
 
 	cmt_shm_fifo_0.reader_local_rptr	= 0;
@@ -75,10 +73,8 @@ void shm_fifo_init(struct shrm_dev *shrm)
 	ape_shm_fifo_1.shared_rptr		= 0;
 	*((u32 *)shrm->ac_audio_shared_wptr) = 0;
 	*((u32 *)shrm->ac_audio_shared_rptr) = 0;
-	ape_shm_fifo_1.availablesize = shrm->ape_audio_fifo_size;
 	ape_shm_fifo_1.end_addr_fifo    = shrm->ape_audio_fifo_size;
 	ape_shm_fifo_1.fifo_virtual_addr = shrm->ape_audio_fifo_base;
-	spin_lock_init(&ape_shm_fifo_1.fifo_update_lock);
 
 	cmt_shm_fifo_1.reader_local_rptr	= 0;
 	cmt_shm_fifo_1.reader_local_wptr	= 0;
@@ -122,6 +118,22 @@ u8 read_boot_info_req(struct shrm_dev *shrm,
 	return 1;
 }
 
+/*
+ * Free words in an AC FIFO.  Each AC FIFO has a single producer (the
+ * writers are serialized by the channel tx lock) and a single consumer
+ * side (the read notification tasklet), so this needs no lock: a stale
+ * writer_local_rptr only under-reports the free space.
+ */
+static u32 shm_fifo_space(struct fifo_write_params *fifo)
+{
+	u32 rptr = ACCESS_ONCE(fifo->writer_local_rptr);
+	u32 wptr = fifo->writer_local_wptr;
+
+	if (rptr > wptr)
+		return rptr - wptr;
+	return fifo->end_addr_fifo - wptr + rptr;
+}
+
 void write_boot_info_resp(struct shrm_dev *shrm, u32 config,
 							u32 version)
 {
@@ -130,7 +142,6 @@ void write_boot_info_resp(struct shrm_dev *shrm, u32 config,
 	u8 msg_length;
 	version = SHRM_VER;
 
-	spin_lock_bh(&fifo->fifo_update_lock);
 	/* Read L1 header read content of reader_local_rptr */
 	msg = (u32 *)
 		(fifo->writer_local_wptr+fifo->fifo_virtual_addr);
@@ -150,9 +161,9 @@ void write_boot_info_resp(struct shrm_dev *shrm, u32 config,
 		*msg = ca_csc_inactivity_timer;
 		msg_length = L1_NORMAL_MSG;
 	}
+	/* message words before the pointer that covers them */
+	smp_wmb();
 	fifo->writer_local_wptr += msg_length;
-	fifo->availablesize -= msg_length;
-	spin_unlock_bh(&fifo->fifo_update_lock);
 }
 
 /**
@@ -160,25 +171,27 @@ void write_boot_info_resp(struct shrm_dev *shrm, u32 config,
  * @shrm:	pointer to shrm device information structure
  * @channel:	audio or common channel
  * @l2header:	L2 header or device ID
- * @addr:	pointer to write buffer address
+ * @src:	source the message payload is copied from
  * @length:	length of mst to write
  *
  * Function Which Writes the data into Fifo in IPC zone
- * It is called from shm_write_msg. This function will copy the msg
- * from the kernel buffer to FIFO. There are 4 kernel buffers from where
- * the data is to copied to FIFO one for each of the messages ISI, RPC,
- * AUDIO and SECURITY. ISI, RPC and SECURITY messages are pushed to FIFO
- * in commmon channel and AUDIO message is pushed onto audio channel FIFO.
+ * It is called from shm_write_msg_src. The payload is copied by @src
+ * straight into the FIFO, in two spans when the message wraps, so
+ * callers need not linearize it first. ISI, RPC and SECURITY messages
+ * are pushed to FIFO in commmon channel and AUDIO message is pushed onto
+ * audio channel FIFO. If @src fails the write pointer is not moved and
+ * its error is returned.
  */
 int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
-				u8 l2header, void *addr, u32 length)
+				u8 l2header, struct shrm_tx_src *src, u32 length)
 {
 	struct fifo_write_params *fifo = NULL;
 	u32 l1_header = 0, l2_header = 0;
 	u32 requiredsize;
-	u32 size = 0;
+	u32 size = 0, first;
+	u32 availablesize;
 	u32 *msg;
-	u8 *src;
+	int ret;
 
 	if (channel == COMMON_CHANNEL)
 		fifo = &ape_shm_fifo_0;
@@ -195,7 +208,8 @@ int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
 	requiredsize += 2;
 
 	/* if availablesize = or < requiredsize then error */
-	if (fifo->availablesize <= requiredsize) {
+	availablesize = shm_fifo_space(fifo);
+	if (availablesize <= requiredsize) {
 		/* Fatal ERROR - should never happens */
 		dev_dbg(shrm->dev, "wr_wptr= %x\n",
 					fifo->writer_local_wptr);
@@ -206,7 +220,7 @@ int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
 		dev_dbg(shrm->dev, "shared_rptr= %x\n",
 						fifo->shared_rptr);
 		dev_dbg(shrm->dev, "availsize= %x\n",
-						fifo->availablesize);
+						availablesize);
 		dev_dbg(shrm->dev, "end__fifo= %x\n",
 				fifo->end_addr_fifo);
 		dev_warn(shrm->dev, "Modem is busy, please wait."
@@ -225,172 +239,84 @@ int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
 	if (channel == COMMON_CHANNEL) {
 		/* build L1 header */
 		l1_header = ((L1_NORMAL_MSG << L1_MSG_MAPID_OFFSET) |
-				(((msg_common_counter++) << COUNTER_OFFSET)
+				((msg_common_counter << COUNTER_OFFSET)
 				 & MASK_40_55_BIT) |
 				((length + L2_HEADER_SIZE) & MASK_0_39_BIT));
 	} else if (channel == AUDIO_CHANNEL) {
 		/* build L1 header */
 		l1_header = ((L1_NORMAL_MSG << L1_MSG_MAPID_OFFSET) |
-				(((msg_audio_counter++) << COUNTER_OFFSET)
+				((msg_audio_counter << COUNTER_OFFSET)
 				 & MASK_40_55_BIT) |
 				((length + L2_HEADER_SIZE) & MASK_0_39_BIT));
 	}
 
 	/*
-	 * Need to take care race condition for fifo->availablesize
-	 * & fifo->writer_local_rptr with Ac_Read_notification interrupt.
-	 * One option could be use stack variable for LocalRptr and recompute
-	 * fifo->availablesize,based on flag enabled in the
-	 * Ac_read_notification
+	 * The read notification tasklet may move writer_local_rptr
+	 * concurrently, but only ever towards writer_local_wptr, so the
+	 * space found above stays free until this message is published.
 	 */
 	l2_header = ((l2header << L2_HEADER_OFFSET) |
 					((length) & MASK_0_39_BIT));
-	spin_lock_bh(&fifo->fifo_update_lock);
-	/* Check Local Rptr is less than or equal to Local WPtr */
-	if (fifo->writer_local_rptr <= fifo->writer_local_wptr) {
-		msg = (u32 *)
-			(fifo->fifo_virtual_addr+fifo->writer_local_wptr);
-
-		/* check enough place bewteen writer_local_wptr & end of FIFO */
-		if ((fifo->end_addr_fifo-fifo->writer_local_wptr) >=
-							requiredsize) {
-			/* Add L1 header and L2 header */
-			*msg = l1_header;
-			msg++;
-			*msg = l2_header;
-			msg++;
-
-			/* copy the l2 message in 1 memcpy */
-			memcpy((void *)msg, addr, length);
-			/* UpdateWptr */
-			fifo->writer_local_wptr += requiredsize;
-			fifo->availablesize -= requiredsize;
-			fifo->writer_local_wptr %= fifo->end_addr_fifo;
-		} else {
-			/*
-			 * message is split between and of FIFO and beg of FIFO
-			 * copy first part from writer_local_wptr to end of FIFO
-			 */
-			size = fifo->end_addr_fifo-fifo->writer_local_wptr;
-
-			if (size == 1) {
-				/* Add L1 header */
-				*msg = l1_header;
-				msg++;
-				/* UpdateWptr */
-				fifo->writer_local_wptr = 0;
-				fifo->availablesize -= size;
-				/*
-				 * copy second part from beg of FIFO
-				 * with remaining part of msg
-				 */
-				msg =	(u32 *)
-						fifo->fifo_virtual_addr;
-				*msg = l2_header;
-				msg++;
-
-				/* copy the l3 message in 1 memcpy */
-				memcpy((void *)msg, addr, length);
-				/* UpdateWptr */
-				fifo->writer_local_wptr +=
-							requiredsize-size;
-				fifo->availablesize -=
-							(requiredsize-size);
-			} else if (size == 2) {
-				/* Add L1 header and L2 header */
-				*msg = l1_header;
-				msg++;
-				*msg = l2_header;
-				msg++;
-
-				/* UpdateWptr */
-				fifo->writer_local_wptr = 0;
-				fifo->availablesize -= size;
-
-				/*
-				 * copy second part from beg of FIFO
-				 * with remaining part of msg
-				 */
-				msg =	(u32 *)
-						fifo->fifo_virtual_addr;
-				/* copy the l3 message in 1 memcpy */
-				memcpy((void *)msg, addr, length);
-
-				/* UpdateWptr */
-				fifo->writer_local_wptr +=
-							requiredsize-size;
-				fifo->availablesize -=
-							(requiredsize-size);
-			} else {
-				/* Add L1 header and L2 header */
-				*msg = l1_header;
-				msg++;
-				*msg = l2_header;
-				msg++;
-
-				/* copy the l2 message in 1 memcpy */
-				memcpy((void *)msg, addr, (size-2)*4);
-
-
-				/* UpdateWptr */
-				fifo->writer_local_wptr = 0;
-				fifo->availablesize -= size;
-
-				/*
-				 * copy second part from beg of FIFO
-				 * with remaining part of msg
-				 */
-				msg = (u32 *)fifo->fifo_virtual_addr;
-				src = (u8 *)addr+((size - 2) * 4);
-				memcpy((void *)msg, src,
-						(length-((size - 2) * 4)));
-
-				/* UpdateWptr */
-				fifo->writer_local_wptr +=
-							requiredsize-size;
-				fifo->availablesize -=
-							(requiredsize-size);
-			}
-
-		}
+	msg = (u32 *)(fifo->fifo_virtual_addr + fifo->writer_local_wptr);
+	size = fifo->end_addr_fifo - fifo->writer_local_wptr;
+	if ((fifo->writer_local_rptr > fifo->writer_local_wptr) ||
+						(size >= requiredsize)) {
+		/* whole message fits in front of writer_local_wptr */
+		msg[0] = l1_header;
+		msg[1] = l2_header;
+		ret = src->copy(&msg[2], src, 0, length);
+	} else if (size == 1) {
+		/* only the L1 header fits before the end of FIFO */
+		msg[0] = l1_header;
+		msg = fifo->fifo_virtual_addr;
+		msg[0] = l2_header;
+		ret = src->copy(&msg[1], src, 0, length);
 	} else {
-		/* writer_local_rptr > writer_local_wptr */
-		msg = (u32 *)
-			(fifo->fifo_virtual_addr+fifo->writer_local_wptr);
-		/* Add L1 header and L2 header */
-		*msg = l1_header;
-		msg++;
-		*msg = l2_header;
-		msg++;
 		/*
-		 * copy message possbile between writer_local_wptr up
-		 * to writer_local_rptr copy the l3 message in 1 memcpy
+		 * message is split between end of FIFO and beg of FIFO,
+		 * headers and first (size - 2) words go up to end of FIFO
 		 */
-		memcpy((void *)msg, addr, length);
-
-		/* UpdateWptr */
-		fifo->writer_local_wptr += requiredsize;
-		fifo->availablesize -= requiredsize;
-
+		msg[0] = l1_header;
+		msg[1] = l2_header;
+		first = (size - 2) * 4;
+		ret = src->copy(&msg[2], src, 0, first);
+		if (!ret)
+			ret = src->copy(fifo->fifo_virtual_addr, src, first,
+							length - first);
 	}
-	spin_unlock_bh(&fifo->fifo_update_lock);
+	if (ret < 0) {
+		/* nothing is published, the message slot is simply reused */
+		return ret;
+	}
+	/* message words before the pointer that covers them */
+	smp_wmb();
+	/* UpdateWptr */
+	fifo->writer_local_wptr = (fifo->writer_local_wptr + requiredsize) %
+							fifo->end_addr_fifo;
+	if (channel == COMMON_CHANNEL)
+		msg_common_counter++;
+	else
+		msg_audio_counter++;
+	shrm_stats_fifo_level(channel == COMMON_CHANNEL ?
+				SHRM_AC_COMMON_FIFO : SHRM_AC_AUDIO_FIFO,
+			fifo->end_addr_fifo - availablesize + requiredsize);
 	return length;
 }
 
 /**
- * read_one_l2msg_common() - read message from common channel
+ * read_one_l2msg() - locate the next message in a CMT->APE FIFO
  * @shrm:	pointer to shrm device information structure
- * @l2_msg:	pointer to the read L2 message buffer
- * @len:	message length
+ * @fifo:	FIFO to read from
+ * @msg:	filled in with where the message lies in the FIFO
  *
- * This function read one message from the FIFO  and returns l2 header type
+ * The message is not copied and reader_local_rptr is left alone, the
+ * caller gives the space back with consume_one_l2msg() once it has
+ * copied the message out.  Returns the l2 header type.
  */
-u8 read_one_l2msg_common(struct shrm_dev *shrm,
-			u8 *l2_msg, u32 *len)
+static u8 read_one_l2msg(struct shrm_dev *shrm,
+			struct fifo_read_params *fifo, struct shrm_l2msg *msg)
 {
-	struct fifo_read_params *fifo = &cmt_shm_fifo_0;
-
-	u32 *msg;
+	u32 *ptr;
 	u32 l1_header = 0;
 	u32 l2_header = 0;
 	u32 length;
@@ -399,9 +325,9 @@ u8 read_one_l2msg_common(struct shrm_dev *shrm,
 	u32 size = 0;
 
 	/* Read L1 header read content of reader_local_rptr */
-	msg = (u32 *)
+	ptr = (u32 *)
 		(fifo->reader_local_rptr+fifo->fifo_virtual_addr);
-	l1_header = *msg++;
+	l1_header = *ptr++;
 	msgtype = (l1_header & 0xF0000000) >> L1_HEADER_MASK;
 
 	if (msgtype != L1_NORMAL_MSG) {
@@ -418,6 +344,7 @@ u8 read_one_l2msg_common(struct shrm_dev *shrm,
 						fifo->availablesize);
 		dev_info(shrm->dev, "end_fifo= %x\n",
 						fifo->end_addr_fifo);
+		dev_info(shrm->dev, "Received msgtype is %d\n", msgtype);
 		/* Fatal ERROR - should never happens */
 		dev_crit(shrm->dev, "Fatal ERROR - should never happen\n");
 		dev_info(shrm->dev, "Initiating a modem reset\n");
@@ -429,58 +356,96 @@ u8 read_one_l2msg_common(struct shrm_dev *shrm,
 		length = l2_header & MASK_0_39_BIT;
 	} else {
 		/* Read L2 header,Msg size & content of reader_local_rptr */
-		l2_header = *msg;
+		l2_header = *ptr;
 		length = l2_header & MASK_0_39_BIT;
 	}
 
-	*len = length;
+	msg->size = length;
+	msg->wrap = NULL;
+	msg->wrap_len = 0;
 	msg_size = ((length + 3) / 4);
 	msg_size += 2;
 
 	if (fifo->reader_local_rptr + msg_size <=
 						fifo->end_addr_fifo) {
-		/* Skip L2 header */
-		msg++;
-
-		/* read msg between reader_local_rptr and end of FIFO */
-		memcpy((void *)l2_msg, (void *)msg, length);
-		/* UpdateLocalRptr */
-		fifo->reader_local_rptr += msg_size;
-		fifo->reader_local_rptr %= fifo->end_addr_fifo;
+		/* msg lies between reader_local_rptr and end of FIFO */
+		msg->data = ptr + 1;
+		msg->len = length;
 	} else {
 		/*
-		 * msg split between end of FIFO and beg copy first
-		 * part of msg read msg between reader_local_rptr
-		 * and end of FIFO
+		 * msg split between end of FIFO and beg, with the
+		 * headers possibly at the end and all of the data at
+		 * the beginning
 		 */
 		size = fifo->end_addr_fifo-fifo->reader_local_rptr;
 		if (size == 1) {
-			msg = (u32 *)(fifo->fifo_virtual_addr);
-			/* Skip L2 header */
-			msg++;
-			memcpy((void *)l2_msg, (void *)(msg), length);
+			msg->data = fifo->fifo_virtual_addr + 1;
+			msg->len = length;
 		} else if (size == 2) {
-			/* Skip L2 header */
-			msg++;
-			msg = (u32 *)(fifo->fifo_virtual_addr);
-			memcpy((void *)l2_msg,
-						(void *)(msg), length);
+			msg->data = fifo->fifo_virtual_addr;
+			msg->len = length;
 		} else {
-			/* Skip L2 header */
-			msg++;
-			memcpy((void *)l2_msg, (void *)msg, ((size - 2) * 4));
-			/* copy second part of msg */
-			l2_msg += ((size - 2) * 4);
-			msg = (u32 *)(fifo->fifo_virtual_addr);
-			memcpy((void *)l2_msg, (void *)(msg),
-						(length-((size - 2) * 4)));
+			msg->data = ptr + 1;
+			msg->len = (size - 2) * 4;
+			msg->wrap = fifo->fifo_virtual_addr;
+			msg->wrap_len = length - msg->len;
 		}
-		fifo->reader_local_rptr =
-			(fifo->reader_local_rptr+msg_size) %
-				fifo->end_addr_fifo;
 	}
 	return (l2_header>>L2_HEADER_OFFSET) & MASK_0_15_BIT;
- }
+}
+
+/* Give the FIFO space of a message back, see read_one_l2msg() */
+static void consume_one_l2msg(struct fifo_read_params *fifo,
+			struct shrm_l2msg *msg)
+{
+	u32 msg_size = ((msg->size + 3) / 4) + 2;
+
+	fifo->reader_local_rptr =
+		(fifo->reader_local_rptr + msg_size) % fifo->end_addr_fifo;
+}
+
+/**
+ * shrm_l2msg_read() - copy part of a message out of the FIFO
+ * @msg:	message returned by read_one_l2msg_common/audio()
+ * @offset:	offset in the message
+ * @buf:	destination buffer
+ * @len:	number of bytes to copy
+ */
+void shrm_l2msg_read(struct shrm_l2msg *msg, unsigned int offset,
+			void *buf, unsigned int len)
+{
+	u32 count;
+
+	if (offset < msg->len) {
+		count = min(len, msg->len - offset);
+		memcpy(buf, msg->data + offset, count);
+		buf += count;
+		len -= count;
+		offset = 0;
+	} else {
+		offset -= msg->len;
+	}
+	if (len)
+		memcpy(buf, msg->wrap + offset, len);
+}
+
+/**
+ * read_one_l2msg_common() - read message from common channel
+ * @shrm:	pointer to shrm device information structure
+ * @msg:	filled in with the location of the message
+ *
+ * This function locates one message in the FIFO and returns l2 header
+ * type.  consume_one_l2msg_common() frees it once it has been copied.
+ */
+u8 read_one_l2msg_common(struct shrm_dev *shrm, struct shrm_l2msg *msg)
+{
+	return read_one_l2msg(shrm, &cmt_shm_fifo_0, msg);
+}
+
+void consume_one_l2msg_common(struct shrm_dev *shrm, struct shrm_l2msg *msg)
+{
+	consume_one_l2msg(&cmt_shm_fifo_0, msg);
+}
 
 u8 read_remaining_messages_common()
 {
@@ -492,103 +457,15 @@ u8 read_remaining_messages_common()
 	return ((fifo->reader_local_rptr != fifo->reader_local_wptr) ? 1 : 0);
 }
 
-u8 read_one_l2msg_audio(struct shrm_dev *shrm,
-				u8 *l2_msg, u32 *len)
+u8 read_one_l2msg_audio(struct shrm_dev *shrm, struct shrm_l2msg *msg)
 {
-	struct fifo_read_params *fifo = &cmt_shm_fifo_1;
-
-	u32 *msg;
-	u32 l1_header = 0;
-	u32 l2_header = 0;
-	u32 length;
-	u8 msgtype;
-	u32 msg_size;
-	u32 size = 0;
-
-	/* Read L1 header read content of reader_local_rptr */
-	 msg = (u32 *)
-			(fifo->reader_local_rptr+fifo->fifo_virtual_addr);
-	 l1_header = *msg++;
-	 msgtype = (l1_header & 0xF0000000) >> L1_HEADER_MASK;
-
-	if (msgtype != L1_NORMAL_MSG) {
-		/* Fatal ERROR - should never happens */
-		dev_info(shrm->dev, "wr_local_wptr= %x\n",
-						fifo->reader_local_wptr);
-		dev_info(shrm->dev, "wr_local_rptr= %x\n",
-						fifo->reader_local_rptr);
-		dev_info(shrm->dev, "shared_wptr= %x\n",
-						fifo->shared_wptr);
-		dev_info(shrm->dev, "shared_rptr= %x\n",
-						fifo->shared_rptr);
-		dev_info(shrm->dev, "availsize=%x\n",
-						fifo->availablesize);
-		dev_info(shrm->dev, "end_fifo= %x\n",
-						fifo->end_addr_fifo);
-		dev_info(shrm->dev, "Received msgtype is %d\n", msgtype);
-		/* Fatal ERROR - should never happens */
-		dev_crit(shrm->dev, "Fatal ERROR - should never happen\n");
-		dev_info(shrm->dev, "Initiating a modem reset\n");
-		queue_kthread_work(&shrm->shm_ac_wake_kw,
-				&shrm->shm_mod_reset_req);
-	 }
-	if (fifo->reader_local_rptr == (fifo->end_addr_fifo-1)) {
-		l2_header = (*((u32 *)fifo->fifo_virtual_addr));
-		length = l2_header & MASK_0_39_BIT;
-	} else {
-		/* Read L2 header,Msg size & content of reader_local_rptr */
-		l2_header = *msg;
-		length = l2_header & MASK_0_39_BIT;
-	}
-
-	*len = length;
-	msg_size = ((length + 3) / 4);
-	msg_size += 2;
-
-	if (fifo->reader_local_rptr + msg_size <=
-						fifo->end_addr_fifo) {
-		/* Skip L2 header */
-		msg++;
-		/* read msg between reader_local_rptr and end of FIFO */
-		memcpy((void *)l2_msg, (void *)msg, length);
-		/* UpdateLocalRptr */
-		fifo->reader_local_rptr += msg_size;
-		fifo->reader_local_rptr %= fifo->end_addr_fifo;
-	} else {
-
-		/*
-		 * msg split between end of FIFO and beg
-		 * copy first part of msg
-		 * read msg between reader_local_rptr and end of FIFO
-		 */
-		size = fifo->end_addr_fifo-fifo->reader_local_rptr;
-		if (size == 1) {
-			msg = (u32 *)(fifo->fifo_virtual_addr);
-			/* Skip L2 header */
-			msg++;
-			memcpy((void *)l2_msg, (void *)(msg), length);
-		} else if (size == 2) {
-			/* Skip L2 header */
-			msg++;
-			msg = (u32 *)(fifo->fifo_virtual_addr);
-			memcpy((void *)l2_msg, (void *)(msg), length);
-		} else {
-			/* Skip L2 header */
-			msg++;
-			memcpy((void *)l2_msg, (void *)msg, ((size - 2) * 4));
-			/* copy second part of msg */
-			l2_msg += ((size - 2) * 4);
-			msg = (u32 *)(fifo->fifo_virtual_addr);
-			memcpy((void *)l2_msg, (void *)(msg),
-						(length-((size - 2) * 4)));
-		}
-		fifo->reader_local_rptr =
-			(fifo->reader_local_rptr+msg_size) %
-			fifo->end_addr_fifo;
+	return read_one_l2msg(shrm, &cmt_shm_fifo_1, msg);
+}
 
-	}
-	return (l2_header>>L2_HEADER_OFFSET) & MASK_0_15_BIT;
- }
+void consume_one_l2msg_audio(struct shrm_dev *shrm, struct shrm_l2msg *msg)
+{
+	consume_one_l2msg(&cmt_shm_fifo_1, msg);
+}
 
 u8 read_remaining_messages_audio()
 {
@@ -603,6 +480,7 @@ u8 is_the_only_one_unread_message(struct shrm_dev *shrm,
 {
 	struct fifo_write_params *fifo = NULL;
 	u32 messagesize = 0;
+	u32 rptr;
 	u8 is_only_one_unread_msg = 0;
 
 	if (channel == COMMON_CHANNEL)
@@ -614,18 +492,16 @@ u8 is_the_only_one_unread_message(struct shrm_dev *shrm,
 	messagesize = ((length + 3) / 4);
 	/* Add size of L1 & L2 header */
 	messagesize += 2;
-	/*
-	 * possibility of race condition with Ac Read notification interrupt.
-	 * need to check ?
-	 */
-	if (fifo->writer_local_wptr > fifo->writer_local_rptr)
+	/* the read notification tasklet may move writer_local_rptr */
+	rptr = ACCESS_ONCE(fifo->writer_local_rptr);
+	if (fifo->writer_local_wptr > rptr)
 		is_only_one_unread_msg =
-			((fifo->writer_local_rptr + messagesize) ==
+			((rptr + messagesize) ==
 			fifo->writer_local_wptr) ? 1 : 0;
 	else
 		/* Msg split between end of fifo and starting of Fifo */
 		is_only_one_unread_msg =
-			(((fifo->writer_local_rptr + messagesize) %
+			(((rptr + messagesize) %
 			fifo->end_addr_fifo) == fifo->writer_local_wptr) ?
 									1 : 0;
 
@@ -641,8 +517,13 @@ void update_ca_common_local_wptr(struct shrm_dev *shrm)
 	struct fifo_read_params *fifo = &cmt_shm_fifo_0;
 
 	fifo->shared_wptr =
-		(*((u32 *)shrm->ca_common_shared_wptr));
+		ACCESS_ONCE(*((u32 *)shrm->ca_common_shared_wptr));
+	/* the message words are read only after the pointer covering them */
+	rmb();
 	fifo->reader_local_wptr = fifo->shared_wptr;
+	shrm_stats_fifo_level(SHRM_CA_COMMON_FIFO, (fifo->reader_local_wptr -
+			fifo->reader_local_rptr + fifo->end_addr_fifo) %
+						fifo->end_addr_fifo);
 }
 
 void update_ca_audio_local_wptr(struct shrm_dev *shrm)
@@ -654,8 +535,13 @@ void update_ca_audio_local_wptr(struct shrm_dev *shrm)
 	struct fifo_read_params *fifo = &cmt_shm_fifo_1;
 
 	fifo->shared_wptr =
-		(*((u32 *)shrm->ca_audio_shared_wptr));
+		ACCESS_ONCE(*((u32 *)shrm->ca_audio_shared_wptr));
+	/* the message words are read only after the pointer covering them */
+	rmb();
 	fifo->reader_local_wptr = fifo->shared_wptr;
+	shrm_stats_fifo_level(SHRM_CA_AUDIO_FIFO, (fifo->reader_local_wptr -
+			fifo->reader_local_rptr + fifo->end_addr_fifo) %
+						fifo->end_addr_fifo);
 }
 
 void update_ac_common_local_rptr(struct shrm_dev *shrm)
@@ -665,27 +551,15 @@ void update_ac_common_local_rptr(struct shrm_dev *shrm)
 	 * shared read pointer
 	 */
 	struct fifo_write_params *fifo;
-	u32 free_space = 0;
+	u32 rptr;
 
 	fifo = &ape_shm_fifo_0;
 
-	spin_lock_bh(&fifo->fifo_update_lock);
-	fifo->shared_rptr =
-		(*((u32 *)shrm->ac_common_shared_rptr));
-
-	if (fifo->shared_rptr >= fifo->writer_local_rptr)
-		free_space =
-			(fifo->shared_rptr-fifo->writer_local_rptr);
-	else {
-		free_space =
-			(fifo->end_addr_fifo-fifo->writer_local_rptr);
-		free_space += fifo->shared_rptr;
-	}
-
-	/* Chance of race condition of below variables with write_msg */
-	fifo->availablesize += free_space;
-	fifo->writer_local_rptr = fifo->shared_rptr;
-	spin_unlock_bh(&fifo->fifo_update_lock);
+	rptr = ACCESS_ONCE(*((u32 *)shrm->ac_common_shared_rptr));
+	/* the modem is done with the words up to rptr, reuse them after */
+	mb();
+	fifo->shared_rptr = rptr;
+	ACCESS_ONCE(fifo->writer_local_rptr) = rptr;
 }
 
 void update_ac_audio_local_rptr(struct shrm_dev *shrm)
@@ -695,26 +569,15 @@ void update_ac_audio_local_rptr(struct shrm_dev *shrm)
 	 * shared read pointer
 	 */
 	struct fifo_write_params *fifo;
-	u32 free_space = 0;
+	u32 rptr;
 
 	fifo = &ape_shm_fifo_1;
-	spin_lock_bh(&fifo->fifo_update_lock);
-	fifo->shared_rptr =
-		(*((u32 *)shrm->ac_audio_shared_rptr));
 
-	if (fifo->shared_rptr >= fifo->writer_local_rptr)
-		free_space =
-			(fifo->shared_rptr-fifo->writer_local_rptr);
-	else {
-		free_space =
-			(fifo->end_addr_fifo-fifo->writer_local_rptr);
-		free_space += fifo->shared_rptr;
-	}
-
-	/* Chance of race condition of below variables with write_msg */
-	fifo->availablesize += free_space;
-	fifo->writer_local_rptr = fifo->shared_rptr;
-	spin_unlock_bh(&fifo->fifo_update_lock);
+	rptr = ACCESS_ONCE(*((u32 *)shrm->ac_audio_shared_rptr));
+	/* the modem is done with the words up to rptr, reuse them after */
+	mb();
+	fifo->shared_rptr = rptr;
+	ACCESS_ONCE(fifo->writer_local_rptr) = rptr;
 }
 
 void update_ac_common_shared_wptr(struct shrm_dev *shrm)
@@ -724,15 +587,15 @@ void update_ac_common_shared_wptr(struct shrm_dev *shrm)
 	 * local write pointer
 	 */
 	struct fifo_write_params *fifo;
+	u32 wptr;
 
 	fifo = &ape_shm_fifo_0;
-	spin_lock_bh(&fifo->fifo_update_lock);
+	wptr = ACCESS_ONCE(fifo->writer_local_wptr);
+	/* the message words must reach the IPC zone before the pointer */
+	wmb();
 	/* Update shared pointer fifo offset of the IPC zone */
-	(*((u32 *)shrm->ac_common_shared_wptr)) =
-						fifo->writer_local_wptr;
-
-	fifo->shared_wptr = fifo->writer_local_wptr;
-	spin_unlock_bh(&fifo->fifo_update_lock);
+	(*((u32 *)shrm->ac_common_shared_wptr)) = wptr;
+	fifo->shared_wptr = wptr;
 }
 
 void update_ac_audio_shared_wptr(struct shrm_dev *shrm)
@@ -742,14 +605,15 @@ void update_ac_audio_shared_wptr(struct shrm_dev *shrm)
 	 * local write pointer
 	 */
 	struct fifo_write_params *fifo;
+	u32 wptr;
 
 	fifo = &ape_shm_fifo_1;
-	spin_lock_bh(&fifo->fifo_update_lock);
+	wptr = ACCESS_ONCE(fifo->writer_local_wptr);
+	/* the message words must reach the IPC zone before the pointer */
+	wmb();
 	/* Update shared pointer fifo offset of the IPC zone */
-	(*((u32 *)shrm->ac_audio_shared_wptr)) =
-						fifo->writer_local_wptr;
-	fifo->shared_wptr = fifo->writer_local_wptr;
-	spin_unlock_bh(&fifo->fifo_update_lock);
+	(*((u32 *)shrm->ac_audio_shared_wptr)) = wptr;
+	fifo->shared_wptr = wptr;
 }
 
 void update_ca_common_shared_rptr(struct shrm_dev *shrm)
@@ -762,6 +626,8 @@ void update_ca_common_shared_rptr(struct shrm_dev *shrm)
 
 	fifo = &cmt_shm_fifo_0;
 
+	/* all reads of the consumed words are done before handing them back */
+	mb();
 	/* Update shared pointer fifo offset of the IPC zone */
 	(*((u32 *)shrm->ca_common_shared_rptr)) =
 						fifo->reader_local_rptr;
@@ -778,6 +644,8 @@ void update_ca_audio_shared_rptr(struct shrm_dev *shrm)
 
 	fifo = &cmt_shm_fifo_1;
 
+	/* all reads of the consumed words are done before handing them back */
+	mb();
 	/* Update shared pointer fifo offset of the IPC zone */
 	(*((u32 *)shrm->ca_audio_shared_rptr)) =
 						fifo->reader_local_rptr;
@@ -809,11 +677,31 @@ void get_writer_pointers(u8 channel_type, u32 *writer_local_rptr,
 	else /* channel_type = AUDIO_CHANNEL */
 		fifo = &ape_shm_fifo_1;
 
-	spin_lock_bh(&fifo->fifo_update_lock);
-	*writer_local_rptr = fifo->writer_local_rptr;
-	*writer_local_wptr = fifo->writer_local_wptr;
-	*shared_wptr = fifo->shared_wptr;
-	spin_unlock_bh(&fifo->fifo_update_lock);
+	*writer_local_rptr = ACCESS_ONCE(fifo->writer_local_rptr);
+	*writer_local_wptr = ACCESS_ONCE(fifo->writer_local_wptr);
+	*shared_wptr = ACCESS_ONCE(fifo->shared_wptr);
+}
+
+/**
+ * shm_fifo_unpublished() - words written but not yet shown to the modem
+ * @channel:	audio or common channel
+ *
+ * Only meaningful from the single writer of @channel.
+ */
+u32 shm_fifo_unpublished(u8 channel)
+{
+	struct fifo_write_params *fifo;
+	u32 shared_wptr;
+
+	if (channel == COMMON_CHANNEL)
+		fifo = &ape_shm_fifo_0;
+	else /* channel = AUDIO_CHANNEL */
+		fifo = &ape_shm_fifo_1;
+
+	shared_wptr = ACCESS_ONCE(fifo->shared_wptr);
+	if (fifo->writer_local_wptr >= shared_wptr)
+		return fifo->writer_local_wptr - shared_wptr;
+	return fifo->end_addr_fifo - shared_wptr + fifo->writer_local_wptr;
 }
 
 void set_ca_msg_0_read_notif_send(u8 val)
@@ -46,14 +46,13 @@
 #define PRCM_MOD_RESETN_VAL	0x204
 
 static u8 boot_state = BOOT_INIT;
-static u8 recieve_common_msg[8*1024];
-static u8 recieve_audio_msg[8*1024];
 static received_msg_handler rx_common_handler;
 static received_msg_handler rx_audio_handler;
 static struct hrtimer timer;
 static struct hrtimer mod_stuck_timer_0;
 static struct hrtimer mod_stuck_timer_1;
 static struct hrtimer fifo_full_timer;
+static struct hrtimer tx_coalesce_timer;
 struct sock *shrm_nl_sk;
 
 static char shrm_common_tx_state = SHRM_SLEEP_STATE;
@@ -65,18 +64,29 @@ static atomic_t ac_sleep_disable_count = ATOMIC_INIT(0);
 static atomic_t ac_msg_pend_1 = ATOMIC_INIT(0);
 static atomic_t mod_stuck = ATOMIC_INIT(0);
 static atomic_t fifo_full = ATOMIC_INIT(0);
+static atomic_t tx_coalesce_pending = ATOMIC_INIT(0);
+/* ns timestamp of the first unserved audio interrupt, 0 for none */
+static atomic64_t audio_rx_stamp = ATOMIC64_INIT(0);
+static ktime_t ca_wake_stamp;
+static ktime_t ca_sleep_stamp;
 static struct shrm_dev *shm_dev;
 
+/*
+ * Hold back the common channel message pending notification for up to
+ * this long, so that a burst of messages costs the modem one wakeup.
+ * 0 notifies for every message that finds the modem idle.
+ */
+static unsigned int tx_coalesce_usecs;
+module_param(tx_coalesce_usecs, uint, 0644);
+MODULE_PARM_DESC(tx_coalesce_usecs,
+		"Common channel TX notification coalescing delay (us)");
+
 /* Spin lock and tasklet declaration */
 DECLARE_TASKLET(shm_ca_0_tasklet, shm_ca_msgpending_0_tasklet, 0);
-DECLARE_TASKLET(shm_ca_1_tasklet, shm_ca_msgpending_1_tasklet, 0);
 DECLARE_TASKLET(shm_ac_read_0_tasklet, shm_ac_read_notif_0_tasklet, 0);
-DECLARE_TASKLET(shm_ac_read_1_tasklet, shm_ac_read_notif_1_tasklet, 0);
 
 static DEFINE_MUTEX(ac_state_mutex);
 
-static DEFINE_SPINLOCK(ca_common_lock);
-static DEFINE_SPINLOCK(ca_audio_lock);
 static DEFINE_SPINLOCK(ca_wake_req_lock);
 static DEFINE_SPINLOCK(boot_lock);
 static DEFINE_SPINLOCK(mod_stuck_lock);
@@ -116,18 +126,37 @@ void shm_mod_reset_req_work(struct kthread_work *work)
 	prcmu_modem_reset();
 }
 
+/* modem_request(), timing the AC wake handshake when there is one */
+static void shrm_modem_request(struct shrm_dev *shrm)
+{
+	ktime_t start;
+
+	if (modem_get_usage(shrm->modem)) {
+		modem_request(shrm->modem);
+		return;
+	}
+	start = ktime_get();
+	modem_request(shrm->modem);
+	shrm_stats_handshake(SHRM_AC_WAKE, start);
+}
+
 static void shm_ac_sleep_req_work(struct kthread_work *work)
 {
+	ktime_t start;
+
 	mutex_lock(&ac_state_mutex);
-	if (atomic_read(&ac_sleep_disable_count) == 0)
+	if (atomic_read(&ac_sleep_disable_count) == 0) {
+		start = ktime_get();
 		modem_release(shm_dev->modem);
+		shrm_stats_handshake(SHRM_AC_SLEEP, start);
+	}
 	mutex_unlock(&ac_state_mutex);
 }
 
 static void shm_ac_wake_req_work(struct kthread_work *work)
 {
 	mutex_lock(&ac_state_mutex);
-	modem_request(shm_dev->modem);
+	shrm_modem_request(shm_dev);
 	mutex_unlock(&ac_state_mutex);
 }
 
@@ -158,6 +187,23 @@ static enum hrtimer_restart shm_fifo_full_timeout(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+static enum hrtimer_restart shm_tx_coalesce_timeout(struct hrtimer *timer)
+{
+	if (atomic_xchg(&tx_coalesce_pending, 0))
+		queue_kthread_work(&shm_dev->shm_common_ch_wr_kw,
+				&shm_dev->send_ac_msg_pend_notify_0);
+	return HRTIMER_NORESTART;
+}
+
+/* publish the common channel wptr and notify the modem now */
+static void shm_common_tx_kick(struct shrm_dev *shrm)
+{
+	if (atomic_xchg(&tx_coalesce_pending, 0))
+		hrtimer_try_to_cancel(&tx_coalesce_timer);
+	queue_kthread_work(&shrm->shm_common_ch_wr_kw,
+			&shrm->send_ac_msg_pend_notify_0);
+}
+
 static enum hrtimer_restart shm_mod_stuck_timeout(struct hrtimer *timer)
 {
 	unsigned long flags;
@@ -323,8 +369,8 @@ void shm_ca_msgpending_0_tasklet(unsigned long tasklet_data)
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
 
-	/* Interprocess locking */
-	spin_lock(&ca_common_lock);
+	/* this tasklet is the only reader of the CA common FIFO */
+	shrm->rx_common_irqs++;
 
 	/* Update_reader_local_wptr with shared_wptr */
 	update_ca_common_local_wptr(shrm);
@@ -373,17 +419,23 @@ void shm_ca_msgpending_0_tasklet(unsigned long tasklet_data)
 				"BOOT_INFO_SYNC\n");
 		}
 	}
-	/* Interprocess locking */
-	spin_unlock(&ca_common_lock);
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
 }
 
-void shm_ca_msgpending_1_tasklet(unsigned long tasklet_data)
+/*
+ * The audio channel bottom halves run on their own realtime kthread
+ * rather than as tasklets, so that voice frames are not held back behind
+ * the common channel tasklets when those are busy with bulk data.
+ */
+static void shm_audio_rx_req_work(struct kthread_work *work)
 {
-	struct shrm_dev *shrm = (struct shrm_dev *)tasklet_data;
+	struct shrm_dev *shrm = container_of(work, struct shrm_dev,
+			shm_audio_rx_req);
 	u32 reader_local_rptr;
 	u32 reader_local_wptr;
 	u32 shared_rptr;
+	ktime_t irq_stamp;
+	s64 stamp_ns;
 
 	/*
 	 * This function is called when CaMsgPendingNotification Trigerred
@@ -392,15 +444,20 @@ void shm_ca_msgpending_1_tasklet(unsigned long tasklet_data)
 
 	dev_dbg(shrm->dev, "%s IN\n", __func__);
 
+	/*
+	 * Take the stamp and clear it in one go, so that a notification
+	 * from here on gets a new one. A rerun finding none reports none.
+	 */
+	stamp_ns = atomic64_xchg(&audio_rx_stamp, 0);
+	irq_stamp = ns_to_ktime(stamp_ns);
+
 	if (check_modem_in_reset()) {
 		dev_err(shrm->dev, "%s:Modem state reset or unknown\n",
 				__func__);
 		return;
 	}
 
-	/* Interprocess locking */
-	spin_lock(&ca_audio_lock);
-
+	/* this work is the only reader of the CA audio FIFO */
 	/* Update_reader_local_wptr(with shared_wptr) */
 	update_ca_audio_local_wptr(shrm);
 	get_reader_pointers(AUDIO_CHANNEL, &reader_local_rptr,
@@ -417,15 +474,13 @@ void shm_ca_msgpending_1_tasklet(unsigned long tasklet_data)
 	if (reader_local_rptr != shared_rptr)
 		ca_msg_read_notification_1(shrm);
 	if (reader_local_rptr != reader_local_wptr)
-		receive_messages_audio(shrm);
+		receive_messages_audio(shrm, irq_stamp);
 
 	get_reader_pointers(AUDIO_CHANNEL, &reader_local_rptr,
 			&reader_local_wptr, &shared_rptr);
 	if (reader_local_rptr == reader_local_wptr)
 		shrm_audio_rx_state = SHRM_IDLE;
 
-	 /* Interprocess locking */
-	spin_unlock(&ca_audio_lock);
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
 }
 
@@ -468,9 +523,9 @@ void shm_ac_read_notif_0_tasklet(unsigned long tasklet_data)
 
 	} else if (boot_state == BOOT_DONE) {
 		if (writer_local_rptr != writer_local_wptr) {
+			/* the modem is awake, don't hold back what's queued */
 			shrm_common_tx_state = SHRM_PTR_FREE;
-			queue_kthread_work(&shrm->shm_common_ch_wr_kw,
-					&shrm->send_ac_msg_pend_notify_0);
+			shm_common_tx_kick(shrm);
 		} else {
 			shrm_common_tx_state = SHRM_IDLE;
 			shrm_restart_netdev(shrm->ndev);
@@ -486,9 +541,10 @@ void shm_ac_read_notif_0_tasklet(unsigned long tasklet_data)
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
 }
 
-void shm_ac_read_notif_1_tasklet(unsigned long tasklet_data)
+static void shm_audio_read_notif_work(struct kthread_work *work)
 {
-	struct shrm_dev *shrm = (struct shrm_dev *)tasklet_data;
+	struct shrm_dev *shrm = container_of(work, struct shrm_dev,
+			shm_audio_read_notif);
 	u32 writer_local_rptr;
 	u32 writer_local_wptr;
 	u32 shared_wptr;
@@ -560,6 +616,7 @@ void shm_ca_sleep_req_work(struct kthread_work *work)
 		shm_dev->intr_base + GOP_SET_REGISTER_BASE);
 	preempt_enable();
 	local_irq_restore(flags);
+	shrm_stats_handshake(SHRM_CA_SLEEP, ca_sleep_stamp);
 
 	hrtimer_start(&timer, ktime_set(0, 10*NSEC_PER_MSEC),
 			HRTIMER_MODE_REL);
@@ -580,7 +637,7 @@ void shm_ca_wake_req_work(struct kthread_work *work)
 		shm_fifo_init(shrm);
 
 	mutex_lock(&ac_state_mutex);
-	modem_request(shrm->modem);
+	shrm_modem_request(shrm);
 	mutex_unlock(&ac_state_mutex);
 
 	local_irq_save(flags);
@@ -607,6 +664,7 @@ void shm_ca_wake_req_work(struct kthread_work *work)
 			shm_dev->intr_base + GOP_SET_REGISTER_BASE);
 	preempt_enable();
 	local_irq_restore(flags);
+	shrm_stats_handshake(SHRM_CA_WAKE, ca_wake_stamp);
 }
 #ifdef CONFIG_U8500_SHRM_MODEM_SILENT_RESET
 static int shrm_modem_reset_sequence(void)
@@ -621,9 +679,8 @@ static int shrm_modem_reset_sequence(void)
 	atomic_set(&mod_stuck, 0);
 	atomic_set(&fifo_full, 0);
 	tasklet_disable_nosync(&shm_ac_read_0_tasklet);
-	tasklet_disable_nosync(&shm_ac_read_1_tasklet);
 	tasklet_disable_nosync(&shm_ca_0_tasklet);
-	tasklet_disable_nosync(&shm_ca_1_tasklet);
+	/* the audio works bail out on their own while the modem is in reset */
 
 	/*
 	 * keep the count to 0 so that we can bring down the line
@@ -657,9 +714,7 @@ static int shrm_modem_reset_sequence(void)
 	spin_unlock_irqrestore(&boot_lock, flags);
 
 	tasklet_enable(&shm_ac_read_0_tasklet);
-	tasklet_enable(&shm_ac_read_1_tasklet);
 	tasklet_enable(&shm_ca_0_tasklet);
-	tasklet_enable(&shm_ca_1_tasklet);
 	/* re-enable irqs */
 	enable_irq(shm_dev->ac_read_notif_0_irq);
 	enable_irq(shm_dev->ac_read_notif_1_irq);
@@ -708,6 +763,7 @@ static irqreturn_t shrm_prcmu_irq_handler(int irq, void *data)
 
 	switch (irq) {
 	case IRQ_PRCMU_CA_WAKE:
+		ca_wake_stamp = ktime_get();
 		suspend_block_sleep();
 		if (shrm->msr_flag)
 			atomic_set(&ac_sleep_disable_count, 0);
@@ -715,6 +771,7 @@ static irqreturn_t shrm_prcmu_irq_handler(int irq, void *data)
 		queue_kthread_work(&shrm->shm_ca_wake_kw, &shrm->shm_ca_wake_req);
 		break;
 	case IRQ_PRCMU_CA_SLEEP:
+		ca_sleep_stamp = ktime_get();
 		queue_kthread_work(&shrm->shm_ca_wake_kw, &shrm->shm_ca_sleep_req);
 		break;
 	case IRQ_PRCMU_MODEM_SW_RESET_REQ:
@@ -762,7 +819,7 @@ static void send_ac_msg_pend_notify_0_work(struct kthread_work *work)
 
 	mutex_lock(&ac_state_mutex);
 	atomic_inc(&ac_sleep_disable_count);
-	modem_request(shrm->modem);
+	shrm_modem_request(shrm);
 	mutex_unlock(&ac_state_mutex);
 
 	spin_lock_irqsave(&start_timer_lock, flags);
@@ -784,6 +841,7 @@ static void send_ac_msg_pend_notify_0_work(struct kthread_work *work)
 	/* Trigger AcMsgPendingNotification to CMU */
 	writel((1<<GOP_COMMON_AC_MSG_PENDING_NOTIFICATION_BIT),
 			shrm->intr_base + GOP_SET_REGISTER_BASE);
+	shrm->tx_common_doorbells++;
 
 	/* timer to detect modem stuck or hang */
 	hrtimer_start(&mod_stuck_timer_0, ktime_set(MOD_STUCK_TIMEOUT, 0),
@@ -810,7 +868,7 @@ static void send_ac_msg_pend_notify_1_work(struct kthread_work *work)
 		atomic_inc(&ac_sleep_disable_count);
 		atomic_inc(&ac_msg_pend_1);
 	}
-	modem_request(shrm->modem);
+	shrm_modem_request(shrm);
 	mutex_unlock(&ac_state_mutex);
 
 	spin_lock_irqsave(&start_timer_lock, flags);
@@ -832,6 +890,7 @@ static void send_ac_msg_pend_notify_1_work(struct kthread_work *work)
 	/* Trigger AcMsgPendingNotification to CMU */
 	writel((1<<GOP_AUDIO_AC_MSG_PENDING_NOTIFICATION_BIT),
 			shrm->intr_base + GOP_SET_REGISTER_BASE);
+	shrm->tx_audio_doorbells++;
 
 	/* timer to detect modem stuck or hang */
 	hrtimer_start(&mod_stuck_timer_1, ktime_set(MOD_STUCK_TIMEOUT, 0),
@@ -899,6 +958,8 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 	mod_stuck_timer_1.function = shm_mod_stuck_timeout;
 	hrtimer_init(&fifo_full_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	fifo_full_timer.function = shm_fifo_full_timeout;
+	hrtimer_init(&tx_coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	tx_coalesce_timer.function = shm_tx_coalesce_timeout;
 
 	init_kthread_worker(&shrm->shm_common_ch_wr_kw);
 	shrm->shm_common_ch_wr_kw_task = kthread_run(kthread_worker_fn,
@@ -921,6 +982,18 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 	/* must use the FIFO scheduler as it is realtime sensitive */
 	sched_setscheduler(shrm->shm_audio_ch_wr_kw_task, SCHED_FIFO, &param);
 
+	init_kthread_worker(&shrm->shm_audio_ch_rx_kw);
+	shrm->shm_audio_ch_rx_kw_task = kthread_run(kthread_worker_fn,
+						    &shrm->shm_audio_ch_rx_kw,
+						    "shm_audio_channel_rx");
+	if (IS_ERR(shrm->shm_audio_ch_rx_kw_task)) {
+		dev_err(shrm->dev, "failed to create work task\n");
+		err = -ENOMEM;
+		goto free_kw2;
+	}
+	/* voice frames must not wait behind anything else */
+	sched_setscheduler(shrm->shm_audio_ch_rx_kw_task, SCHED_FIFO, &param);
+
 	init_kthread_worker(&shrm->shm_ac_wake_kw);
 	shrm->shm_ac_wake_kw_task = kthread_run(kthread_worker_fn,
 						&shrm->shm_ac_wake_kw,
@@ -928,7 +1001,7 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 	if (IS_ERR(shrm->shm_ac_wake_kw_task)) {
 		dev_err(shrm->dev, "failed to create work task\n");
 		err = -ENOMEM;
-		goto free_kw2;
+		goto free_kw_audio_rx;
 	}
 	/* must use the FIFO scheduler as it is realtime sensitive */
 	sched_setscheduler(shrm->shm_ac_wake_kw_task, SCHED_FIFO, &param);
@@ -968,6 +1041,9 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 			  send_ac_msg_pend_notify_0_work);
 	init_kthread_work(&shrm->send_ac_msg_pend_notify_1,
 			  send_ac_msg_pend_notify_1_work);
+	init_kthread_work(&shrm->shm_audio_rx_req, shm_audio_rx_req_work);
+	init_kthread_work(&shrm->shm_audio_read_notif,
+			  shm_audio_read_notif_work);
 	init_kthread_work(&shrm->shm_ca_wake_req, shm_ca_wake_req_work);
 	init_kthread_work(&shrm->shm_ca_sleep_req, shm_ca_sleep_req_work);
 	init_kthread_work(&shrm->shm_ac_sleep_req, shm_ac_sleep_req_work);
@@ -977,7 +1053,6 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 
 	/* set tasklet data */
 	shm_ca_0_tasklet.data = (unsigned long)shrm;
-	shm_ca_1_tasklet.data = (unsigned long)shrm;
 
 	err = request_irq(IRQ_PRCMU_CA_SLEEP, shrm_prcmu_irq_handler,
 			IRQF_NO_SUSPEND, "ca-sleep", shrm);
@@ -1011,6 +1086,7 @@ int shrm_protocol_init(struct shrm_dev *shrm,
 		goto drop;
 	}
 #endif
+	shrm_debugfs_init(shrm);
 	return 0;
 
 #ifdef CONFIG_U8500_SHRM_MODEM_SILENT_RESET
@@ -1029,6 +1105,8 @@ free_kw4:
 	kthread_stop(shrm->shm_ca_wake_kw_task);
 free_kw3:
 	kthread_stop(shrm->shm_ac_wake_kw_task);
+free_kw_audio_rx:
+	kthread_stop(shrm->shm_audio_ch_rx_kw_task);
 free_kw2:
 	kthread_stop(shrm->shm_audio_ch_wr_kw_task);
 free_kw1:
@@ -1041,14 +1119,18 @@ void shrm_protocol_deinit(struct shrm_dev *shrm)
 	free_irq(IRQ_PRCMU_CA_SLEEP, NULL);
 	free_irq(IRQ_PRCMU_CA_WAKE, NULL);
 	free_irq(IRQ_PRCMU_MODEM_SW_RESET_REQ, NULL);
+	hrtimer_cancel(&tx_coalesce_timer);
+	shrm_debugfs_exit();
 	flush_kthread_worker(&shrm->shm_common_ch_wr_kw);
 	flush_kthread_worker(&shrm->shm_audio_ch_wr_kw);
+	flush_kthread_worker(&shrm->shm_audio_ch_rx_kw);
 	flush_kthread_worker(&shrm->shm_ac_wake_kw);
 	flush_kthread_worker(&shrm->shm_ca_wake_kw);
 	flush_kthread_worker(&shrm->shm_ac_sleep_kw);
 	flush_kthread_worker(&shrm->shm_mod_stuck_kw);
 	kthread_stop(shrm->shm_common_ch_wr_kw_task);
 	kthread_stop(shrm->shm_audio_ch_wr_kw_task);
+	kthread_stop(shrm->shm_audio_ch_rx_kw_task);
 	kthread_stop(shrm->shm_ac_wake_kw_task);
 	kthread_stop(shrm->shm_ca_wake_kw_task);
 	kthread_stop(shrm->shm_ac_sleep_kw_task);
@@ -1100,6 +1182,7 @@ irqreturn_t ac_read_notif_0_irq_handler(int irq, void *ctrlr)
 	if (atomic_read(&fifo_full)) {
 		atomic_set(&fifo_full, 0);
 		hrtimer_cancel(&fifo_full_timer);
+		shrm_stats_fifo_drained();
 	}
 
 	if (check_modem_in_reset()) {
@@ -1152,6 +1235,7 @@ irqreturn_t ac_read_notif_1_irq_handler(int irq, void *ctrlr)
 	if (atomic_read(&fifo_full)) {
 		atomic_set(&fifo_full, 0);
 		hrtimer_cancel(&fifo_full_timer);
+		shrm_stats_fifo_drained();
 	}
 
 	if (check_modem_in_reset()) {
@@ -1160,8 +1244,8 @@ irqreturn_t ac_read_notif_1_irq_handler(int irq, void *ctrlr)
 		return IRQ_NONE;
 	}
 
-	shm_ac_read_1_tasklet.data = (unsigned long)shrm;
-	tasklet_schedule(&shm_ac_read_1_tasklet);
+	queue_kthread_work(&shrm->shm_audio_ch_rx_kw,
+			&shrm->shm_audio_read_notif);
 
 	local_irq_save(flags);
 	preempt_disable();
@@ -1247,7 +1331,9 @@ irqreturn_t ca_msg_pending_notif_1_irq_handler(int irq, void *ctrlr)
 		return IRQ_NONE;
 	}
 
-	tasklet_schedule(&shm_ca_1_tasklet);
+	/* delivery latency is measured from the first unserved interrupt */
+	atomic64_cmpxchg(&audio_rx_stamp, 0, ktime_to_ns(ktime_get()));
+	queue_kthread_work(&shrm->shm_audio_ch_rx_kw, &shrm->shm_audio_rx_req);
 
 	local_irq_save(flags);
 	preempt_disable();
@@ -1279,20 +1365,19 @@ irqreturn_t ca_msg_pending_notif_1_irq_handler(int irq, void *ctrlr)
 }
 
 /**
- * shm_write_msg() - write message to shared memory
+ * shm_write_msg_src() - write message to shared memory
  * @shrm:	pointer to the shrm device information structure
  * @l2_header:	L2 header
- * @addr:	pointer to the message
+ * @src:	source the message payload is copied from
  * @length:	length of the message to be written
  *
  * This function is called from net or char interface driver write operation.
- * Prior to calling this function the message is copied from the user space
- * buffer to the kernel buffer. This function based on the l2 header routes
- * the message to the respective channel and FIFO. Then makes a call to the
- * fifo write function where the message is written to the physical device.
+ * This function based on the l2 header routes the message to the respective
+ * channel and FIFO. Then makes a call to the fifo write function where the
+ * payload is copied by @src straight into the physical device.
  */
-int shm_write_msg(struct shrm_dev *shrm, u8 l2_header,
-					void *addr, u32 length)
+int shm_write_msg_src(struct shrm_dev *shrm, u8 l2_header,
+			struct shrm_tx_src *src, u32 length)
 {
 	u8 channel = 0;
 	int ret;
@@ -1333,9 +1418,11 @@ int shm_write_msg(struct shrm_dev *shrm, u8 l2_header,
 		ret = -ENODEV;
 		goto out;
 	}
-	ret = shm_write_msg_to_fifo(shrm, channel, l2_header, addr, length);
+	ret = shm_write_msg_to_fifo(shrm, channel, l2_header, src, length);
 	if (ret < 0) {
-		dev_err(shrm->dev, "write message to fifo failed\n");
+		/* -EFAULT is the source's to handle, e.g. by retrying */
+		if (ret != -EFAULT)
+			dev_err(shrm->dev, "write message to fifo failed\n");
 		if (ret == -EAGAIN) {
 			if (!atomic_read(&fifo_full)) {
 				/* Start a timer so as to handle this gently */
@@ -1343,24 +1430,41 @@ int shm_write_msg(struct shrm_dev *shrm, u8 l2_header,
 				hrtimer_start(&fifo_full_timer, ktime_set(
 						FIFO_FULL_TIMEOUT, 0),
 						HRTIMER_MODE_REL);
+				shrm_stats_fifo_full(channel);
 			}
 		}
 		return ret;
 	}
+	shrm_stats_tx(l2_header, length);
 	/*
 	 * notify only if new msg copied is the only unread one
 	 * otherwise it means that reading process is ongoing
 	 */
-	if (is_the_only_one_unread_message(shrm, channel, length)) {
-
-		/* Send Message Pending Noitication to CMT */
-		if (channel == 0)
-			queue_kthread_work(&shrm->shm_common_ch_wr_kw,
-					&shrm->send_ac_msg_pend_notify_0);
-		else
+	if (channel == 0) {
+		shrm->tx_common_msgs++;
+		if (is_the_only_one_unread_message(shrm, channel, length)) {
+			if (!tx_coalesce_usecs) {
+				/* Send Message Pending Noitication to CMT */
+				shm_common_tx_kick(shrm);
+			} else if (!atomic_xchg(&tx_coalesce_pending, 1)) {
+				/* first of a burst, notify when it ends */
+				hrtimer_start(&tx_coalesce_timer,
+					ns_to_ktime(tx_coalesce_usecs *
+						NSEC_PER_USEC),
+					HRTIMER_MODE_REL);
+			}
+		} else if (atomic_read(&tx_coalesce_pending) &&
+				shm_fifo_unpublished(channel) >=
+					shrm->ape_common_fifo_size / 4) {
+			/* don't let a long burst fill the FIFO unseen */
+			shm_common_tx_kick(shrm);
+		}
+	} else {
+		shrm->tx_audio_msgs++;
+		if (is_the_only_one_unread_message(shrm, channel, length))
+			/* Send Message Pending Noitication to CMT */
 			queue_kthread_work(&shrm->shm_audio_ch_wr_kw,
 					&shrm->send_ac_msg_pend_notify_1);
-
 	}
 
 	dev_dbg(shrm->dev, "%s OUT\n", __func__);
@@ -1370,6 +1474,33 @@ out:
 	return ret;
 }
 
+static int shm_copy_from_buf(void *dst, struct shrm_tx_src *src,
+						u32 offset, u32 len)
+{
+	memcpy(dst, (u8 *)src->data + offset, len);
+	return 0;
+}
+
+/**
+ * shm_write_msg() - write message to shared memory
+ * @shrm:	pointer to the shrm device information structure
+ * @l2_header:	L2 header
+ * @addr:	pointer to the message
+ * @length:	length of the message to be written
+ *
+ * Same as shm_write_msg_src() for a message held in a linear kernel buffer.
+ */
+int shm_write_msg(struct shrm_dev *shrm, u8 l2_header,
+					void *addr, u32 length)
+{
+	struct shrm_tx_src src = {
+		.copy = shm_copy_from_buf,
+		.data = addr,
+	};
+
+	return shm_write_msg_src(shrm, l2_header, &src, length);
+}
+
 void ca_msg_read_notification_0(struct shrm_dev *shrm)
 {
 	unsigned long flags;
@@ -1402,6 +1533,7 @@ void ca_msg_read_notification_0(struct shrm_dev *shrm)
 			shrm->intr_base + GOP_SET_REGISTER_BASE);
 		preempt_enable();
 		local_irq_restore(flags);
+		shrm->rx_common_read_notifs++;
 		set_ca_msg_0_read_notif_send(1);
 		shrm_common_rx_state = SHRM_PTR_BUSY;
 	}
@@ -1454,15 +1586,16 @@ void ca_msg_read_notification_1(struct shrm_dev *shrm)
  *
  * The messages sent from CMT to APE are written to the respective FIFO
  * and an interrupt is triggered by the CMT. This ca message pending
- * interrupt calls this function. This function sends a read notification
- * acknowledgement to the CMT and calls the common channel receive handler
- * where the messsage is copied to the respective(ISI, RPC, SECURIT) queue
- * based on the message l2 header.
+ * interrupt calls this function. This function calls the common channel
+ * receive handler for every message in the FIFO, where the messsage is
+ * copied to the respective(ISI, RPC, SECURIT) queue based on the message
+ * l2 header, and then sends one read notification acknowledgement to the
+ * CMT for the whole batch.
  */
 void receive_messages_common(struct shrm_dev *shrm)
 {
+	struct shrm_l2msg msg;
 	u8 l2_header;
-	u32 len;
 
 	if (check_modem_in_reset()) {
 		dev_err(shrm->dev, "%s:Modem state reset or unknown.\n",
@@ -1470,16 +1603,16 @@ void receive_messages_common(struct shrm_dev *shrm)
 		return;
 	}
 
-	l2_header = read_one_l2msg_common(shrm, recieve_common_msg, &len);
+	l2_header = read_one_l2msg_common(shrm, &msg);
 	/* Send Recieve_Call_back to Upper Layer */
 	if (!rx_common_handler) {
 		dev_err(shrm->dev, "common_rx_handler is Null\n");
 		BUG();
 	}
-	(*rx_common_handler)(l2_header, &recieve_common_msg, len,
-					shrm);
-	/* SendReadNotification */
-	ca_msg_read_notification_0(shrm);
+	(*rx_common_handler)(l2_header, &msg, shrm);
+	shrm_stats_rx(l2_header, msg.size);
+	/* the message has been copied out, its FIFO space can go back */
+	consume_one_l2msg_common(shrm, &msg);
 
 	while (read_remaining_messages_common()) {
 		if (check_modem_in_reset()) {
@@ -1488,18 +1621,21 @@ void receive_messages_common(struct shrm_dev *shrm)
 			return;
 		}
 
-		l2_header = read_one_l2msg_common(shrm, recieve_common_msg,
-								&len);
+		l2_header = read_one_l2msg_common(shrm, &msg);
 		/* Send Recieve_Call_back to Upper Layer */
-		(*rx_common_handler)(l2_header,
-					&recieve_common_msg, len,
-					shrm);
+		(*rx_common_handler)(l2_header, &msg, shrm);
+		shrm_stats_rx(l2_header, msg.size);
+		consume_one_l2msg_common(shrm, &msg);
 	}
+
+	/* SendReadNotification, once for the whole batch */
+	ca_msg_read_notification_0(shrm);
 }
 
 /**
  * receive_messages_audio() - receive audio message from CMT
  * @shrm:	pointer to shrm device information structure
+ * @irq_stamp:	when the ca message pending interrupt was taken, 0 if unknown
  *
  * The messages sent from CMT to APE are written to the respective FIFO
  * and an interrupt is triggered by the CMT. This ca message pending
@@ -1507,10 +1643,10 @@ void receive_messages_common(struct shrm_dev *shrm)
  * acknowledgement to the CMT and calls the common channel receive handler
  * where the messsage is copied to the audio queue.
  */
-void receive_messages_audio(struct shrm_dev *shrm)
+void receive_messages_audio(struct shrm_dev *shrm, ktime_t irq_stamp)
 {
+	struct shrm_l2msg msg;
 	u8 l2_header;
-	u32 len;
 
 	if (check_modem_in_reset()) {
 		dev_err(shrm->dev, "%s:Modem state reset or unknown.\n",
@@ -1518,15 +1654,18 @@ void receive_messages_audio(struct shrm_dev *shrm)
 		return;
 	}
 
-	l2_header = read_one_l2msg_audio(shrm, recieve_audio_msg, &len);
+	l2_header = read_one_l2msg_audio(shrm, &msg);
 	/* Send Recieve_Call_back to Upper Layer */
 
 	if (!rx_audio_handler) {
 		dev_crit(shrm->dev, "audio_rx_handler is Null\n");
 		BUG();
 	}
-	(*rx_audio_handler)(l2_header, &recieve_audio_msg,
-					len, shrm);
+	(*rx_audio_handler)(l2_header, &msg, shrm);
+	if (ktime_to_ns(irq_stamp))
+		shrm_stats_audio_rx(irq_stamp);
+	shrm_stats_rx(l2_header, msg.size);
+	consume_one_l2msg_audio(shrm, &msg);
 
 	/* SendReadNotification */
 	ca_msg_read_notification_1(shrm);
@@ -1537,12 +1676,11 @@ void receive_messages_audio(struct shrm_dev *shrm)
 			return;
 		}
 
-		l2_header = read_one_l2msg_audio(shrm,
-						recieve_audio_msg, &len);
+		l2_header = read_one_l2msg_audio(shrm, &msg);
 		/* Send Recieve_Call_back to Upper Layer */
-		(*rx_audio_handler)(l2_header,
-					&recieve_audio_msg, len,
-					shrm);
+		(*rx_audio_handler)(l2_header, &msg, shrm);
+		shrm_stats_rx(l2_header, msg.size);
+		consume_one_l2msg_audio(shrm, &msg);
 	}
 }
 
@@ -14,6 +14,9 @@
 #include <linux/netdevice.h>
 #include <linux/if_arp.h>
 #include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 
 #include <net/caif/caif_device.h>
 #include <net/caif/caif_shm.h>
@@ -31,6 +34,20 @@
 #define LOW_WATERMARK		3
 #define HIGH_WATERMARK		4
 
+/*
+ * A partly filled Tx buffer is held back for more frames while this many
+ * buffers are already with the modem. It goes out as soon as one of them
+ * comes back empty.
+ */
+#define TX_HOLD_IN_FLIGHT	2
+
+/*
+ * Rx skbs are taken from a pool refilled with the skbs of sent frames,
+ * when those are large enough. Larger frames get a fresh allocation.
+ */
+#define RX_POOL_SZ		32
+#define RX_POOL_SKB_SZ		1664
+
 /* Maximum number of CAIF buffers per shared memory buffer. */
 #define SHM_MAX_FRMS_PER_BUF	10
 
@@ -88,6 +105,20 @@ struct shm_caif_frm {
 	u8 hdr_ofs;
 };
 
+struct shm_buf_stats {
+	u32 tx_bufs;
+	u32 tx_held;
+	u32 tx_max_in_flight;
+	u32 tx_frames[SHM_MAX_FRMS_PER_BUF + 1];
+	u64 tx_fill;
+	u32 rx_bufs;
+	u32 rx_frames;
+	u64 rx_fill;
+	u32 rx_pool_hits;
+	u32 rx_pool_misses;
+	u32 rx_pool_recycled;
+};
+
 struct shmdrv_layer {
 	/* caif_dev_common must always be first in the structure*/
 	struct caif_dev_common cfdev;
@@ -96,6 +127,7 @@ struct shmdrv_layer {
 	u32 shm_rx_addr;
 	u32 shm_base_addr;
 	u32 tx_empty_available;
+	u32 tx_in_flight;
 	spinlock_t lock;
 
 	struct list_head tx_empty_list;
@@ -105,21 +137,130 @@ struct shmdrv_layer {
 	struct list_head rx_pend_list;
 	struct list_head rx_full_list;
 
-	struct workqueue_struct *pshm_tx_workqueue;
-	struct workqueue_struct *pshm_rx_workqueue;
+	struct kthread_worker pshm_tx_kw;
+	struct task_struct *pshm_tx_kw_task;
+	struct kthread_worker pshm_rx_kw;
+	struct task_struct *pshm_rx_kw_task;
 
 	struct kthread_worker pshm_flow_ctrl_kw;
 	struct task_struct *pshm_flow_ctrl_kw_task;
 
-	struct work_struct shm_tx_work;
-	struct work_struct shm_rx_work;
+	struct kthread_work shm_tx_work;
+	struct kthread_work shm_rx_work;
 	struct kthread_work shm_flow_on_work;
 	struct kthread_work shm_flow_off_work;
 
 	struct sk_buff_head sk_qhead;
+	struct sk_buff_head rx_skb_pool;
 	struct shmdev_layer *pshm_dev;
+
+	struct shm_buf_stats stats;
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *debugfs_dir;
+#endif
 };
 
+#ifdef CONFIG_DEBUG_FS
+static u32 shm_fill_pct(u64 used, u32 bufs, u32 capacity)
+{
+	if (!bufs)
+		return 0;
+	return div64_u64(used * 100, (u64)bufs * capacity);
+}
+
+static int shm_stats_show(struct seq_file *s, void *data)
+{
+	struct shmdrv_layer *pshm_drv = s->private;
+	struct shm_buf_stats *st = &pshm_drv->stats;
+	int i;
+
+	seq_printf(s, "tx_buffers: %u\n", st->tx_bufs);
+	seq_printf(s, "tx_fill: %u%%\n", shm_fill_pct(st->tx_fill,
+			st->tx_bufs, TX_BUF_SZ - SHM_CAIF_FRM_OFS));
+	seq_puts(s, "tx_frames_per_buffer:");
+	for (i = 1; i <= SHM_MAX_FRMS_PER_BUF; i++)
+		seq_printf(s, " %u", st->tx_frames[i]);
+	seq_putc(s, '\n');
+	seq_printf(s, "tx_held_back: %u\n", st->tx_held);
+	seq_printf(s, "tx_in_flight: %u max %u\n", pshm_drv->tx_in_flight,
+			st->tx_max_in_flight);
+	seq_printf(s, "rx_buffers: %u\n", st->rx_bufs);
+	seq_printf(s, "rx_frames: %u\n", st->rx_frames);
+	seq_printf(s, "rx_fill: %u%%\n", shm_fill_pct(st->rx_fill,
+			st->rx_bufs, RX_BUF_SZ - SHM_CAIF_FRM_OFS));
+	seq_printf(s, "rx_pool: %u/%u hits %u misses %u recycled %u\n",
+			skb_queue_len(&pshm_drv->rx_skb_pool), RX_POOL_SZ,
+			st->rx_pool_hits, st->rx_pool_misses,
+			st->rx_pool_recycled);
+	return 0;
+}
+
+static int shm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, shm_stats_show, inode->i_private);
+}
+
+static const struct file_operations shm_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = shm_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static inline void debugfs_init(struct shmdrv_layer *pshm_drv,
+				struct net_device *pshm_netdev)
+{
+	pshm_drv->debugfs_dir = debugfs_create_dir(pshm_netdev->name, NULL);
+	if (!IS_ERR_OR_NULL(pshm_drv->debugfs_dir))
+		debugfs_create_file("stats", S_IRUSR, pshm_drv->debugfs_dir,
+				pshm_drv, &shm_stats_fops);
+}
+
+static inline void debugfs_deinit(struct shmdrv_layer *pshm_drv)
+{
+	debugfs_remove_recursive(pshm_drv->debugfs_dir);
+}
+#else
+static inline void debugfs_init(struct shmdrv_layer *pshm_drv,
+				struct net_device *pshm_netdev)
+{
+}
+
+static inline void debugfs_deinit(struct shmdrv_layer *pshm_drv)
+{
+}
+#endif
+
+/* Get an skb for a received frame of len bytes. */
+static struct sk_buff *shm_rx_skb_get(struct shmdrv_layer *pshm_drv,
+					unsigned int len)
+{
+	struct sk_buff *skb = NULL;
+
+	if (len <= RX_POOL_SKB_SZ) {
+		skb = skb_dequeue(&pshm_drv->rx_skb_pool);
+		if (skb) {
+			pshm_drv->stats.rx_pool_hits++;
+			return skb;
+		}
+		pshm_drv->stats.rx_pool_misses++;
+	}
+	return netdev_alloc_skb(pshm_drv->pshm_dev->pshm_netdev, len);
+}
+
+/* Done with a sent skb: keep it for Rx if it is fit for it, else free it. */
+static void shm_tx_skb_put(struct shmdrv_layer *pshm_drv, struct sk_buff *skb)
+{
+	if (skb_queue_len(&pshm_drv->rx_skb_pool) < RX_POOL_SZ &&
+			skb_recycle_check(skb, RX_POOL_SKB_SZ)) {
+		skb_queue_tail(&pshm_drv->rx_skb_pool, skb);
+		pshm_drv->stats.rx_pool_recycled++;
+		return;
+	}
+	dev_kfree_skb_any(skb);
+}
+
 static int shm_netdev_open(struct net_device *shm_netdev)
 {
 	netif_wake_queue(shm_netdev);
@@ -205,15 +346,15 @@ int caif_shmdrv_rx_cb(u32 mbx_msg, void *priv)
 
 		spin_unlock_irqrestore(&pshm_drv->lock, flags);
 
-		/* Schedule RX work queue. */
-		if (!work_pending(&pshm_drv->shm_rx_work))
-			queue_work(pshm_drv->pshm_rx_workqueue,
-						&pshm_drv->shm_rx_work);
+		/* Schedule RX work. */
+		queue_kthread_work(&pshm_drv->pshm_rx_kw,
+					&pshm_drv->shm_rx_work);
 	}
 
 	/* Check for emptied buffers. */
 	if (mbx_msg & SHM_EMPTY_MASK) {
 		int idx;
+		int kick;
 
 		spin_lock_irqsave(&pshm_drv->lock, flags);
 
@@ -247,6 +388,7 @@ int caif_shmdrv_rx_cb(u32 mbx_msg, void *priv)
 			goto err_sync;
 		}
 		list_del_init(&pbuf->list);
+		pshm_drv->tx_in_flight--;
 
 		/* Reset buffer parameters. */
 		pbuf->frames = 0;
@@ -258,20 +400,23 @@ int caif_shmdrv_rx_cb(u32 mbx_msg, void *priv)
 		list_for_each(pos, &pshm_drv->tx_empty_list)
 			avail_emptybuff++;
 
+		/* A buffer held back or frames queued can go out now. */
+		kick = !list_empty(&pshm_drv->tx_pend_list) ||
+				!skb_queue_empty(&pshm_drv->sk_qhead);
+
 		/* Check whether we have to wake up the transmitter. */
 		if ((avail_emptybuff > HIGH_WATERMARK) &&
 					(!pshm_drv->tx_empty_available)) {
 			pshm_drv->tx_empty_available = 1;
 			queue_kthread_work(&pshm_drv->pshm_flow_ctrl_kw,
 					&pshm_drv->shm_flow_on_work);
-			spin_unlock_irqrestore(&pshm_drv->lock, flags);
+			kick = 1;
+		}
+		spin_unlock_irqrestore(&pshm_drv->lock, flags);
 
-			/* Schedule the work queue. if required */
-			if (!work_pending(&pshm_drv->shm_tx_work))
-				queue_work(pshm_drv->pshm_tx_workqueue,
-							&pshm_drv->shm_tx_work);
-		} else
-			spin_unlock_irqrestore(&pshm_drv->lock, flags);
+		if (kick)
+			queue_kthread_work(&pshm_drv->pshm_tx_kw,
+						&pshm_drv->shm_tx_work);
 	}
 
 	return 0;
@@ -280,7 +425,7 @@ err_sync:
 	return -EIO;
 }
 
-static void shm_rx_work_func(struct work_struct *rx_work)
+static void shm_rx_work_func(struct kthread_work *rx_work)
 {
 	struct shmdrv_layer *pshm_drv;
 	struct buf_list *pbuf;
@@ -311,6 +456,7 @@ static void shm_rx_work_func(struct work_struct *rx_work)
 
 		/* Retrieve pointer to start of the packet descriptor area. */
 		pck_desc = (struct shm_pck_desc *) pbuf->desc_vptr;
+		pshm_drv->stats.rx_bufs++;
 
 		/*
 		 * Check whether descriptor contains a CAIF shared memory
@@ -356,10 +502,17 @@ static void shm_rx_work_func(struct work_struct *rx_work)
 			if ((frm_pck_ofs + pck_desc->frm_len) > pbuf->len)
 				break;
 
+			pshm_drv->stats.rx_frames++;
+			pshm_drv->stats.rx_fill += pck_desc->frm_len;
+
 			/* Get a suitable CAIF packet and copy in data. */
-			skb = netdev_alloc_skb(pshm_drv->pshm_dev->pshm_netdev,
-							frm_pck_len + 1);
-			BUG_ON(skb == NULL);
+			skb = shm_rx_skb_get(pshm_drv, frm_pck_len + 1);
+			if (skb == NULL) {
+				++pshm_drv->pshm_dev->pshm_netdev->stats.
+								rx_dropped;
+				pck_desc++;
+				continue;
+			}
 
 			p = skb_put(skb, frm_pck_len);
 			memcpy(p, pbuf->desc_vptr + frm_pck_ofs, frm_pck_len);
@@ -390,30 +543,106 @@ static void shm_rx_work_func(struct work_struct *rx_work)
 
 	}
 
-	/* Schedule the work queue. if required */
-	if (!work_pending(&pshm_drv->shm_tx_work))
-		queue_work(pshm_drv->pshm_tx_workqueue, &pshm_drv->shm_tx_work);
+	/* Hand the buffers back to the modem. */
+	queue_kthread_work(&pshm_drv->pshm_tx_kw, &pshm_drv->shm_tx_work);
+}
 
+/*
+ * Append as many queued frames as fit to a Tx buffer. Returns 1 when the
+ * buffer can take no more, 0 when the frame queue ran dry first. Sent
+ * skbs are left on done, to be disposed of outside the spin lock.
+ */
+static int shm_tx_fill_buf(struct shmdrv_layer *pshm_drv,
+			struct buf_list *pbuf, struct sk_buff_head *done)
+{
+	unsigned int frmlen;
+	struct shm_caif_frm *frm;
+	struct sk_buff *skb;
+	struct shm_pck_desc *pck_desc;
+
+	while (pbuf->frames < SHM_MAX_FRMS_PER_BUF &&
+			pbuf->frm_ofs < pbuf->len) {
+		skb = skb_peek(&pshm_drv->sk_qhead);
+		if (skb == NULL)
+			return 0;
+
+		frm = (struct shm_caif_frm *)
+				(pbuf->desc_vptr + pbuf->frm_ofs);
+
+		frm->hdr_ofs = 0;
+		frmlen = 0;
+		frmlen += SHM_HDR_LEN + frm->hdr_ofs + skb->len;
+
+		/* Add tail padding if needed. */
+		if (frmlen % SHM_FRM_PAD_LEN)
+			frmlen += SHM_FRM_PAD_LEN -
+					(frmlen % SHM_FRM_PAD_LEN);
+
+		/*
+		 * Verify that packet, header and additional padding
+		 * can fit within the buffer frame area.
+		 */
+		if (frmlen >= (pbuf->len - pbuf->frm_ofs)) {
+			if (pbuf->frames)
+				return 1;
+			/* Not even an empty buffer can take this one. */
+			skb = skb_dequeue(&pshm_drv->sk_qhead);
+			pshm_drv->pshm_dev->pshm_netdev->stats.tx_dropped++;
+			__skb_queue_tail(done, skb);
+			continue;
+		}
+
+		/* Only this work takes frames off the queue. */
+		skb = skb_dequeue(&pshm_drv->sk_qhead);
+
+		/* Copy in CAIF frame. */
+		skb_copy_bits(skb, 0, pbuf->desc_vptr +
+				pbuf->frm_ofs + SHM_HDR_LEN +
+					frm->hdr_ofs, skb->len);
+
+		pshm_drv->pshm_dev->pshm_netdev->stats.tx_packets++;
+		pshm_drv->pshm_dev->pshm_netdev->stats.tx_bytes +=
+								frmlen;
+		__skb_queue_tail(done, skb);
+
+		/* Fill in the shared memory packet descriptor area. */
+		pck_desc = (struct shm_pck_desc *) (pbuf->desc_vptr);
+		/* Forward to current frame. */
+		pck_desc += pbuf->frames;
+		pck_desc->frm_ofs = (pbuf->phy_addr -
+					pshm_drv->shm_base_addr) +
+							pbuf->frm_ofs;
+		pck_desc->frm_len = frmlen;
+		/* Terminate packet descriptor area. */
+		pck_desc++;
+		pck_desc->frm_ofs = 0;
+		/* Update buffer parameters. */
+		pbuf->frames++;
+		pbuf->frm_ofs += frmlen + (frmlen % 32);
+	}
+	return 1;
 }
 
-static void shm_tx_work_func(struct work_struct *tx_work)
+static void shm_tx_work_func(struct kthread_work *tx_work)
 {
 	u32 mbox_msg;
-	unsigned int frmlen, avail_emptybuff, append = 0;
+	unsigned int avail_emptybuff;
+	int full;
 	unsigned long flags = 0;
 	struct buf_list *pbuf = NULL;
 	struct shmdrv_layer *pshm_drv;
-	struct shm_caif_frm *frm;
 	struct sk_buff *skb;
-	struct shm_pck_desc *pck_desc;
+	struct sk_buff_head done;
 	struct list_head *pos;
 
 	pshm_drv = container_of(tx_work, struct shmdrv_layer, shm_tx_work);
+	__skb_queue_head_init(&done);
 
 	do {
 		/* Initialize mailbox message. */
 		mbox_msg = 0x00;
 		avail_emptybuff = 0;
+		full = 0;
 
 		spin_lock_irqsave(&pshm_drv->lock, flags);
 
@@ -434,100 +663,70 @@ static void shm_tx_work_func(struct work_struct *tx_work)
 
 		skb = skb_peek(&pshm_drv->sk_qhead);
 
-		if (skb == NULL)
-			goto send_msg;
-		/* Check the available no. of buffers in the empty list */
-		list_for_each(pos, &pshm_drv->tx_empty_list)
-			avail_emptybuff++;
-
-		if ((avail_emptybuff < LOW_WATERMARK) &&
-					pshm_drv->tx_empty_available) {
-			/* Update blocking condition. */
-			pshm_drv->tx_empty_available = 0;
-			queue_kthread_work(&pshm_drv->pshm_flow_ctrl_kw,
-					&pshm_drv->shm_flow_off_work);
+		if (skb != NULL) {
+			/* Check the available no. of buffers in the empty list */
+			list_for_each(pos, &pshm_drv->tx_empty_list)
+				avail_emptybuff++;
+
+			if ((avail_emptybuff < LOW_WATERMARK) &&
+						pshm_drv->tx_empty_available) {
+				/* Update blocking condition. */
+				pshm_drv->tx_empty_available = 0;
+				queue_kthread_work(&pshm_drv->pshm_flow_ctrl_kw,
+						&pshm_drv->shm_flow_off_work);
+			}
 		}
+
 		/*
-		 * We simply return back to the caller if we do not have space
-		 * either in Tx pending list or Tx empty list. In this case,
-		 * we hold the received skb in the skb list, waiting to
-		 * be transmitted once Tx buffers become available
+		 * Carry on with a buffer held back for aggregation, else take
+		 * the first free Tx buffer. If there is neither, the frames
+		 * stay queued until a Tx buffer comes back from the modem.
 		 */
-		if (list_empty(&pshm_drv->tx_empty_list))
-			goto send_msg;
-
-		/* Get the first free Tx buffer. */
-		pbuf = list_entry(pshm_drv->tx_empty_list.next,
+		pbuf = NULL;
+		if (!list_empty(&pshm_drv->tx_pend_list)) {
+			pbuf = list_entry(pshm_drv->tx_pend_list.next,
 						struct buf_list, list);
-		do {
-			if (append) {
-				skb = skb_peek(&pshm_drv->sk_qhead);
-				if (skb == NULL)
-					break;
-			}
-
-			frm = (struct shm_caif_frm *)
-					(pbuf->desc_vptr + pbuf->frm_ofs);
-
-			frm->hdr_ofs = 0;
-			frmlen = 0;
-			frmlen += SHM_HDR_LEN + frm->hdr_ofs + skb->len;
-
-			/* Add tail padding if needed. */
-			if (frmlen % SHM_FRM_PAD_LEN)
-				frmlen += SHM_FRM_PAD_LEN -
-						(frmlen % SHM_FRM_PAD_LEN);
+		} else if (skb != NULL &&
+				!list_empty(&pshm_drv->tx_empty_list)) {
+			pbuf = list_entry(pshm_drv->tx_empty_list.next,
+						struct buf_list, list);
+			list_move_tail(&pbuf->list, &pshm_drv->tx_pend_list);
+		}
+		spin_unlock_irqrestore(&pshm_drv->lock, flags);
 
-			/*
-			 * Verify that packet, header and additional padding
-			 * can fit within the buffer frame area.
-			 */
-			if (frmlen >= (pbuf->len - pbuf->frm_ofs))
-				break;
+		/* A buffer on the pending list is only touched from here. */
+		if (pbuf != NULL)
+			full = shm_tx_fill_buf(pshm_drv, pbuf, &done);
 
-			if (!append) {
-				list_del_init(&pbuf->list);
-				append = 1;
+		spin_lock_irqsave(&pshm_drv->lock, flags);
+		if (pbuf != NULL && pbuf->frames) {
+			if (full || pshm_drv->tx_in_flight < TX_HOLD_IN_FLIGHT) {
+				/* Assign buffer as full. */
+				list_move_tail(&pbuf->list,
+						&pshm_drv->tx_full_list);
+				mbox_msg |= SHM_SET_FULL(pbuf->index);
+
+				pshm_drv->tx_in_flight++;
+				if (pshm_drv->tx_in_flight >
+						pshm_drv->stats.tx_max_in_flight)
+					pshm_drv->stats.tx_max_in_flight =
+						pshm_drv->tx_in_flight;
+				pshm_drv->stats.tx_bufs++;
+				pshm_drv->stats.tx_frames[pbuf->frames]++;
+				pshm_drv->stats.tx_fill +=
+					pbuf->frm_ofs - SHM_CAIF_FRM_OFS;
+			} else {
+				pshm_drv->stats.tx_held++;
 			}
-
-			skb = skb_dequeue(&pshm_drv->sk_qhead);
-			if (skb == NULL)
-				break;
-			/* Copy in CAIF frame. */
-			skb_copy_bits(skb, 0, pbuf->desc_vptr +
-					pbuf->frm_ofs + SHM_HDR_LEN +
-						frm->hdr_ofs, skb->len);
-
-			pshm_drv->pshm_dev->pshm_netdev->stats.tx_packets++;
-			pshm_drv->pshm_dev->pshm_netdev->stats.tx_bytes +=
-									frmlen;
-			dev_kfree_skb_any(skb);
-
-			/* Fill in the shared memory packet descriptor area. */
-			pck_desc = (struct shm_pck_desc *) (pbuf->desc_vptr);
-			/* Forward to current frame. */
-			pck_desc += pbuf->frames;
-			pck_desc->frm_ofs = (pbuf->phy_addr -
-						pshm_drv->shm_base_addr) +
-								pbuf->frm_ofs;
-			pck_desc->frm_len = frmlen;
-			/* Terminate packet descriptor area. */
-			pck_desc++;
-			pck_desc->frm_ofs = 0;
-			/* Update buffer parameters. */
-			pbuf->frames++;
-			pbuf->frm_ofs += frmlen + (frmlen % 32);
-
-		} while (pbuf->frames < SHM_MAX_FRMS_PER_BUF &&
-				pbuf->frm_ofs < pbuf->len);
-
-		/* Assign buffer as full. */
-		list_add_tail(&pbuf->list, &pshm_drv->tx_full_list);
-		append = 0;
-		mbox_msg |= SHM_SET_FULL(pbuf->index);
-send_msg:
+		} else if (pbuf != NULL) {
+			/* Only oversized frames were seen, nothing to hold. */
+			list_move(&pbuf->list, &pshm_drv->tx_empty_list);
+		}
 		spin_unlock_irqrestore(&pshm_drv->lock, flags);
 
+		while ((skb = __skb_dequeue(&done)) != NULL)
+			shm_tx_skb_put(pshm_drv, skb);
+
 		if (mbox_msg)
 			pshm_drv->pshm_dev->pshmdev_mbxsend
 					(pshm_drv->pshm_dev->shm_id, mbox_msg);
@@ -542,9 +741,8 @@ static int shm_netdev_tx(struct sk_buff *skb, struct net_device *shm_netdev)
 
 	skb_queue_tail(&pshm_drv->sk_qhead, skb);
 
-	/* Schedule Tx work queue. for deferred processing of skbs*/
-	if (!work_pending(&pshm_drv->shm_tx_work))
-		queue_work(pshm_drv->pshm_tx_workqueue, &pshm_drv->shm_tx_work);
+	/* Schedule Tx work for deferred processing of skbs. */
+	queue_kthread_work(&pshm_drv->pshm_tx_kw, &pshm_drv->shm_tx_work);
 
 	return 0;
 }
@@ -603,6 +801,7 @@ int caif_shmcore_probe(struct shmdev_layer *pshm_dev)
 	}
 
 	skb_queue_head_init(&pshm_drv->sk_qhead);
+	skb_queue_head_init(&pshm_drv->rx_skb_pool);
 
 	pr_info("SHM DEVICE[%d] PROBED BY DRIVER, NEW SHM DRIVER"
 			" INSTANCE AT pshm_drv =0x%p\n",
@@ -636,16 +835,25 @@ int caif_shmcore_probe(struct shmdev_layer *pshm_dev)
 	INIT_LIST_HEAD(&pshm_drv->rx_pend_list);
 	INIT_LIST_HEAD(&pshm_drv->rx_full_list);
 
-	INIT_WORK(&pshm_drv->shm_tx_work, shm_tx_work_func);
-	INIT_WORK(&pshm_drv->shm_rx_work, shm_rx_work_func);
+	init_kthread_work(&pshm_drv->shm_tx_work, shm_tx_work_func);
+	init_kthread_work(&pshm_drv->shm_rx_work, shm_rx_work_func);
 
 	init_kthread_work(&pshm_drv->shm_flow_on_work, shm_flow_on_work_func);
 	init_kthread_work(&pshm_drv->shm_flow_off_work, shm_flow_off_work_func);
 
-	pshm_drv->pshm_tx_workqueue =
-				create_singlethread_workqueue("shm_tx_work");
-	pshm_drv->pshm_rx_workqueue =
-				create_singlethread_workqueue("shm_rx_work");
+	/*
+	 * Dedicated realtime threads rather than shared workqueues, so that
+	 * buffers are turned around without waiting behind unrelated work.
+	 */
+	init_kthread_worker(&pshm_drv->pshm_tx_kw);
+	pshm_drv->pshm_tx_kw_task = kthread_run(kthread_worker_fn,
+			&pshm_drv->pshm_tx_kw, "shm_caif_tx");
+	sched_setscheduler(pshm_drv->pshm_tx_kw_task, SCHED_FIFO, &param);
+
+	init_kthread_worker(&pshm_drv->pshm_rx_kw);
+	pshm_drv->pshm_rx_kw_task = kthread_run(kthread_worker_fn,
+			&pshm_drv->pshm_rx_kw, "shm_caif_rx");
+	sched_setscheduler(pshm_drv->pshm_rx_kw_task, SCHED_FIFO, &param);
 
 	init_kthread_worker(&pshm_drv->pshm_flow_ctrl_kw);
 	pshm_drv->pshm_flow_ctrl_kw_task = kthread_run(kthread_worker_fn,
@@ -707,6 +915,8 @@ int caif_shmcore_probe(struct shmdev_layer *pshm_dev)
 	if (result)
 		pr_warn("ERROR[%d], SHM could not, "
 			"register with NW FRMWK Bailing out ...\n", result);
+	else
+		debugfs_init(pshm_drv, pshm_dev->pshm_netdev);
 
 	return result;
 }
@@ -718,6 +928,16 @@ void caif_shmcore_remove(struct net_device *pshm_netdev)
 
 	pshm_drv = netdev_priv(pshm_netdev);
 
+	debugfs_deinit(pshm_drv);
+
+	/* Stop the transfer threads before their buffers go away. */
+	flush_kthread_worker(&pshm_drv->pshm_rx_kw);
+	kthread_stop(pshm_drv->pshm_rx_kw_task);
+	flush_kthread_worker(&pshm_drv->pshm_tx_kw);
+	kthread_stop(pshm_drv->pshm_tx_kw_task);
+	skb_queue_purge(&pshm_drv->sk_qhead);
+	skb_queue_purge(&pshm_drv->rx_skb_pool);
+
 	while (!(list_empty(&pshm_drv->tx_pend_list))) {
 		pbuf =
 			list_entry(pshm_drv->tx_pend_list.next,
@@ -767,9 +987,6 @@ void caif_shmcore_remove(struct net_device *pshm_netdev)
 		kfree(pbuf);
 	}
 
-	/* Destroy work queues. */
-	destroy_workqueue(pshm_drv->pshm_tx_workqueue);
-	destroy_workqueue(pshm_drv->pshm_rx_workqueue);
 	flush_kthread_worker(&pshm_drv->pshm_flow_ctrl_kw);
 	kthread_stop(pshm_drv->pshm_flow_ctrl_kw_task);
 
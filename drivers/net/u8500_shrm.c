@@ -9,6 +9,7 @@
 
 #include <linux/if_ether.h>
 #include <linux/netdevice.h>
+#include <linux/ethtool.h>
 #include <linux/phonet.h>
 #include <linux/if_phonet.h>
 #include <linux/if_arp.h>
@@ -21,14 +22,37 @@
 #include <net/phonet/phonet.h>
 #include <net/phonet/pep.h>
 
+/*
+ * Pass a received ISI message up to phonet from the NAPI poll loop.
+ */
+static void shrm_net_rx_skb(struct napi_struct *napi, struct sk_buff *skb)
+{
+	struct net_device *dev = napi->dev;
+	u32 msgsize = skb->len;
+
+	skb_reset_mac_header(skb);
+	__skb_pull(skb, dev->hard_header_len);
+	/*Write metadata, and then pass to the receive level*/
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_PHONET);
+	skb->priority = 0;
+	skb->ip_summed = CHECKSUM_UNNECESSARY; /* don't check it */
+	if (likely(napi_gro_receive(napi, skb) != GRO_DROP)) {
+		dev->stats.rx_packets++;
+		dev->stats.rx_bytes += msgsize;
+	} else
+		dev->stats.rx_dropped++;
+}
 
 /**
  * shrm_net_receive() - receive data and copy to user space buffer
  * @dev:	pointer to the network device structure
  *
- * Copy data from ISI queue to the user space buffer.
+ * Copy one message from the ISI queue into an skb and pass it up.  The
+ * queue only holds messages which arrived while the interface could not
+ * take them directly.  Called from the NAPI poll loop.
  */
-int shrm_net_receive(struct net_device *dev)
+static int shrm_net_receive(struct net_device *dev)
 {
 	struct sk_buff *skb;
 	struct isadev_context *isadev;
@@ -58,7 +82,7 @@ int shrm_net_receive(struct net_device *dev)
 	 * The packet has been retrieved from the transmission
 	 * medium. Build an skb around it, so upper layers can handle it
 	 */
-	skb = dev_alloc_skb(msgsize);
+	skb = netdev_alloc_skb(dev, msgsize);
 	if (!skb) {
 		if (printk_ratelimit())
 			dev_notice(shrm->dev,
@@ -85,26 +109,109 @@ int shrm_net_receive(struct net_device *dev)
 		skb_put(skb, msgsize);
 	}
 
+	shrm_net_rx_skb(&net_iface_priv->napi, skb);
+out:
 	spin_lock_bh(&q->update_lock);
 	remove_msg_from_queue(q);
 	spin_unlock_bh(&q->update_lock);
 
-	skb_reset_mac_header(skb);
-	__skb_pull(skb, dev->hard_header_len);
-	/*Write metadata, and then pass to the receive level*/
-	skb->dev = dev;/*kmalloc(sizeof(struct net_device), GFP_ATOMIC);*/
-	skb->protocol = htons(ETH_P_PHONET);
-	skb->priority = 0;
-	skb->ip_summed = CHECKSUM_UNNECESSARY; /* don't check it */
-	if (likely(netif_rx_ni(skb) == NET_RX_SUCCESS)) {
-		dev->stats.rx_packets++;
-		dev->stats.rx_bytes += msgsize;
-	} else
+	return msgsize;
+}
+
+/**
+ * shrm_net_receive_l2msg() - receive an ISI message straight from the FIFO
+ * @dev:	pointer to the network device structure
+ * @msg:	message in the modem FIFO
+ *
+ * Copies the message once, from the shared memory FIFO into a new skb,
+ * and leaves it for the NAPI poll loop.  Called from the receive tasklet
+ * once per message, the poll loop then delivers the whole batch.
+ */
+int shrm_net_receive_l2msg(struct net_device *dev, struct shrm_l2msg *msg)
+{
+	struct shrm_net_iface_priv *net_iface_priv = netdev_priv(dev);
+	struct sk_buff *skb;
+
+	if (skb_queue_len(&net_iface_priv->rx_queue) >= SHRM_NAPI_RX_QUEUE) {
+		dev->stats.rx_fifo_errors++;
+		dev->stats.rx_dropped++;
+		return -ENOBUFS;
+	}
+
+	skb = netdev_alloc_skb(dev, msg->size);
+	if (!skb) {
+		if (printk_ratelimit())
+			dev_notice(&dev->dev,
+			"isa rx: low on mem - packet dropped\n");
 		dev->stats.rx_dropped++;
+		return -ENOMEM;
+	}
 
-	return msgsize;
-out:
-	return -ENOMEM;
+	shrm_l2msg_read(msg, 0, skb_put(skb, msg->size), msg->size);
+
+	/* close purges the queue, nothing may be added once it is down */
+	spin_lock(&net_iface_priv->rx_queue.lock);
+	if (unlikely(!net_iface_priv->shrm_device->netdev_flag_up)) {
+		spin_unlock(&net_iface_priv->rx_queue.lock);
+		dev_kfree_skb(skb);
+		dev->stats.rx_dropped++;
+		return -ENETDOWN;
+	}
+	__skb_queue_tail(&net_iface_priv->rx_queue, skb);
+	spin_unlock(&net_iface_priv->rx_queue.lock);
+	napi_schedule(&net_iface_priv->napi);
+
+	return msg->size;
+}
+
+/**
+ * shrm_net_rx_schedule() - have the poll loop drain the ISI queue
+ * @dev:	pointer to the network device structure
+ */
+void shrm_net_rx_schedule(struct net_device *dev)
+{
+	struct shrm_net_iface_priv *net_iface_priv = netdev_priv(dev);
+
+	napi_schedule(&net_iface_priv->napi);
+}
+
+static int shrm_net_rx_pending(struct net_device *dev)
+{
+	struct shrm_net_iface_priv *net_iface_priv = netdev_priv(dev);
+	struct shrm_dev *shrm = net_iface_priv->shrm_device;
+
+	return !skb_queue_empty(&net_iface_priv->rx_queue) ||
+		!list_empty(&shrm->isa_context->isadev[ISI_MESSAGING].
+			    dl_queue.msg_list);
+}
+
+static int shrm_net_poll(struct napi_struct *napi, int budget)
+{
+	struct net_device *dev = napi->dev;
+	struct shrm_net_iface_priv *net_iface_priv = netdev_priv(dev);
+	struct sk_buff *skb;
+	int work = 0;
+
+	net_iface_priv->rx_polls++;
+
+	/* messages queued before the direct path took over go first */
+	while (work < budget && shrm_net_receive(dev) > 0)
+		work++;
+
+	while (work < budget &&
+	       (skb = skb_dequeue(&net_iface_priv->rx_queue)) != NULL) {
+		shrm_net_rx_skb(napi, skb);
+		work++;
+	}
+
+	if (work < budget) {
+		napi_complete(napi);
+		/* the receive tasklet may have added more meanwhile */
+		if (shrm_net_rx_pending(dev))
+			napi_reschedule(napi);
+	}
+
+	return work;
 }
 
 static int netdev_isa_open(struct net_device *dev)
@@ -113,10 +220,13 @@ static int netdev_isa_open(struct net_device *dev)
 			(struct shrm_net_iface_priv *)netdev_priv(dev);
 	struct shrm_dev *shrm = net_iface_priv->shrm_device;
 
+	napi_enable(&net_iface_priv->napi);
 	shrm->netdev_flag_up = 1;
 	if (!netif_carrier_ok(dev))
 		netif_carrier_on(dev);
 	netif_wake_queue(dev);
+	/* pick up whatever arrived while we were down */
+	napi_schedule(&net_iface_priv->napi);
 	return 0;
 }
 
@@ -126,9 +236,14 @@ static int netdev_isa_close(struct net_device *dev)
 			(struct shrm_net_iface_priv *)netdev_priv(dev);
 	struct shrm_dev *shrm = net_iface_priv->shrm_device;
 
+	/* the receive tasklet checks the flag under the queue lock */
+	spin_lock_bh(&net_iface_priv->rx_queue.lock);
 	shrm->netdev_flag_up = 0;
+	spin_unlock_bh(&net_iface_priv->rx_queue.lock);
 	netif_stop_queue(dev);
 	netif_carrier_off(dev);
+	napi_disable(&net_iface_priv->napi);
+	skb_queue_purge(&net_iface_priv->rx_queue);
 	return 0;
 }
 
@@ -154,9 +269,15 @@ static struct net_device_stats *netdev_isa_stats(struct net_device *dev)
  * @skb:	pointer to the socket buffer
  * @dev:	pointer to the network device structure
  *
- * Copies data(ISI message) from the user buffer to the kernel buffer and
- * schedule transfer thread to transmit the message to the modem via FIFO.
+ * Copies the ISI message, linear part and fragments alike, straight into
+ * the FIFO and schedules transfer thread to notify the modem.
  */
+static int netdev_isa_copy_skb(void *dst, struct shrm_tx_src *src,
+						u32 offset, u32 len)
+{
+	return skb_copy_bits(src->data, offset, dst, len);
+}
+
 static netdev_tx_t netdev_isa_write(struct sk_buff *skb, struct net_device *dev)
 {
 	int err;
@@ -164,6 +285,10 @@ static netdev_tx_t netdev_isa_write(struct sk_buff *skb, struct net_device *dev)
 	struct shrm_net_iface_priv *net_iface_priv =
 			(struct shrm_net_iface_priv *)netdev_priv(dev);
 	struct shrm_dev *shrm = net_iface_priv->shrm_device;
+	struct shrm_tx_src src = {
+		.copy = netdev_isa_copy_skb,
+		.data = skb,
+	};
 
 	/*
 	 * FIXME:
@@ -183,8 +308,12 @@ static netdev_tx_t netdev_isa_write(struct sk_buff *skb, struct net_device *dev)
 	 * GPRS traffic here.
 	 * Ideally, it should be done either by Pipe controller in
 	 * modem OR some implementation of Pipe controller on APE side
+	 *
+	 * Pipe indications are never shorter than PIPE_HDL_INDEX, pull that
+	 * much into the linear part so the rest can stay fragmented.
 	 */
-	if (skb->data[RESOURCE_ID_INDEX] == PN_PIPE) {
+	if (pskb_may_pull(skb, PIPE_HDL_INDEX + 1) &&
+			skb->data[RESOURCE_ID_INDEX] == PN_PIPE) {
 		if ((skb->data[MSG_ID_INDEX] == PNS_PIPE_CREATED_IND) ||
 			(skb->data[MSG_ID_INDEX] == PNS_PIPE_ENABLED_IND) ||
 			(skb->data[MSG_ID_INDEX] == PNS_PIPE_DISABLED_IND))
@@ -192,8 +321,7 @@ static netdev_tx_t netdev_isa_write(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	spin_lock_bh(&shrm->isa_context->common_tx);
-	err = shm_write_msg(shrm, ISI_MESSAGING, skb->data,
-			skb->len);
+	err = shm_write_msg_src(shrm, ISI_MESSAGING, &src, skb->len);
 	if (!err) {
 		dev->stats.tx_packets++;
 		dev->stats.tx_bytes += skb->len;
@@ -216,6 +344,54 @@ static const struct net_device_ops shrm_netdev_ops = {
 	.ndo_get_stats = netdev_isa_stats,
 };
 
+static const char shrm_gstrings_stats[][ETH_GSTRING_LEN] = {
+	"rx_interrupts",
+	"rx_read_notifications",
+	"rx_polls",
+	"tx_messages",
+	"tx_doorbells",
+};
+
+static int shrm_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return ARRAY_SIZE(shrm_gstrings_stats);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void shrm_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	if (sset == ETH_SS_STATS)
+		memcpy(data, shrm_gstrings_stats, sizeof(shrm_gstrings_stats));
+}
+
+/*
+ * Interrupt, read notification and message pending notification rates on
+ * the common channel, to be read next to the packet/byte counters.
+ */
+static void shrm_get_ethtool_stats(struct net_device *dev,
+				struct ethtool_stats *stats, u64 *data)
+{
+	struct shrm_net_iface_priv *net_iface_priv = netdev_priv(dev);
+	struct shrm_dev *shrm = net_iface_priv->shrm_device;
+
+	data[0] = shrm->rx_common_irqs;
+	data[1] = shrm->rx_common_read_notifs;
+	data[2] = net_iface_priv->rx_polls;
+	data[3] = shrm->tx_common_msgs;
+	data[4] = shrm->tx_common_doorbells;
+}
+
+static const struct ethtool_ops shrm_ethtool_ops = {
+	.get_link = ethtool_op_get_link,
+	.get_sset_count = shrm_get_sset_count,
+	.get_strings = shrm_get_strings,
+	.get_ethtool_stats = shrm_get_ethtool_stats,
+};
+
 static void shm_net_init(struct net_device *dev)
 {
 	struct shrm_net_iface_priv *net_iface_priv;
@@ -224,14 +400,20 @@ static void shm_net_init(struct net_device *dev)
 	dev->header_ops = &phonet_header_ops;
 	dev->type = ARPHRD_PHONET;
 	dev->flags = IFF_POINTOPOINT | IFF_NOARP;
+	/* netdev_isa_write copies fragments straight into the FIFO */
+	dev->features = NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HIGHDMA;
 	dev->mtu = PHONET_MAX_MTU;
 	dev->hard_header_len = SHRM_HLEN;
 	dev->addr_len = PHONET_ALEN;
 	dev->tx_queue_len = PN_TX_QUEUE_LEN;
 	dev->destructor = free_netdev;
 	dev->dev_addr[0] = PN_LINK_ADDR;
+	dev->ethtool_ops = &shrm_ethtool_ops;
 	net_iface_priv = netdev_priv(dev);
 	memset(net_iface_priv, 0 , sizeof(struct shrm_net_iface_priv));
+	skb_queue_head_init(&net_iface_priv->rx_queue);
+	netif_napi_add(dev, &net_iface_priv->napi, shrm_net_poll,
+			SHRM_NAPI_WEIGHT);
 }
 
 int shrm_register_netdev(struct shrm_dev *shrm)
@@ -308,5 +490,8 @@ int shrm_resume_netdev(struct net_device *dev)
 
 void shrm_unregister_netdev(struct shrm_dev *shrm)
 {
+	struct shrm_net_iface_priv *net_iface_priv = netdev_priv(shrm->ndev);
+
 	unregister_netdev(shrm->ndev);
+	skb_queue_purge(&net_iface_priv->rx_queue);
 }
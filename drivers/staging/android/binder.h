@@ -32,11 +32,20 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	/*
+	 * Passes a range of the sender's memory outside the parcel data:
+	 * 'binder' is the start of the range and 'cookie' its length in
+	 * bytes.  The target gets the address of a copy in its binder buffer
+	 * area, valid until it frees the transaction buffer.
+	 */
+	BINDER_TYPE_PAGES	= B_PACK_CHARS('p', 'g', '*', B_TYPE_LARGE),
 };
 
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/* let a SCHED_FIFO/SCHED_RR caller lend its policy to the target */
+	FLAT_BINDER_FLAG_INHERIT_RT = 0x800,
 };
 
 /*
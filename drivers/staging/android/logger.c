@@ -25,10 +25,64 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/cpumask.h>
+#include <linux/lzo.h>
+#include <linux/workqueue.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_stage - a per-cpu staging ring in front of a log
+ *
+ * Writers reserve space with a cmpxchg on 'head' and never take log->mutex
+ * unless the ring is full or their payload faults. Each record starts with
+ * a 32-bit tag holding its length, which is only set once the record has
+ * been filled in. 'tail' is only moved by the log->mutex holder, which
+ * copies committed records into the log proper. 'head' and 'tail' run
+ * freely and are masked on access.
+ */
+struct logger_stage {
+	unsigned char		*buffer;/* the staging ring itself */
+	atomic_t		head;	/* next free byte, taken by writers */
+	unsigned int		tail;	/* oldest unconsumed byte */
+	struct logger_entry	next;	/* header of the record at 'tail' */
+};
+
+/* size of each per-cpu staging ring, a power of two */
+#define LOGGER_STAGE_SIZE	(16*1024)
+
+/* logger_stage_offset - returns index 'n' into a staging ring */
+#define logger_stage_offset(n)	((n) & (LOGGER_STAGE_SIZE - 1))
+
+/* record tag flags, the low bits hold the record length */
+#define LOGGER_STAGE_COMMITTED	0x80000000
+#define LOGGER_STAGE_DISCARDED	0x40000000
+#define LOGGER_STAGE_LEN_MASK	0x0000ffff
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * struct logger_chunk - a piece of a log's archive of overwritten entries
+ *
+ * Holds whole entries, in the same layout as the ring. Protected by the log's
+ * mutex, except for 'raw' while 'busy' is set.
+ */
+struct logger_chunk {
+	struct list_head	list;	/* entry in log->chunks, oldest first */
+	unsigned long		seq;	/* position in the archive */
+	unsigned char		*raw;	/* the entries, until compressed */
+	unsigned char		*lzo;	/* the entries, once compressed */
+	size_t			used;	/* bytes of entries */
+	size_t			lzo_len;/* bytes of compressed entries */
+	bool			busy;	/* being compressed */
+	bool			orphan;	/* dropped while being compressed */
+	bool			stored;	/* does not compress, keep it raw */
+};
+
+/* size of each archive chunk */
+#define LOGGER_CHUNK_SIZE	(16*1024)
+#endif
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
@@ -45,6 +99,16 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage	*stage;	/* per-cpu staging rings, or NULL */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct list_head	chunks;	/* archive of overwritten entries */
+	struct logger_chunk	*open;	/* chunk being appended to, or NULL */
+	unsigned long		next_seq; /* seq of the next chunk */
+	size_t			archive_bytes; /* memory held by chunks */
+	size_t			lzo_in;	/* bytes of compressed chunks... */
+	size_t			lzo_out; /* ...and what they compressed to */
+	struct work_struct	work;	/* compresses full chunks */
+#endif
 };
 
 /*
@@ -59,6 +123,13 @@ struct logger_reader {
 	size_t			r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	bool			in_archive; /* reading the archive, not r_off */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	unsigned long		a_seq;	/* archive chunk being read */
+	size_t			a_off;	/* offset into that chunk */
+	unsigned char		*cache;	/* a decompressed chunk */
+	unsigned long		cache_seq; /* which one, 0 if none */
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -230,6 +301,455 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 	return off;
 }
 
+static void logger_drain(struct logger_log *log);
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+
+/*
+ * The archive keeps entries pushed out of the ring. They are appended to
+ * an open chunk; full chunks are LZO compressed by 'log->work' and the
+ * oldest chunks are dropped once the archive outgrows its budget. Readers
+ * that get lapped by the writer continue in the archive instead of losing
+ * entries, and new readers start at its oldest entry.
+ */
+
+/* compressed history kept per log, in bytes */
+#define LOGGER_ARCHIVE_BUDGET	(CONFIG_ANDROID_LOGGER_COMPRESS_SIZE * 1024)
+
+static void archive_free_chunk(struct logger_chunk *chunk)
+{
+	kfree(chunk->raw);
+	kfree(chunk->lzo);
+	kfree(chunk);
+}
+
+/*
+ * archive_drop - unlinks 'chunk' from the archive and frees it, or leaves
+ * that to the compression work if it is busy with the chunk.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_drop(struct logger_log *log, struct logger_chunk *chunk)
+{
+	list_del(&chunk->list);
+	if (chunk->raw) {
+		log->archive_bytes -= LOGGER_CHUNK_SIZE;
+	} else {
+		log->archive_bytes -= chunk->lzo_len;
+		log->lzo_in -= chunk->used;
+		log->lzo_out -= chunk->lzo_len;
+	}
+	if (chunk == log->open)
+		log->open = NULL;
+
+	if (chunk->busy)
+		chunk->orphan = true;
+	else
+		archive_free_chunk(chunk);
+}
+
+/*
+ * archive_trim - drops the oldest chunks until the archive fits its budget.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_trim(struct logger_log *log)
+{
+	while (log->archive_bytes > LOGGER_ARCHIVE_BUDGET) {
+		struct logger_chunk *chunk;
+
+		chunk = list_first_entry(&log->chunks, struct logger_chunk,
+					 list);
+		if (chunk == log->open || chunk->busy)
+			break;
+		archive_drop(log, chunk);
+	}
+}
+
+/*
+ * archive_flush - empties the archive.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_flush(struct logger_log *log)
+{
+	while (!list_empty(&log->chunks))
+		archive_drop(log, list_first_entry(&log->chunks,
+						   struct logger_chunk, list));
+}
+
+/*
+ * archive_compress_work - compresses every full chunk. The chunk is only
+ * marked busy while the compression itself runs without log->mutex.
+ */
+static void archive_compress_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log, work);
+	unsigned char *wrkmem, *dst;
+
+	wrkmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+	dst = kmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE), GFP_KERNEL);
+	if (!wrkmem || !dst)
+		goto out;
+
+	while (1) {
+		struct logger_chunk *chunk, *found = NULL;
+		size_t len;
+		int ret;
+
+		mutex_lock(&log->mutex);
+		list_for_each_entry(chunk, &log->chunks, list) {
+			if (chunk->raw && !chunk->stored &&
+			    chunk != log->open && !chunk->busy) {
+				found = chunk;
+				break;
+			}
+		}
+		if (found)
+			found->busy = true;
+		mutex_unlock(&log->mutex);
+		if (!found)
+			break;
+
+		ret = lzo1x_1_compress(found->raw, found->used, dst, &len,
+				       wrkmem);
+
+		mutex_lock(&log->mutex);
+		found->busy = false;
+		if (found->orphan) {
+			archive_free_chunk(found);
+		} else if (ret == LZO_E_OK && len < found->used) {
+			found->lzo = kmemdup(dst, len, GFP_KERNEL);
+			if (found->lzo) {
+				kfree(found->raw);
+				found->raw = NULL;
+				found->lzo_len = len;
+				log->archive_bytes -= LOGGER_CHUNK_SIZE - len;
+				log->lzo_in += found->used;
+				log->lzo_out += len;
+			}
+		} else {
+			/* leave an uncompressible chunk as it is */
+			found->stored = true;
+		}
+		archive_trim(log);
+		mutex_unlock(&log->mutex);
+	}
+
+out:
+	kfree(dst);
+	kfree(wrkmem);
+}
+
+/*
+ * archive_entry - appends the ring entry at 'off', whose header is 'entry',
+ * to the archive and moves any reader sitting on it along.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_entry(struct logger_log *log, size_t off,
+			  struct logger_entry *entry)
+{
+	struct logger_chunk *chunk = log->open;
+	struct logger_reader *reader;
+	size_t len = sizeof(struct logger_entry) + entry->len;
+	size_t msg_start, first;
+
+	if (chunk && chunk->used + len > LOGGER_CHUNK_SIZE) {
+		log->open = NULL;
+		schedule_work(&log->work);
+		chunk = NULL;
+	}
+	if (!chunk) {
+		chunk = kzalloc(sizeof(struct logger_chunk), GFP_KERNEL);
+		if (!chunk)
+			return;
+		chunk->raw = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		if (!chunk->raw) {
+			kfree(chunk);
+			return;
+		}
+		chunk->seq = log->next_seq++;
+		list_add_tail(&chunk->list, &log->chunks);
+		log->archive_bytes += LOGGER_CHUNK_SIZE;
+		log->open = chunk;
+		archive_trim(log);
+	}
+
+	list_for_each_entry(reader, &log->readers, list) {
+		if (!reader->in_archive && reader->r_off == off) {
+			reader->in_archive = true;
+			reader->a_seq = chunk->seq;
+			reader->a_off = chunk->used;
+		}
+	}
+
+	memcpy(chunk->raw + chunk->used, entry, sizeof(struct logger_entry));
+	chunk->used += sizeof(struct logger_entry);
+
+	msg_start = logger_offset(off + sizeof(struct logger_entry));
+	first = min_t(size_t, entry->len, log->size - msg_start);
+	memcpy(chunk->raw + chunk->used, log->buffer + msg_start, first);
+	memcpy(chunk->raw + chunk->used + first, log->buffer,
+	       entry->len - first);
+	chunk->used += entry->len;
+}
+
+/*
+ * archive_range - archives the ring entries from 'off' up to 'end', which
+ * are about to be overwritten.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_range(struct logger_log *log, size_t off, size_t end)
+{
+	while (off != end) {
+		struct logger_entry scratch;
+		struct logger_entry *entry;
+
+		entry = get_entry_header(log, off, &scratch);
+		archive_entry(log, off, entry);
+		off = logger_offset(off + sizeof(struct logger_entry) +
+				    entry->len);
+	}
+}
+
+/*
+ * archive_data - returns the uncompressed entries of 'chunk', going through
+ * the reader's cache for compressed chunks. NULL if that fails.
+ */
+static unsigned char *archive_data(struct logger_reader *reader,
+				   struct logger_chunk *chunk)
+{
+	size_t len = LOGGER_CHUNK_SIZE;
+
+	if (chunk->raw)
+		return chunk->raw;
+	if (reader->cache && reader->cache_seq == chunk->seq)
+		return reader->cache;
+
+	if (!reader->cache) {
+		reader->cache = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		if (!reader->cache)
+			return NULL;
+	}
+	reader->cache_seq = 0;
+	if (lzo1x_decompress_safe(chunk->lzo, chunk->lzo_len, reader->cache,
+				  &len) != LZO_E_OK || len != chunk->used) {
+		printk(KERN_ERR "logger: bad archive chunk in log '%s'\n",
+		       reader->log->misc.name);
+		return NULL;
+	}
+	reader->cache_seq = chunk->seq;
+
+	return reader->cache;
+}
+
+/*
+ * archive_peek - returns the header of the next archived entry for 'reader',
+ * or NULL once it has read the whole archive, at which point the reader is
+ * moved over to the ring.
+ *
+ * Caller must hold log->mutex.
+ */
+static struct logger_entry *archive_peek(struct logger_log *log,
+					 struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+
+	if (!reader->in_archive)
+		return NULL;
+
+	list_for_each_entry(chunk, &log->chunks, list) {
+		unsigned char *data;
+
+		if (chunk->seq < reader->a_seq)
+			continue;
+		if (chunk->seq > reader->a_seq) {
+			/* our chunk has been dropped */
+			reader->a_seq = chunk->seq;
+			reader->a_off = 0;
+		}
+		if (reader->a_off < chunk->used) {
+			data = archive_data(reader, chunk);
+			if (data)
+				return (struct logger_entry *)
+					(data + reader->a_off);
+		}
+		if (chunk == log->open)
+			break;
+		reader->a_seq++;
+		reader->a_off = 0;
+	}
+
+	/* the open chunk ends where the ring starts */
+	reader->in_archive = false;
+	reader->r_off = log->head;
+
+	return NULL;
+}
+
+static void archive_advance(struct logger_reader *reader,
+			    struct logger_entry *entry)
+{
+	reader->a_off += sizeof(struct logger_entry) + entry->len;
+}
+
+/*
+ * archive_len - returns the number of archived bytes left for 'reader'.
+ *
+ * Caller must hold log->mutex.
+ */
+static size_t archive_len(struct logger_log *log,
+			  struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+	size_t len = 0;
+
+	list_for_each_entry(chunk, &log->chunks, list) {
+		if (chunk->seq == reader->a_seq)
+			len += chunk->used - reader->a_off;
+		else if (chunk->seq > reader->a_seq)
+			len += chunk->used;
+	}
+
+	return len;
+}
+
+/*
+ * archive_size - returns the logical size of the archive: its budget,
+ * scaled by the compression ratio achieved so far.
+ */
+static size_t archive_size(struct logger_log *log)
+{
+	if (!log->lzo_out)
+		return LOGGER_ARCHIVE_BUDGET;
+	return div_u64((u64) LOGGER_ARCHIVE_BUDGET * log->lzo_in,
+		       log->lzo_out);
+}
+
+/*
+ * archive_start - places a new reader at the oldest archived entry.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_start(struct logger_log *log,
+			  struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+
+	reader->cache = NULL;
+	reader->cache_seq = 0;
+	if (list_empty(&log->chunks))
+		return;
+
+	chunk = list_first_entry(&log->chunks, struct logger_chunk, list);
+	reader->in_archive = true;
+	reader->a_seq = chunk->seq;
+	reader->a_off = 0;
+}
+
+static void archive_release(struct logger_reader *reader)
+{
+	kfree(reader->cache);
+}
+
+static void __init init_log_archive(struct logger_log *log)
+{
+	INIT_LIST_HEAD(&log->chunks);
+	INIT_WORK(&log->work, archive_compress_work);
+	log->next_seq = 1;
+}
+
+#else
+
+static inline void archive_flush(struct logger_log *log)
+{
+}
+
+static inline void archive_range(struct logger_log *log, size_t off,
+				 size_t end)
+{
+}
+
+static inline struct logger_entry *archive_peek(struct logger_log *log,
+						struct logger_reader *reader)
+{
+	return NULL;
+}
+
+static inline void archive_advance(struct logger_reader *reader,
+				   struct logger_entry *entry)
+{
+}
+
+static inline size_t archive_len(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	return 0;
+}
+
+static inline size_t archive_size(struct logger_log *log)
+{
+	return 0;
+}
+
+static inline void archive_start(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+}
+
+static inline void archive_release(struct logger_reader *reader)
+{
+}
+
+static inline void init_log_archive(struct logger_log *log)
+{
+}
+
+#endif /* CONFIG_ANDROID_LOGGER_COMPRESS */
+
+/*
+ * do_read_archive_to_user - reads the archived entry 'entry' into the
+ * user-space buffer 'buf'. Returns the number of bytes read.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t do_read_archive_to_user(struct logger_reader *reader,
+				       struct logger_entry *entry,
+				       char __user *buf)
+{
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
+
+	if (copy_header_to_user(reader->r_ver, entry, buf))
+		return -EFAULT;
+	if (copy_to_user(buf + hdr_len, entry->msg, entry->len))
+		return -EFAULT;
+
+	archive_advance(reader, entry);
+
+	return hdr_len + entry->len;
+}
+
+/*
+ * logger_skip_by_uid - moves 'reader' to the first entry readable by 'euid',
+ * in the archive or the ring.
+ *
+ * Caller must hold log->mutex.
+ */
+static void logger_skip_by_uid(struct logger_log *log,
+			       struct logger_reader *reader, uid_t euid)
+{
+	struct logger_entry *entry;
+
+	while ((entry = archive_peek(log, reader)) && entry->euid != euid)
+		archive_advance(reader, entry);
+
+	if (!reader->in_archive)
+		reader->r_off = get_next_entry_by_uid(log,
+			reader->r_off, euid);
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -247,6 +767,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry *entry;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -255,7 +776,8 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
+		logger_drain(log);
+		ret = !reader->in_archive && log->w_off == reader->r_off;
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -278,10 +800,21 @@ start:
 		return ret;
 
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 
 	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+		logger_skip_by_uid(log, reader, current_euid());
+
+	entry = archive_peek(log, reader);
+	if (entry) {
+		ret = get_user_hdr_len(reader->r_ver) + entry->len;
+		if (count < ret) {
+			ret = -EINVAL;
+			goto out;
+		}
+		ret = do_read_archive_to_user(reader, entry, buf);
+		goto out;
+	}
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
@@ -357,11 +890,17 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, log->head)) {
+		size_t head = get_next_entry(log, log->head, len);
+
+		/* this moves the readers on the overwritten entries too */
+		archive_range(log, log->head, head);
+		log->head = head;
+	}
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
+		if (!reader->in_archive &&
+		    clock_interval(old, new, reader->r_off))
 			reader->r_off = get_next_entry(log, reader->r_off, len);
 }
 
@@ -410,6 +949,222 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 	return count;
 }
 
+/*
+ * stage_copy_from_user - copies 'count' bytes from the user-space buffer
+ * 'buf' into 'stage' at the free-running offset 'off'. This never faults
+ * pages in, so a record is not left reserved while its writer sleeps.
+ *
+ * Caller must have page faults disabled.
+ */
+static int stage_copy_from_user(struct logger_stage *stage, unsigned int off,
+				const void __user *buf, size_t count)
+{
+	size_t len;
+
+	if (!access_ok(VERIFY_READ, buf, count))
+		return -EFAULT;
+
+	off = logger_stage_offset(off);
+	len = min_t(size_t, count, LOGGER_STAGE_SIZE - off);
+	if (len && __copy_from_user_inatomic(stage->buffer + off, buf, len))
+		return -EFAULT;
+
+	if (count != len)
+		if (__copy_from_user_inatomic(stage->buffer, buf + len,
+					      count - len))
+			return -EFAULT;
+
+	return 0;
+}
+
+/*
+ * stage_copy - copies 'count' bytes between 'stage' at the free-running
+ * offset 'off' and the kernel buffer 'buf', into the stage if 'to_stage'.
+ */
+static void stage_copy(struct logger_stage *stage, unsigned int off,
+		       void *buf, size_t count, bool to_stage)
+{
+	size_t len;
+
+	off = logger_stage_offset(off);
+	len = min_t(size_t, count, LOGGER_STAGE_SIZE - off);
+	if (to_stage) {
+		memcpy(stage->buffer + off, buf, len);
+		memcpy(stage->buffer, buf + len, count - len);
+	} else {
+		memcpy(buf, stage->buffer + off, len);
+		memcpy(buf + len, stage->buffer, count - len);
+	}
+}
+
+/*
+ * logger_stage_write - writes one entry into the calling cpu's staging ring
+ * without taking log->mutex.
+ *
+ * Returns the payload length on success, or -ENOSPC if the ring has no room
+ * or the payload is not resident. The caller then takes the slow path, which
+ * may fault the payload in, after draining the rings so that order is kept.
+ */
+static ssize_t logger_stage_write(struct logger_log *log,
+				  struct logger_entry *header,
+				  const struct iovec *iov,
+				  unsigned long nr_segs)
+{
+	struct logger_stage *stage;
+	unsigned int head, rec, len;
+	u32 *tag;
+	ssize_t ret = 0;
+
+	if (!log->stage)
+		return -ENOSPC;
+
+	/*
+	 * The cmpxchg below makes each ring safe for any number of writers;
+	 * staying on the cpu just keeps the time a record sits reserved but
+	 * uncommitted, which holds up the drain, short.
+	 */
+	stage = &log->stage[get_cpu()];
+	len = ALIGN(sizeof(u32) + sizeof(struct logger_entry) + header->len,
+		    sizeof(u32));
+	do {
+		head = atomic_read(&stage->head);
+		if (head + len - ACCESS_ONCE(stage->tail) > LOGGER_STAGE_SIZE) {
+			put_cpu();
+			return -ENOSPC;
+		}
+	} while (atomic_cmpxchg(&stage->head, head, head + len) != head);
+
+	rec = head + sizeof(u32);
+	stage_copy(stage, rec, header, sizeof(struct logger_entry), true);
+	rec += sizeof(struct logger_entry);
+
+	pagefault_disable();
+	while (nr_segs-- > 0 && ret < header->len) {
+		size_t seg;
+
+		/* figure out how much of this vector we can keep */
+		seg = min_t(size_t, iov->iov_len, header->len - ret);
+
+		/* on a fault, skip the record and retry on the slow path */
+		if (unlikely(stage_copy_from_user(stage, rec, iov->iov_base,
+						  seg))) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		iov++;
+		rec += seg;
+		ret += seg;
+	}
+	pagefault_enable();
+
+	/* tags sit on 32-bit boundaries so they never wrap */
+	tag = (u32 *) (stage->buffer + logger_stage_offset(head));
+	smp_wmb();
+	ACCESS_ONCE(*tag) = len | (ret < 0 ? LOGGER_STAGE_DISCARDED :
+					     LOGGER_STAGE_COMMITTED);
+	put_cpu();
+
+	return ret;
+}
+
+/*
+ * stage_consume - releases the 'len' byte record at the tail of 'stage'
+ * back to the writers. Records are zeroed so that a reserved but not yet
+ * committed record always reads as such.
+ *
+ * Caller must hold log->mutex.
+ */
+static void stage_consume(struct logger_stage *stage, u32 len)
+{
+	unsigned int off = logger_stage_offset(stage->tail);
+	size_t first = min_t(size_t, len, LOGGER_STAGE_SIZE - off);
+
+	memset(stage->buffer + off, 0, first);
+	memset(stage->buffer, 0, len - first);
+	smp_mb();
+	ACCESS_ONCE(stage->tail) = stage->tail + len;
+}
+
+/*
+ * stage_peek - returns the header of the oldest committed entry in 'stage',
+ * or NULL if there is none. Discarded records are consumed on the way.
+ *
+ * Caller must hold log->mutex.
+ */
+static struct logger_entry *stage_peek(struct logger_stage *stage, u32 *len)
+{
+	while (stage->tail != (unsigned int) atomic_read(&stage->head)) {
+		u32 tag;
+
+		tag = ACCESS_ONCE(*(u32 *) (stage->buffer +
+					    logger_stage_offset(stage->tail)));
+		if (!(tag & (LOGGER_STAGE_COMMITTED | LOGGER_STAGE_DISCARDED)))
+			return NULL;
+		smp_rmb();
+
+		*len = tag & LOGGER_STAGE_LEN_MASK;
+		if (tag & LOGGER_STAGE_COMMITTED) {
+			stage_copy(stage, stage->tail + sizeof(u32),
+				   &stage->next, sizeof(struct logger_entry),
+				   false);
+			return &stage->next;
+		}
+		stage_consume(stage, *len);
+	}
+
+	return NULL;
+}
+
+/*
+ * logger_drain - moves all committed entries out of the staging rings and
+ * into the log, oldest first across all cpus.
+ *
+ * Caller must hold log->mutex.
+ */
+static void logger_drain(struct logger_log *log)
+{
+	if (!log->stage)
+		return;
+
+	while (1) {
+		struct logger_stage *best = NULL;
+		struct logger_entry *entry, *first = NULL;
+		unsigned int off;
+		size_t len1;
+		u32 len, best_len = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			entry = stage_peek(&log->stage[cpu], &len);
+			if (!entry)
+				continue;
+			if (!first || entry->sec < first->sec ||
+			    (entry->sec == first->sec &&
+			     entry->nsec < first->nsec)) {
+				best = &log->stage[cpu];
+				first = entry;
+				best_len = len;
+			}
+		}
+		if (!best)
+			break;
+
+		fix_up_readers(log, sizeof(struct logger_entry) + first->len);
+		do_write_log(log, first, sizeof(struct logger_entry));
+
+		/* the payload may wrap around the end of the staging ring */
+		off = logger_stage_offset(best->tail + sizeof(u32) +
+					  sizeof(struct logger_entry));
+		len1 = min_t(size_t, first->len, LOGGER_STAGE_SIZE - off);
+		do_write_log(log, best->buffer + off, len1);
+		if (first->len != len1)
+			do_write_log(log, best->buffer, first->len - len1);
+
+		stage_consume(best, best_len);
+	}
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -438,7 +1193,22 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
+	ret = logger_stage_write(log, &header, iov, nr_segs);
+	if (likely(ret != -ENOSPC)) {
+		/* pairs with prepare_to_wait() in logger_read() */
+		smp_mb();
+		if (waitqueue_active(&log->wq))
+			wake_up_interruptible(&log->wq);
+		return ret;
+	}
+	ret = 0;
+
+	/*
+	 * Our staging ring is full: drain it and write straight into the
+	 * log instead.
+	 */
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 
 	orig = log->w_off;
 
@@ -514,7 +1284,10 @@ static int logger_open(struct inode *inode, struct file *file)
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
+		logger_drain(log);
 		reader->r_off = log->head;
+		reader->in_archive = false;
+		archive_start(log, reader);
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -540,6 +1313,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 		list_del(&reader->list);
 		mutex_unlock(&log->mutex);
 
+		archive_release(reader);
 		kfree(reader);
 	}
 
@@ -570,11 +1344,11 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+		logger_skip_by_uid(log, reader, current_euid());
 
-	if (log->w_off != reader->r_off)
+	if (archive_peek(log, reader) || log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -598,14 +1372,17 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry *entry;
+	size_t r_off;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
-		ret = log->size;
+		ret = log->size + archive_size(log);
 		break;
 	case LOGGER_GET_LOG_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -613,10 +1390,16 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		ret = 0;
+		r_off = reader->r_off;
+		if (reader->in_archive) {
+			ret = archive_len(log, reader);
+			r_off = log->head;
+		}
+		if (log->w_off >= r_off)
+			ret += log->w_off - r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret += (log->size - r_off) + log->w_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -626,10 +1409,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 
 		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
+			logger_skip_by_uid(log, reader, current_euid());
 
-		if (log->w_off != reader->r_off)
+		entry = archive_peek(log, reader);
+		if (entry)
+			ret = get_user_hdr_len(reader->r_ver) + entry->len;
+		else if (log->w_off != reader->r_off)
 			ret = get_user_hdr_len(reader->r_ver) +
 				get_entry_msg_len(log, reader->r_off);
 		else
@@ -640,8 +1425,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
+		archive_flush(log);
+		list_for_each_entry(reader, &log->readers, list) {
+			reader->in_archive = false;
 			reader->r_off = log->w_off;
+		}
 		log->head = log->w_off;
 		ret = 0;
 		break;
@@ -720,10 +1508,45 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * init_log_stage - sets up the per-cpu staging rings of 'log'. Without them
+ * every write takes log->mutex, which is slower but still correct.
+ */
+static void __init init_log_stage(struct logger_log *log)
+{
+	struct logger_stage *stage;
+	int cpu;
+
+	stage = kcalloc(nr_cpu_ids, sizeof(struct logger_stage), GFP_KERNEL);
+	if (!stage)
+		goto err;
+
+	for_each_possible_cpu(cpu) {
+		stage[cpu].buffer = kzalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (!stage[cpu].buffer)
+			goto err_free;
+		atomic_set(&stage[cpu].head, 0);
+	}
+
+	log->stage = stage;
+	return;
+
+err_free:
+	for_each_possible_cpu(cpu)
+		kfree(stage[cpu].buffer);
+	kfree(stage);
+err:
+	printk(KERN_WARNING "logger: no staging rings for log '%s'\n",
+	       log->misc.name);
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	init_log_stage(log);
+	init_log_archive(log);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -733,6 +1556,10 @@ static int __init init_log(struct logger_log *log)
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	printk(KERN_INFO "logger: keeping %dK of compressed history for '%s'\n",
+	       CONFIG_ANDROID_LOGGER_COMPRESS_SIZE, log->misc.name);
+#endif
 
 	return 0;
 }
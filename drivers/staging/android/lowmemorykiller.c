@@ -16,6 +16,22 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in one bucket per oom_adj value, maintained from fork,
+ * exit and oom_adj writes, so finding a victim only looks at the buckets at
+ * or above the selected minimum oom_adj instead of walking every task under
+ * tasklist_lock.
+ *
+ * With /sys/module/lowmemorykiller/parameters/predictive set to 1 the driver
+ * also follows the reclaim pressure (pages scanned vs. reclaimed by vmscan)
+ * over pressure_window_ms windows. While pressure is at least
+ * pressure_rising percent and higher than in the previous window, each level
+ * fires at the minfree threshold of the next level up, i.e. one level
+ * earlier. Independently of that, a level does not kill more than once per
+ * kill_ratelimit_ms. Per-level kill counts, rate-limited kills, the latency
+ * of the last kill (SIGKILL to task freed) and the total RSS freed are
+ * exported as the kill_count, kill_ratelimited, kill_latency_ms and
+ * freed_pages parameters.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +51,11 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/vmstat.h>
+#include <linux/jiffies.h>
+#include <linux/lowmemorykiller.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,8 +73,53 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+#define LOWMEM_LEVELS	ARRAY_SIZE(lowmem_adj)
+
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
+static unsigned long lowmem_deathpending_start;
+static int lowmem_deathpending_level;
+
+static uint32_t lowmem_predictive;
+static uint32_t lowmem_pressure_window_ms = 100;
+static uint32_t lowmem_pressure_rising = 60;	/* percent */
+static uint32_t lowmem_kill_ratelimit_ms = 250;
+
+/* reclaim pressure over the current and the previous window */
+static struct {
+	unsigned long start;
+	unsigned long scanned;
+	unsigned long reclaimed;
+	int pressure;
+	int prev_pressure;
+} lowmem_window;
+static DEFINE_SPINLOCK(lowmem_window_lock);
+
+/* per-level statistics, indexed like lowmem_adj[] */
+static unsigned long lowmem_last_kill[LOWMEM_LEVELS];
+static uint32_t lowmem_kill_count[LOWMEM_LEVELS];
+static uint32_t lowmem_kill_ratelimited[LOWMEM_LEVELS];
+static uint32_t lowmem_kill_latency_ms[LOWMEM_LEVELS];
+static unsigned long lowmem_freed_pages[LOWMEM_LEVELS];
+
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+/*
+ * signal_structs of live thread groups, indexed by oom_adj - OOM_DISABLE.
+ * Processes are forked long before this driver's initcall runs, so the
+ * buckets are initialized on first use, under lowmem_bucket_lock.
+ */
+static struct list_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+
+/*
+ * lowmem_select() drops lowmem_bucket_lock every LOWMEM_SCAN_BATCH
+ * entries, keeping its place with lowmem_scan_cursor. Only one scan runs
+ * at a time, so the bucket walk never meets another scan's cursor.
+ */
+#define LOWMEM_SCAN_BATCH	16
+static LIST_HEAD(lowmem_scan_cursor);
+static DEFINE_MUTEX(lowmem_scan_mutex);
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -73,19 +139,220 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
 
-	if (task == lowmem_deathpending)
+	if (task == lowmem_deathpending) {
+		lowmem_kill_latency_ms[lowmem_deathpending_level] =
+			jiffies_to_msecs(jiffies - lowmem_deathpending_start);
 		lowmem_deathpending = NULL;
+	}
 
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/* Sum one per-zone vm event over all zones and online cpus */
+static unsigned long lowmem_zone_events(enum vm_event_item first)
+{
+	unsigned long sum = 0;
+	int cpu, zone;
+
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++)
+			sum += this->event[first + zone];
+	}
+	return sum;
+}
+
+static void lowmem_window_sample(unsigned long *scanned,
+				 unsigned long *reclaimed)
+{
+	*scanned = lowmem_zone_events(PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL) +
+		lowmem_zone_events(PGSCAN_DIRECT_NORMAL - ZONE_NORMAL);
+	*reclaimed = lowmem_zone_events(PGSTEAL_NORMAL - ZONE_NORMAL);
+}
+#else
+static void lowmem_window_sample(unsigned long *scanned,
+				 unsigned long *reclaimed)
+{
+	*scanned = 0;
+	*reclaimed = 0;
+}
+#endif
+
+/*
+ * Close the current window once it has run for pressure_window_ms and
+ * return whether reclaim pressure is rising.  Pressure is the share of
+ * scanned pages that could not be reclaimed, in percent.
+ */
+static int lowmem_pressure_rising_now(void)
+{
+	unsigned long scanned, reclaimed, ds, dr;
+
+	if (!lowmem_predictive)
+		return 0;
+
+	if (time_after_eq(jiffies, lowmem_window.start +
+			  msecs_to_jiffies(lowmem_pressure_window_ms)) &&
+	    spin_trylock(&lowmem_window_lock)) {
+		lowmem_window_sample(&scanned, &reclaimed);
+		ds = scanned - lowmem_window.scanned;
+		dr = reclaimed - lowmem_window.reclaimed;
+		lowmem_window.prev_pressure = lowmem_window.pressure;
+		if (ds && ds > dr)
+			lowmem_window.pressure = (ds - dr) * 100 / ds;
+		else
+			lowmem_window.pressure = 0;
+		lowmem_window.scanned = scanned;
+		lowmem_window.reclaimed = reclaimed;
+		lowmem_window.start = jiffies;
+		spin_unlock(&lowmem_window_lock);
+		lowmem_print(4, "lowmem pressure %d (was %d)\n",
+			     lowmem_window.pressure,
+			     lowmem_window.prev_pressure);
+	}
+
+	return lowmem_window.pressure >= lowmem_pressure_rising &&
+		lowmem_window.pressure > lowmem_window.prev_pressure;
+}
+
+/* Threshold of a level; one level earlier while pressure is rising */
+static size_t lowmem_level_minfree(int level, int nr_levels, int rising)
+{
+	if (!rising)
+		return lowmem_minfree[level];
+	if (level + 1 < nr_levels)
+		return lowmem_minfree[level + 1];
+	return lowmem_minfree[level] + lowmem_minfree[level] / 4;
+}
+
+static struct list_head *lowmem_bucket(int oom_adj)
+{
+	struct list_head *bucket;
+
+	if (oom_adj < OOM_DISABLE)
+		oom_adj = OOM_DISABLE;
+	if (oom_adj > OOM_ADJUST_MAX)
+		oom_adj = OOM_ADJUST_MAX;
+	bucket = &lowmem_buckets[oom_adj - OOM_DISABLE];
+	if (unlikely(!bucket->next))
+		INIT_LIST_HEAD(bucket);
+	return bucket;
+}
+
+/* Called for every new thread group, once it is on the task list */
+void lowmem_bucket_add(struct signal_struct *sig)
+{
+	spin_lock(&lowmem_bucket_lock);
+	list_add_tail(&sig->lowmem_node, lowmem_bucket(sig->oom_adj));
+	spin_unlock(&lowmem_bucket_lock);
+}
+
+/* Called when the last thread of a group exits */
+void lowmem_bucket_del(struct signal_struct *sig)
+{
+	spin_lock(&lowmem_bucket_lock);
+	list_del_init(&sig->lowmem_node);
+	spin_unlock(&lowmem_bucket_lock);
+}
+
+/* Called after oom_adj (or oom_score_adj) was written */
+void lowmem_bucket_update(struct signal_struct *sig)
+{
+	spin_lock(&lowmem_bucket_lock);
+	if (!list_empty(&sig->lowmem_node))
+		list_move_tail(&sig->lowmem_node, lowmem_bucket(sig->oom_adj));
+	spin_unlock(&lowmem_bucket_lock);
+}
+
+/*
+ * Pick the largest process from the highest non-empty oom_adj bucket at
+ * or above min_adj.  Returns the task with a reference held, or NULL if
+ * there is none or another reclaimer is already scanning.
+ */
+static struct task_struct *lowmem_select(int min_adj, int *oom_adj_out,
+					 int *tasksize_out)
 {
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
-	int rem = 0;
+	struct signal_struct *sig;
+	struct list_head *bucket;
+	int selected_tasksize = 0;
 	int tasksize;
+	int oom_adj;
+	int scanned = 0;
+
+	if (!mutex_trylock(&lowmem_scan_mutex))
+		return NULL;
+
+	spin_lock(&lowmem_bucket_lock);
+	rcu_read_lock();
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj; oom_adj--) {
+		bucket = lowmem_bucket(oom_adj);
+		list_add(&lowmem_scan_cursor, bucket);
+		while (lowmem_scan_cursor.next != bucket) {
+			struct mm_struct *mm;
+
+			if (++scanned % LOWMEM_SCAN_BATCH == 0) {
+				rcu_read_unlock();
+				spin_unlock(&lowmem_bucket_lock);
+				cond_resched();
+				spin_lock(&lowmem_bucket_lock);
+				rcu_read_lock();
+				/* the bucket may have changed around the cursor */
+				continue;
+			}
+
+			sig = list_entry(lowmem_scan_cursor.next,
+					 struct signal_struct, lowmem_node);
+			list_move(&lowmem_scan_cursor, &sig->lowmem_node);
+
+			p = pid_task(sig->leader_pid, PIDTYPE_PID);
+			if (!p)
+				continue;
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= 0)
+				continue;
+			if (selected && tasksize <= selected_tasksize)
+				continue;
+			/* pinned, as the lock may be dropped before we are done */
+			get_task_struct(p);
+			if (selected)
+				put_task_struct(selected);
+			selected = p;
+			selected_tasksize = tasksize;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
+		}
+		list_del(&lowmem_scan_cursor);
+		if (selected)
+			break;
+	}
+	if (selected) {
+		*oom_adj_out = oom_adj;
+		*tasksize_out = selected_tasksize;
+	}
+	rcu_read_unlock();
+	spin_unlock(&lowmem_bucket_lock);
+	mutex_unlock(&lowmem_scan_mutex);
+	return selected;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected = NULL;
+	int rem = 0;
 	int i;
+	int level = -1;
+	int rising;
+	size_t minfree;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
@@ -109,10 +376,12 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
+	rising = lowmem_pressure_rising_now();
 	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
+		minfree = lowmem_level_minfree(i, array_size, rising);
+		if (other_free < minfree && other_file < minfree) {
 			min_adj = lowmem_adj[i];
+			level = i;
 			break;
 		}
 	}
@@ -129,55 +398,33 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+
+	if (lowmem_kill_ratelimit_ms && lowmem_last_kill[level] &&
+	    time_before(jiffies, lowmem_last_kill[level] +
+			msecs_to_jiffies(lowmem_kill_ratelimit_ms))) {
+		lowmem_kill_ratelimited[level]++;
+		lowmem_print(4, "lowmem_shrink level %d rate limited\n", level);
+		return rem;
 	}
+
+	selected = lowmem_select(min_adj, &selected_oom_adj, &selected_tasksize);
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
+		lowmem_deathpending_start = jiffies;
+		lowmem_deathpending_level = level;
+		lowmem_last_kill[level] = jiffies;
+		lowmem_kill_count[level]++;
+		lowmem_freed_pages[level] += selected_tasksize;
+		do_send_sig_info(SIGKILL, SEND_SIG_FORCED, selected, true);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -205,6 +452,20 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(predictive, lowmem_predictive, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_window_ms, lowmem_pressure_window_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_rising, lowmem_pressure_rising, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(kill_ratelimit_ms, lowmem_kill_ratelimit_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_array_named(kill_count, lowmem_kill_count, uint, NULL, S_IRUGO);
+module_param_array_named(kill_ratelimited, lowmem_kill_ratelimited, uint, NULL,
+			 S_IRUGO);
+module_param_array_named(kill_latency_ms, lowmem_kill_latency_ms, uint, NULL,
+			 S_IRUGO);
+module_param_array_named(freed_pages, lowmem_freed_pages, ulong, NULL,
+			 S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
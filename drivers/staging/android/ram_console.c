@@ -14,14 +14,17 @@
  */
 
 #include <linux/console.h>
+#include <linux/ctype.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/notifier.h>
 #include <linux/platform_device.h>
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
 #include <linux/platform_data/ram_console.h>
+#include <linux/workqueue.h>
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 #include <linux/rslib.h>
@@ -31,10 +34,33 @@ struct ram_console_buffer {
 	uint32_t    sig;
 	uint32_t    start;
 	uint32_t    size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+	uint32_t    ecc_end;	/* data ECC is stale from here to start */
+#endif
 	uint8_t     data[0];
 };
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+#define RAM_CONSOLE_SIG (0x52474244) /* DBGR */
+
+/*
+ * Each console write is stored as a record header followed by len bytes
+ * of text.  The printk timestamp prefix is moved into the header; cpu is
+ * the cpu that flushed the line to the console.
+ */
+struct ram_console_record {
+	uint8_t     magic;
+	uint8_t     cpu;
+	uint16_t    len;
+	uint32_t    sec;
+	uint32_t    usec;
+} __packed;
+
+#define RAM_CONSOLE_REC_MAGIC	(0xa5)
+#define RAM_CONSOLE_REC_NO_TIME	(0xffffffff)	/* usec, line had no timestamp */
+#else
 #define RAM_CONSOLE_SIG (0x43474244) /* DBGC */
+#endif
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_EARLY_INIT
 static char __initdata
@@ -56,6 +82,24 @@ static int ram_console_bad_blocks;
 #define ECC_POLY CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_POLYNOMIAL
 #endif
 
+#if defined(CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION) && \
+	defined(CONFIG_ANDROID_RAM_CONSOLE_RECORDS)
+/*
+ * Data blocks are encoded from a workqueue once the writer has moved
+ * past them, so console writes only pay for the header ECC.  Positions
+ * are linear byte counts; ram_console_ecc_off is ram_console_ecc_pos
+ * in the ring.
+ */
+#define RAM_CONSOLE_LAZY_ECC
+#define RAM_CONSOLE_ECC_NONE (0xffffffff) /* ecc_end, all data ECC stale */
+#define RAM_CONSOLE_ECC_DELAY (HZ / 10)
+static unsigned long ram_console_written;
+static unsigned long ram_console_ecc_pos;
+static size_t ram_console_ecc_off;
+static void ram_console_ecc_work_func(struct work_struct *work);
+static DECLARE_DEFERRED_WORK(ram_console_ecc_work, ram_console_ecc_work_func);
+#endif
+
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 static void ram_console_encode_rs8(uint8_t *data, size_t len, uint8_t *ecc)
 {
@@ -82,14 +126,17 @@ static int ram_console_decode_rs8(void *data, size_t len, uint8_t *ecc)
 static void ram_console_update(const char *s, unsigned int count)
 {
 	struct ram_console_buffer *buffer = ram_console_buffer;
-#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+#if defined(CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION) && \
+	!defined(RAM_CONSOLE_LAZY_ECC)
 	uint8_t *buffer_end = buffer->data + ram_console_buffer_size;
 	uint8_t *block;
 	uint8_t *par;
 	int size = ECC_BLOCK_SIZE;
 #endif
 	memcpy(buffer->data + buffer->start, s, count);
-#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+#ifdef RAM_CONSOLE_LAZY_ECC
+	ram_console_written += count;
+#elif defined(CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION)
 	block = buffer->data + (buffer->start & ~(ECC_BLOCK_SIZE - 1));
 	par = ram_console_par_buffer +
 	      (buffer->start / ECC_BLOCK_SIZE) * ECC_SIZE;
@@ -108,14 +155,138 @@ static void ram_console_update_header(void)
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	struct ram_console_buffer *buffer = ram_console_buffer;
 	uint8_t *par;
+#ifdef RAM_CONSOLE_LAZY_ECC
+	/* the stale range would wrap onto itself */
+	if (ram_console_written - ram_console_ecc_pos >= ram_console_buffer_size)
+		buffer->ecc_end = RAM_CONSOLE_ECC_NONE;
+#endif
 	par = ram_console_par_buffer +
 	      DIV_ROUND_UP(ram_console_buffer_size, ECC_BLOCK_SIZE) * ECC_SIZE;
 	ram_console_encode_rs8((uint8_t *)buffer, sizeof(*buffer), par);
 #endif
 }
 
-static void
-ram_console_write(struct console *console, const char *s, unsigned int count)
+#ifdef RAM_CONSOLE_LAZY_ECC
+/*
+ * Encode the blocks between pos and end, starting at ring offset *offp.
+ * The block holding end is only encoded if partial is set.  Returns the
+ * new position.
+ */
+static unsigned long ram_console_encode_blocks(unsigned long pos,
+					       size_t *offp,
+					       unsigned long end, int partial)
+{
+	uint8_t *data = ram_console_buffer->data;
+	size_t off = *offp;
+
+	/* anything older has been overwritten and will be encoded again */
+	if (end - pos >= ram_console_buffer_size)
+		pos += (end - pos) / ram_console_buffer_size *
+			ram_console_buffer_size;
+
+	while (pos != end) {
+		size_t block = off & ~(ECC_BLOCK_SIZE - 1);
+		size_t block_end = min(block + ECC_BLOCK_SIZE,
+				       ram_console_buffer_size);
+		size_t count = block_end - off;
+
+		if (end - pos < count) {
+			if (!partial)
+				break;
+			count = end - pos;
+		}
+		ram_console_encode_rs8(data + block, block_end - block,
+			(uint8_t *)ram_console_par_buffer +
+			(block / ECC_BLOCK_SIZE) * ECC_SIZE);
+		pos += count;
+		off += count;
+		if (off == ram_console_buffer_size)
+			off = 0;
+	}
+	*offp = off;
+	return pos;
+}
+
+static void ram_console_publish_ecc(unsigned long pos, size_t off)
+{
+	ram_console_ecc_pos = pos;
+	ram_console_ecc_off = off;
+	ram_console_buffer->ecc_end = off;
+	ram_console_update_header();
+}
+
+/*
+ * Whether the writer has completed a data block the work has not encoded
+ * yet.  Called with the console lock held.
+ */
+static int ram_console_ecc_pending(void)
+{
+	size_t off = ram_console_ecc_off;
+	size_t block_end = min((off & ~(ECC_BLOCK_SIZE - 1)) + ECC_BLOCK_SIZE,
+			       ram_console_buffer_size);
+
+	return ram_console_written - ram_console_ecc_pos >= block_end - off;
+}
+
+/*
+ * Blocks may be overwritten while they are encoded.  That is harmless:
+ * the writer has then moved past ram_console_ecc_pos and the block is
+ * inside the stale range when it is published.  The work is kicked by
+ * ram_console_write() and only re-arms itself while it is behind, so an
+ * idle console does not wake the CPU.
+ */
+static void ram_console_ecc_work_func(struct work_struct *work)
+{
+	unsigned long end = ACCESS_ONCE(ram_console_written);
+	size_t off = ram_console_ecc_off;
+	unsigned long pos;
+	int pending;
+
+	pos = ram_console_encode_blocks(ram_console_ecc_pos, &off, end, 0);
+	console_lock();
+	if (pos != ram_console_ecc_pos)
+		ram_console_publish_ecc(pos, off);
+	pending = ram_console_ecc_pending();
+	console_unlock();
+	if (pending)
+		schedule_delayed_work(&ram_console_ecc_work,
+				      RAM_CONSOLE_ECC_DELAY);
+}
+
+static int ram_console_panic(struct notifier_block *nb, unsigned long event,
+			     void *unused)
+{
+	size_t off = ram_console_ecc_off;
+	unsigned long pos;
+
+	pos = ram_console_encode_blocks(ram_console_ecc_pos, &off,
+					ram_console_written, 1);
+	ram_console_publish_ecc(pos, off);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ram_console_panic_nb = {
+	.notifier_call = ram_console_panic,
+};
+
+/* Whether the data block at off was written after its ECC was. */
+static int ram_console_block_stale(struct ram_console_buffer *buffer,
+				   size_t off, size_t len)
+{
+	size_t n = ram_console_buffer_size;
+	size_t stale, rel;
+
+	if (buffer->ecc_end >= n)
+		return 1;
+	stale = (buffer->start + n - buffer->ecc_end) % n;
+	if (!stale)
+		return 0;
+	rel = (off + n - buffer->ecc_end) % n;
+	return rel < stale || rel + len > n;
+}
+#endif
+
+static void ram_console_put(const char *s, unsigned int count)
 {
 	int rem;
 	struct ram_console_buffer *buffer = ram_console_buffer;
@@ -137,9 +308,116 @@ ram_console_write(struct console *console, const char *s, unsigned int count)
 	buffer->start += count;
 	if (buffer->size < ram_console_buffer_size)
 		buffer->size += count;
+}
+
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+/*
+ * Parse the "[%5lu.%06lu] " prefix printk adds with printk.time set.
+ * Returns its length, or 0 if s does not start with one.
+ */
+static unsigned int ram_console_parse_time(const char *s, unsigned int count,
+					   struct ram_console_record *rec)
+{
+	unsigned int i = 0, digits;
+	uint32_t sec = 0, usec = 0;
+
+	if (count < 1 || s[i++] != '[')
+		return 0;
+	while (i < count && s[i] == ' ')
+		i++;
+	for (digits = 0; i < count && isdigit(s[i]); i++, digits++)
+		sec = sec * 10 + s[i] - '0';
+	if (!digits || digits > 9 || i >= count || s[i++] != '.')
+		return 0;
+	for (digits = 0; i < count && isdigit(s[i]); i++, digits++)
+		usec = usec * 10 + s[i] - '0';
+	if (digits != 6 || i + 2 > count || s[i] != ']' || s[i + 1] != ' ')
+		return 0;
+	rec->sec = sec;
+	rec->usec = usec;
+	return i + 2;
+}
+
+static void
+ram_console_write(struct console *console, const char *s, unsigned int count)
+{
+	struct ram_console_record rec;
+	unsigned int skip;
+
+	rec.magic = RAM_CONSOLE_REC_MAGIC;
+	rec.cpu = raw_smp_processor_id();
+	skip = ram_console_parse_time(s, count, &rec);
+	if (!skip) {
+		rec.sec = 0;
+		rec.usec = RAM_CONSOLE_REC_NO_TIME;
+	}
+	s += skip;
+	count -= skip;
+	count = min_t(unsigned int, count, 0xffff);
+	if (count > ram_console_buffer_size - sizeof(rec)) {
+		s += count - (ram_console_buffer_size - sizeof(rec));
+		count = ram_console_buffer_size - sizeof(rec);
+	}
+	rec.len = count;
+
+	ram_console_put((const char *)&rec, sizeof(rec));
+	ram_console_put(s, count);
 	ram_console_update_header();
+#ifdef RAM_CONSOLE_LAZY_ECC
+	if (!delayed_work_pending(&ram_console_ecc_work) &&
+	    ram_console_ecc_pending())
+		schedule_delayed_work(&ram_console_ecc_work,
+				      RAM_CONSOLE_ECC_DELAY);
+#endif
 }
 
+/*
+ * Rebuild the console text from the records in log.  Garbage left at the
+ * start of the ring by a record that was partly overwritten is skipped a
+ * byte at a time.  Returns the length of the text; dest may be NULL.
+ */
+static size_t ram_console_decode(const uint8_t *log, size_t size, char *dest)
+{
+	struct ram_console_record rec;
+	size_t pos = 0, out = 0;
+	char prefix[32];
+	int len;
+
+	while (pos + sizeof(rec) <= size) {
+		memcpy(&rec, log + pos, sizeof(rec));
+		if (rec.magic != RAM_CONSOLE_REC_MAGIC ||
+		    rec.len > size - pos - sizeof(rec) ||
+		    (rec.usec >= USEC_PER_SEC &&
+		     rec.usec != RAM_CONSOLE_REC_NO_TIME)) {
+			pos++;
+			continue;
+		}
+		pos += sizeof(rec);
+		if (rec.usec != RAM_CONSOLE_REC_NO_TIME) {
+			len = snprintf(prefix, sizeof(prefix),
+				       "[%5lu.%06lu] c%u ",
+				       (unsigned long)rec.sec,
+				       (unsigned long)rec.usec, rec.cpu);
+			if (dest)
+				memcpy(dest + out, prefix, len);
+			out += len;
+		}
+		if (dest)
+			memcpy(dest + out, log + pos, rec.len);
+		out += rec.len;
+		pos += rec.len;
+	}
+	return out;
+}
+#else
+static void
+ram_console_write(struct console *console, const char *s, unsigned int count)
+{
+	ram_console_put(s, count);
+	ram_console_update_header();
+}
+#endif
+
 static struct console ram_console = {
 	.name	= "ram",
 	.write	= ram_console_write,
@@ -161,9 +439,12 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 {
 	size_t old_log_size = buffer->size;
 	size_t bootinfo_size = 0;
-	size_t total_size = old_log_size;
+	size_t total_size;
 	char *ptr;
 	const char *bootinfo_label = "Boot info:\n";
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+	uint8_t *log;
+#endif
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	uint8_t *block;
@@ -178,6 +459,14 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 		int size = ECC_BLOCK_SIZE;
 		if (block + size > buffer->data + ram_console_buffer_size)
 			size = buffer->data + ram_console_buffer_size - block;
+#ifdef RAM_CONSOLE_LAZY_ECC
+		if (ram_console_block_stale(buffer, block - buffer->data,
+					    size)) {
+			block += ECC_BLOCK_SIZE;
+			par += ECC_SIZE;
+			continue;
+		}
+#endif
 		numerr = ram_console_decode_rs8(block, size, par);
 		if (numerr > 0) {
 #if 0
@@ -204,6 +493,22 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 				      "\nNo errors detected\n");
 	if (strbuf_len >= sizeof(strbuf))
 		strbuf_len = sizeof(strbuf) - 1;
+#endif
+
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+	log = kmalloc(buffer->size, GFP_KERNEL);
+	if (log == NULL) {
+		printk(KERN_ERR "ram_console: failed to allocate buffer\n");
+		return;
+	}
+	memcpy(log, &buffer->data[buffer->start], buffer->size - buffer->start);
+	memcpy(log + buffer->size - buffer->start,
+	       &buffer->data[0], buffer->start);
+	old_log_size = ram_console_decode(log, buffer->size, NULL);
+#endif
+
+	total_size = old_log_size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	total_size += strbuf_len;
 #endif
 
@@ -216,16 +521,24 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 		if (dest == NULL) {
 			printk(KERN_ERR
 			       "ram_console: failed to allocate buffer\n");
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+			kfree(log);
+#endif
 			return;
 		}
 	}
 
 	ram_console_old_log = dest;
 	ram_console_old_log_size = total_size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+	ram_console_decode(log, buffer->size, ram_console_old_log);
+	kfree(log);
+#else
 	memcpy(ram_console_old_log,
 	       &buffer->data[buffer->start], buffer->size - buffer->start);
 	memcpy(ram_console_old_log + buffer->size - buffer->start,
 	       &buffer->data[0], buffer->start);
+#endif
 	ptr = ram_console_old_log + old_log_size;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	memcpy(ptr, strbuf, strbuf_len);
@@ -318,8 +631,15 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 	buffer->sig = RAM_CONSOLE_SIG;
 	buffer->start = 0;
 	buffer->size = 0;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_RECORDS
+	buffer->ecc_end = 0;
+#endif
 
 	register_console(&ram_console);
+#ifdef RAM_CONSOLE_LAZY_ECC
+	atomic_notifier_chain_register(&panic_notifier_list,
+				       &ram_console_panic_nb);
+#endif
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ENABLE_VERBOSE
 	console_verbose();
 #endif
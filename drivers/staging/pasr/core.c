@@ -5,8 +5,12 @@
  */
 
 #include <linux/mm.h>
+#include <linux/init.h>
 #include <linux/spinlock.h>
 #include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/syscore_ops.h>
 #include <linux/pasr.h>
 
 #include "helper.h"
@@ -16,8 +20,15 @@ enum pasr_state {
 	PASR_NO_REFRESH,
 };
 
+/* Sections with more free memory than this get their pages allocated last */
+#define PASR_MOSTLY_FREE	(PASR_SECTION_SZ / 4 * 3)
+
 struct pasr_fw {
 	struct pasr_map *map;
+	phys_addr_t start;
+	phys_addr_t end;
+	u32 mask_updates;
+	u32 suspend_masked;
 };
 
 static struct pasr_fw pasr;
@@ -37,13 +48,36 @@ void pasr_update_mask(struct pasr_section *section, enum pasr_state state)
 			, __func__, state == PASR_REFRESH ? "Start" : "Stop"
 			, section->start, die->idx, die->mem_reg);
 
+	pasr.mask_updates++;
+
 	if (die->apply_mask)
 		die->apply_mask(&die->mem_reg, die->cookie);
 
 	return;
 }
 
-void pasr_put(phys_addr_t paddr, unsigned long size)
+static int pasr_section_masked(struct pasr_section *section)
+{
+	struct pasr_die *die = section->die;
+	u8 bit = (section->start - die->start) >> PASR_SECTION_SZ_BITS;
+
+	return test_bit(bit, &die->mem_reg);
+}
+
+/*
+ * The page allocator reports every buddy block, including those lying
+ * outside the declared dies, so filter those out before the lookup
+ * helpers complain about them.
+ */
+static struct pasr_section *pasr_lookup(phys_addr_t paddr)
+{
+	if (paddr < pasr.start || paddr >= pasr.end)
+		return NULL;
+
+	return pasr_addr2section(pasr.map, paddr);
+}
+
+static void __pasr_put(phys_addr_t paddr, unsigned long size, int deferred)
 {
 	struct pasr_section *s;
 	unsigned long cur_sz;
@@ -53,7 +87,7 @@ void pasr_put(phys_addr_t paddr, unsigned long size)
 		goto out;
 
 	do {
-		s = pasr_addr2section(pasr.map, paddr);
+		s = pasr_lookup(paddr);
 		if (!s)
 			goto out;
 
@@ -66,7 +100,7 @@ void pasr_put(phys_addr_t paddr, unsigned long size)
 		s->free_size += cur_sz;
 		BUG_ON(s->free_size > PASR_SECTION_SZ);
 
-		if (s->free_size < PASR_SECTION_SZ)
+		if (s->free_size < PASR_SECTION_SZ || deferred)
 			goto unlock;
 
 		if (!s->pair)
@@ -87,6 +121,16 @@ out:
 	return;
 }
 
+void pasr_put(phys_addr_t paddr, unsigned long size)
+{
+	__pasr_put(paddr, size, 0);
+}
+
+void pasr_put_deferred(phys_addr_t paddr, unsigned long size)
+{
+	__pasr_put(paddr, size, 1);
+}
+
 void pasr_get(phys_addr_t paddr, unsigned long size)
 {
 	unsigned long flags = 0;
@@ -97,7 +141,7 @@ void pasr_get(phys_addr_t paddr, unsigned long size)
 		goto out;
 
 	do {
-		s = pasr_addr2section(pasr.map, paddr);
+		s = pasr_lookup(paddr);
 		if (!s)
 			goto out;
 
@@ -107,15 +151,16 @@ void pasr_get(phys_addr_t paddr, unsigned long size)
 		if (s->lock)
 			spin_lock_irqsave(s->lock, flags);
 
-		if (s->free_size < PASR_SECTION_SZ)
+		/*
+		 * Paired sections are always masked together. A fully free
+		 * section may not be masked yet if its free was deferred.
+		 */
+		if (!pasr_section_masked(s))
 			goto unlock;
 
-		if (!s->pair)
-			pasr_update_mask(s, PASR_REFRESH);
-		else if (s->pair->free_size == PASR_SECTION_SZ) {
-				pasr_update_mask(s, PASR_REFRESH);
-				pasr_update_mask(s->pair, PASR_REFRESH);
-		}
+		pasr_update_mask(s, PASR_REFRESH);
+		if (s->pair)
+			pasr_update_mask(s->pair, PASR_REFRESH);
 unlock:
 		BUG_ON(cur_sz > s->free_size);
 		s->free_size -= cur_sz;
@@ -131,6 +176,53 @@ out:
 	return;
 }
 
+int pasr_mostly_free(phys_addr_t paddr)
+{
+	struct pasr_section *s;
+
+	if (!pasr.map)
+		return 0;
+
+	s = pasr_lookup(paddr);
+
+	return s && s->free_size >= PASR_MOSTLY_FREE;
+}
+
+/*
+ * Mask off every fully free section whose masking has been deferred by the
+ * page allocator. Called with interrupts disabled on the last CPU standing.
+ */
+static int pasr_suspend(void)
+{
+	struct pasr_section *s;
+	int i, j;
+
+	if (!pasr.map)
+		return 0;
+
+	for_each_pasr_section(i, j, (*pasr.map), s) {
+		if (s->lock)
+			spin_lock(s->lock);
+
+		if (s->free_size == PASR_SECTION_SZ && !pasr_section_masked(s)
+			&& (!s->pair || s->pair->free_size == PASR_SECTION_SZ)) {
+			pasr_update_mask(s, PASR_NO_REFRESH);
+			if (s->pair)
+				pasr_update_mask(s->pair, PASR_NO_REFRESH);
+			pasr.suspend_masked++;
+		}
+
+		if (s->lock)
+			spin_unlock(s->lock);
+	}
+
+	return 0;
+}
+
+static struct syscore_ops pasr_syscore_ops = {
+	.suspend = pasr_suspend,
+};
+
 int pasr_register_mask_function(phys_addr_t addr, void *function, void *cookie)
 {
 	struct pasr_die *die = pasr_addr2die(pasr.map, addr);
@@ -155,7 +247,75 @@ int pasr_register_mask_function(phys_addr_t addr, void *function, void *cookie)
 
 int __init pasr_init_core(struct pasr_map *map)
 {
+	struct pasr_die *last = &map->die[map->nr_dies - 1];
+
+	pasr.start = map->die[0].start;
+	pasr.end = last->start +
+		((phys_addr_t)last->nr_sections << PASR_SECTION_SZ_BITS);
 	pasr.map = map;
 	return 0;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int pasr_sections_show(struct seq_file *m, void *unused)
+{
+	struct pasr_section *s;
+	int i, j;
+
+	seq_printf(m, "die  start       free_kb  used%%  masked  pair\n");
+	for_each_pasr_section(i, j, (*pasr.map), s) {
+		unsigned long free = s->free_size;
+
+		seq_printf(m, "%3d  %#010x  %7lu  %5lu  %6s  %4s\n",
+			i, s->start, free >> 10,
+			100 - (free >> 10) * 100 / (PASR_SECTION_SZ >> 10),
+			pasr_section_masked(s) ? "yes" : "no",
+			s->pair ? "yes" : "no");
+	}
+
+	return 0;
+}
+
+static int pasr_sections_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pasr_sections_show, inode->i_private);
+}
+
+static const struct file_operations pasr_sections_fops = {
+	.open		= pasr_sections_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init pasr_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("pasr", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return -ENOMEM;
+
+	debugfs_create_file("sections", S_IRUGO, dir, NULL,
+			&pasr_sections_fops);
+	debugfs_create_u32("mask_updates", S_IRUGO, dir, &pasr.mask_updates);
+	debugfs_create_u32("suspend_masked", S_IRUGO, dir,
+			&pasr.suspend_masked);
+
+	return 0;
+}
+#else
+static inline int pasr_debugfs_init(void) { return 0; }
+#endif /* CONFIG_DEBUG_FS */
+
+static int __init pasr_late_init(void)
+{
+	if (!pasr.map)
+		return 0;
+
+	register_syscore_ops(&pasr_syscore_ops);
+
+	return pasr_debugfs_init();
+}
+late_initcall(pasr_late_init);
+
@@ -27,6 +27,7 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
+#include <linux/workqueue.h>
 #include "tmem.h"
 
 #include "../zram/xvmalloc.h" /* if built in drivers/staging */
@@ -71,11 +72,14 @@
 
 #define ZBUD_MAX_BUDS 2
 
+#define MAX_POOLS_PER_CLIENT 16
+
 struct zbud_hdr {
 	uint32_t pool_id;
 	struct tmem_oid oid;
 	uint32_t index;
 	uint16_t size; /* compressed size in bytes, zero means unused */
+	struct list_head pool_lru; /* on zcache_pool_acct[pool_id].lru */
 	DECL_SENTINEL
 };
 
@@ -105,7 +109,27 @@ static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 struct list_head zbud_buddied_list;
 static unsigned long zcache_zbud_buddied_count;
 
-/* protects the buddied list and all unbuddied lists */
+/*
+ * Per-pool accounting.  Every zbud is also linked, oldest first, on the
+ * LRU of the pool it belongs to so that eviction can pick its victims
+ * per pool instead of scanning the global budlists.  Hits are bumped on
+ * every successful get and halved on every shrinker pass, so a pool
+ * that has not been read from recently ages towards being the coldest.
+ * A non-zero quota caps the number of compressed pages a pool may hold.
+ */
+static struct {
+	struct list_head lru;
+	atomic_t zpages;
+	unsigned long quota;
+	unsigned long hits;
+} zcache_pool_acct[MAX_POOLS_PER_CLIENT];
+
+static struct {
+	struct tmem_pool *tmem_pools[MAX_POOLS_PER_CLIENT];
+	struct xv_pool *xvpool;
+} zcache_client;
+
+/* protects the buddied list, all unbuddied lists and the pool LRUs */
 static DEFINE_SPINLOCK(zbud_budlists_spinlock);
 
 static LIST_HEAD(zbpg_unused_list);
@@ -249,6 +273,7 @@ static unsigned zbud_free(struct zbud_hdr *zh)
 	BUG_ON(!tmem_oid_valid(&zh->oid));
 	size = zh->size;
 	BUG_ON(zh->size == 0 || zh->size > zbud_max_buddy_size());
+	atomic_dec(&zcache_pool_acct[zh->pool_id].zpages);
 	zh->size = 0;
 	tmem_oid_set_invalid(&zh->oid);
 	INVERT_SENTINEL(zh, ZBH);
@@ -277,6 +302,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
 		chunks = zbud_size_to_chunks(size) ;
 		spin_lock(&zbud_budlists_spinlock);
+		list_del_init(&zh->pool_lru);
 		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
 		list_del_init(&zbpg->bud_list);
 		zbud_unbuddied[chunks].count--;
@@ -285,6 +311,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	} else { /* was buddied: move remaining buddy to unbuddied list */
 		chunks = zbud_size_to_chunks(zh_other->size) ;
 		spin_lock(&zbud_budlists_spinlock);
+		list_del_init(&zh->pool_lru);
 		list_del_init(&zbpg->bud_list);
 		zcache_zbud_buddied_count--;
 		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
@@ -353,6 +380,7 @@ init_zh:
 	zh->index = index;
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
+	list_add_tail(&zh->pool_lru, &zcache_pool_acct[pool_id].lru);
 	/* can wait to copy the data until the list locks are dropped */
 	spin_unlock(&zbud_budlists_spinlock);
 
@@ -361,6 +389,7 @@ init_zh:
 	spin_unlock(&zbpg->lock);
 	zbud_cumul_chunk_counts[nchunks]++;
 	atomic_inc(&zcache_zbud_curr_zpages);
+	atomic_inc(&zcache_pool_acct[pool_id].zpages);
 	zcache_zbud_cumul_zpages++;
 	zcache_zbud_curr_zbytes += size;
 	zcache_zbud_cumul_zbytes += size;
@@ -407,6 +436,17 @@ static unsigned long zcache_evicted_raw_pages;
 static unsigned long zcache_evicted_buddied_pages;
 static unsigned long zcache_evicted_unbuddied_pages;
 
+/* eviction reasons, counted in zpages */
+static unsigned long zcache_evicted_quota_zpages;
+static unsigned long zcache_evicted_cold_zpages;
+static unsigned long zcache_evicted_buddy_zpages;
+static unsigned long zcache_quota_rejected_puts;
+
+enum zbud_evict_reason {
+	ZBUD_EVICT_QUOTA,	/* pool is above its quota */
+	ZBUD_EVICT_COLD,	/* pool has the fewest hits per zpage */
+};
+
 static struct tmem_pool *zcache_get_pool_by_id(uint32_t poolid);
 static void zcache_put_pool(struct tmem_pool *pool);
 
@@ -423,6 +463,11 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 
 	ASSERT_SPINLOCK(&zbpg->lock);
 	BUG_ON(!list_empty(&zbpg->bud_list));
+	spin_lock(&zbud_budlists_spinlock);
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		if (zbpg->buddy[i].size)
+			list_del_init(&zbpg->buddy[i].pool_lru);
+	spin_unlock(&zbud_budlists_spinlock);
 	for (i = 0, j = 0; i < ZBUD_MAX_BUDS; i++) {
 		zh = &zbpg->buddy[i];
 		if (zh->size) {
@@ -446,6 +491,87 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	zbud_free_raw_page(zbpg);
 }
 
+/*
+ * Choose the pool to evict from: any pool above its quota first,
+ * otherwise the one with the fewest recent hits per stored zpage.
+ * Must be called with zbud_budlists_spinlock held.
+ */
+static int zbud_pick_victim_pool(enum zbud_evict_reason *reason)
+{
+	u64 zpages, hits, victim_zpages = 0, victim_hits = 0;
+	int i, victim = -1;
+
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		if (list_empty(&zcache_pool_acct[i].lru))
+			continue;
+		zpages = atomic_read(&zcache_pool_acct[i].zpages);
+		hits = zcache_pool_acct[i].hits;
+		if (zcache_pool_acct[i].quota &&
+		    zpages > zcache_pool_acct[i].quota) {
+			*reason = ZBUD_EVICT_QUOTA;
+			return i;
+		}
+		/* hits / zpages < victim_hits / victim_zpages */
+		if (victim < 0 || hits * victim_zpages < victim_hits * zpages) {
+			victim = i;
+			victim_zpages = zpages;
+			victim_hits = hits;
+		}
+	}
+	*reason = ZBUD_EVICT_COLD;
+	return victim;
+}
+
+/*
+ * Evict the oldest zbpg of a pool that can be locked without waiting.
+ * A buddy belonging to another pool goes along with it and is counted
+ * separately.  Must be called with zbud_budlists_spinlock held with bh
+ * disabled; the lock is dropped on return but bh is left disabled.
+ */
+static bool zbud_evict_pool_lru(int pool_id, enum zbud_evict_reason reason)
+{
+	struct zbud_hdr *zh, *zh0, *zh1;
+	struct zbud_page *zbpg;
+	unsigned long own = 0, other = 0;
+	int i;
+
+	list_for_each_entry(zh, &zcache_pool_acct[pool_id].lru, pool_lru) {
+		zbpg = container_of(zh, struct zbud_page,
+					buddy[zbud_budnum(zh)]);
+		if (unlikely(!spin_trylock(&zbpg->lock)))
+			continue;
+		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
+		if (zh0->size && zh1->size) {
+			zcache_zbud_buddied_count--;
+			zcache_evicted_buddied_pages++;
+		} else {
+			zbud_unbuddied[zbud_size_to_chunks(zh0->size ?
+					zh0->size : zh1->size)].count--;
+			zcache_evicted_unbuddied_pages++;
+		}
+		list_del_init(&zbpg->bud_list);
+		spin_unlock(&zbud_budlists_spinlock);
+		for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+			if (!zbpg->buddy[i].size)
+				continue;
+			if (zbpg->buddy[i].pool_id == pool_id)
+				own++;
+			else
+				other++;
+		}
+		if (reason == ZBUD_EVICT_QUOTA)
+			zcache_evicted_quota_zpages += own;
+		else
+			zcache_evicted_cold_zpages += own;
+		zcache_evicted_buddy_zpages += other;
+		/* want budlists unlocked when doing zbpg eviction */
+		zbud_evict_zbpg(zbpg);
+		return true;
+	}
+	spin_unlock(&zbud_budlists_spinlock);
+	return false;
+}
+
 /*
  * Free nr pages.  This code is funky because we want to hold the locks
  * protecting various lists for as short a time as possible, and in some
@@ -457,7 +583,9 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 static void zbud_evict_pages(int nr)
 {
 	struct zbud_page *zbpg;
-	int i;
+	enum zbud_evict_reason reason;
+	int i, pool_id;
+	bool evicted;
 
 	/* first try freeing any pages on unused list */
 retry_unused_list:
@@ -478,55 +606,79 @@ retry_unused_list:
 	}
 	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
-	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
-retry_unbud_list_i:
+	/* now evict from the pool that is over quota or coldest */
+	while (nr > 0) {
 		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
+		pool_id = zbud_pick_victim_pool(&reason);
+		if (pool_id < 0) {
 			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
+			break;
 		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
-			if (unlikely(!spin_trylock(&zbpg->lock)))
-				continue;
-			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
+		/* drops zbud_budlists_spinlock */
+		evicted = zbud_evict_pool_lru(pool_id, reason);
+		local_bh_enable();
+		if (!evicted)
+			break;
+		nr--;
+	}
+
+	/* age the pools: recent hits count more than old ones */
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++)
+		zcache_pool_acct[i].hits >>= 1;
+out:
+	return;
+}
+
+/*
+ * Ensure that memory allocation requests in zcache don't result
+ * in direct reclaim requests via the shrinker, which would cause
+ * an infinite loop.  Maybe a GFP flag would be better?
+ */
+static DEFINE_SPINLOCK(zcache_direct_reclaim_lock);
+
+/*
+ * Evict pools that are above their quota down to 7/8 of it, so that a
+ * pool hovering at its quota does not bounce between puts and evictions.
+ * Eviction can't be done from the put path itself since it flushes tmem
+ * objects while tmem_put holds a hashbucket lock.
+ */
+static void zcache_quota_work_func(struct work_struct *work)
+{
+	unsigned long quota;
+	bool evicted;
+	int i;
+
+	if (!spin_trylock(&zcache_direct_reclaim_lock))
+		return;
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		quota = zcache_pool_acct[i].quota;
+		if (quota == 0)
+			continue;
+		quota -= quota / 8;
+		while (atomic_read(&zcache_pool_acct[i].zpages) > quota) {
+			spin_lock_bh(&zbud_budlists_spinlock);
+			/* drops zbud_budlists_spinlock */
+			evicted = zbud_evict_pool_lru(i, ZBUD_EVICT_QUOTA);
 			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
+			if (!evicted)
+				break;
 		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
 	}
+	spin_unlock(&zcache_direct_reclaim_lock);
+}
 
-	/* as a last resort, free buddied pages */
-retry_bud_list:
-	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
-		if (unlikely(!spin_trylock(&zbpg->lock)))
-			continue;
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
-		/* want budlists unlocked when doing zbpg eviction */
-		zbud_evict_zbpg(zbpg);
-		local_bh_enable();
-		if (--nr <= 0)
-			goto out;
-		goto retry_bud_list;
+static DECLARE_WORK(zcache_quota_work, zcache_quota_work_func);
+
+static void zcache_pool_acct_init(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		INIT_LIST_HEAD(&zcache_pool_acct[i].lru);
+		atomic_set(&zcache_pool_acct[i].zpages, 0);
+		zcache_pool_acct[i].quota = 0;
+		zcache_pool_acct[i].hits = 0;
 	}
-	spin_unlock_bh(&zbud_budlists_spinlock);
-out:
-	return;
 }
 
 static void zbud_init(void)
@@ -582,6 +734,26 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 		chunks == 0 ? 0 : sum_total_chunks / chunks);
 	return p - buf;
 }
+
+/*
+ * One line per pool: id, zpages stored, quota (0 == none), decayed hits
+ */
+static int zcache_show_pool_quotas(char *buf)
+{
+	int i;
+	char *p = buf;
+
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		if (zcache_client.tmem_pools[i] == NULL)
+			continue;
+		p += sprintf(p, "%d %s %d %lu %lu\n", i,
+			is_ephemeral(zcache_client.tmem_pools[i]) ?
+				"eph" : "pers",
+			atomic_read(&zcache_pool_acct[i].zpages),
+			zcache_pool_acct[i].quota, zcache_pool_acct[i].hits);
+	}
+	return p - buf;
+}
 #endif
 
 /**********
@@ -677,13 +849,6 @@ static unsigned long zcache_flobj_found;
 static unsigned long zcache_failed_eph_puts;
 static unsigned long zcache_failed_pers_puts;
 
-#define MAX_POOLS_PER_CLIENT 16
-
-static struct {
-	struct tmem_pool *tmem_pools[MAX_POOLS_PER_CLIENT];
-	struct xv_pool *xvpool;
-} zcache_client;
-
 /*
  * Tmem operations assume the poolid implies the invoking client.
  * Zcache only has one client (the kernel itself), so translate
@@ -716,12 +881,6 @@ static unsigned long zcache_put_to_flush;
 static unsigned long zcache_aborted_preload;
 static unsigned long zcache_aborted_shrink;
 
-/*
- * Ensure that memory allocation requests in zcache don't result
- * in direct reclaim requests via the shrinker, which would cause
- * an infinite loop.  Maybe a GFP flag would be better?
- */
-static DEFINE_SPINLOCK(zcache_direct_reclaim_lock);
 
 /*
  * for now, used named slabs so can easily track usage; later can
@@ -908,7 +1067,16 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 	size_t clen;
 	int ret;
 	bool ephemeral = is_ephemeral(pool);
-	unsigned long count;
+	unsigned long count, quota;
+
+	quota = zcache_pool_acct[pool->pool_id].quota;
+	if (quota && atomic_read(&zcache_pool_acct[pool->pool_id].zpages)
+								>= quota) {
+		zcache_quota_rejected_puts++;
+		if (ephemeral)
+			schedule_work(&zcache_quota_work);
+		goto out;
+	}
 
 	if (ephemeral) {
 		ret = zcache_compress(page, &cdata, &clen);
@@ -946,6 +1114,7 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 						oid, index, cdata, clen);
 		if (pampd == NULL)
 			goto out;
+		atomic_inc(&zcache_pool_acct[pool->pool_id].zpages);
 		count = atomic_inc_return(&zcache_curr_pers_pampd_count);
 		if (count > zcache_curr_pers_pampd_count_max)
 			zcache_curr_pers_pampd_count_max = count;
@@ -982,6 +1151,7 @@ static void zcache_pampd_free(void *pampd, struct tmem_pool *pool)
 		BUG_ON(atomic_read(&zcache_curr_eph_pampd_count) < 0);
 	} else {
 		zv_free(zcache_client.xvpool, (struct zv_hdr *)pampd);
+		atomic_dec(&zcache_pool_acct[pool->pool_id].zpages);
 		atomic_dec(&zcache_curr_pers_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_pers_pampd_count) < 0);
 	}
@@ -1122,6 +1292,10 @@ ZCACHE_SYSFS_RO(put_to_flush);
 ZCACHE_SYSFS_RO(aborted_preload);
 ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
+ZCACHE_SYSFS_RO(evicted_quota_zpages);
+ZCACHE_SYSFS_RO(evicted_cold_zpages);
+ZCACHE_SYSFS_RO(evicted_buddy_zpages);
+ZCACHE_SYSFS_RO(quota_rejected_puts);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
@@ -1131,6 +1305,37 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
 
+/* write "<pool_id> <max zpages>" to set a pool quota, 0 removes it */
+static ssize_t zcache_pool_quotas_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return zcache_show_pool_quotas(buf);
+}
+
+static ssize_t zcache_pool_quotas_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned int pool_id;
+	unsigned long quota;
+
+	if (sscanf(buf, "%u %lu", &pool_id, &quota) != 2)
+		return -EINVAL;
+	if (pool_id >= MAX_POOLS_PER_CLIENT ||
+	    zcache_client.tmem_pools[pool_id] == NULL)
+		return -EINVAL;
+	zcache_pool_acct[pool_id].quota = quota;
+	if (quota && is_ephemeral(zcache_client.tmem_pools[pool_id]))
+		schedule_work(&zcache_quota_work);
+	return count;
+}
+
+static struct kobj_attribute zcache_pool_quotas_attr = {
+	.attr = { .name = "pool_quotas", .mode = 0644 },
+	.show = zcache_pool_quotas_show,
+	.store = zcache_pool_quotas_store,
+};
+
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
 	&zcache_curr_obj_count_max_attr.attr,
@@ -1160,6 +1365,11 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_evicted_quota_zpages_attr.attr,
+	&zcache_evicted_cold_zpages_attr.attr,
+	&zcache_evicted_buddy_zpages_attr.attr,
+	&zcache_quota_rejected_puts_attr.attr,
+	&zcache_pool_quotas_attr.attr,
 	NULL,
 };
 
@@ -1256,6 +1466,8 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, page);
+		if (ret == 0)
+			zcache_pool_acct[pool_id].hits++;
 		zcache_put_pool(pool);
 	}
 	local_irq_restore(flags);
@@ -1348,6 +1560,8 @@ static int zcache_new_pool(uint32_t flags)
 	atomic_set(&pool->refcount, 0);
 	pool->client = &zcache_client;
 	pool->pool_id = poolid;
+	zcache_pool_acct[poolid].quota = 0;
+	zcache_pool_acct[poolid].hits = 0;
 	tmem_new_pool(pool, flags);
 	zcache_client.tmem_pools[poolid] = pool;
 	pr_info("zcache: created %s tmem pool, id=%d\n",
@@ -1603,6 +1817,7 @@ static int __init zcache_init(void)
 		goto out;
 	}
 #endif /* CONFIG_SYSFS */
+	zcache_pool_acct_init();
 #if defined(CONFIG_CLEANCACHE) || defined(CONFIG_FRONTSWAP)
 	if (zcache_enabled) {
 		unsigned int cpu;
@@ -30,8 +30,10 @@
 #include <linux/highmem.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -39,6 +41,9 @@
 static int zram_major;
 struct zram *devices;
 
+/* Workers compressing bios queued by the async write path */
+static struct workqueue_struct *zram_async_wq;
+
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
@@ -177,6 +182,19 @@ out:
 	zram->table[index].offset = 0;
 }
 
+/*
+ * Frees whatever is stored at index. Writes compress outside zram->lock,
+ * so they call this again once they retake it, right before storing.
+ *
+ * Caller must hold zram->lock.
+ */
+static void zram_free_slot(struct zram *zram, u32 index)
+{
+	if (zram->table[index].page ||
+			zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
+}
+
 static void handle_zero_page(struct page *page)
 {
 	void *user_mem;
@@ -279,11 +297,26 @@ out:
 	bio_io_error(bio);
 }
 
+static struct zram_workspace *zram_get_workspace(struct zram *zram)
+{
+	struct zram_workspace *ws;
+
+	ws = per_cpu_ptr(zram->workspace, raw_smp_processor_id());
+	mutex_lock(&ws->lock);
+	return ws;
+}
+
+static void zram_put_workspace(struct zram_workspace *ws)
+{
+	mutex_unlock(&ws->lock);
+}
+
 static void zram_write(struct zram *zram, struct bio *bio)
 {
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_workspace *ws;
 
 	zram_stat64_inc(zram, &zram->stats.num_writes);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
@@ -297,40 +330,49 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
 
 		/*
 		 * System overwrites unused sectors. Free memory associated
 		 * with this sector now.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
 		mutex_lock(&zram->lock);
+		zram_free_slot(zram, index);
+		mutex_unlock(&zram->lock);
+
+		/* Compression runs outside zram->lock, on this CPU's buffers */
+		ws = zram_get_workspace(zram);
+		src = ws->buffer;
 
 		user_mem = kmap_atomic(page, KM_USER0);
 		if (page_zero_filled(user_mem)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
+			zram_put_workspace(ws);
+			mutex_lock(&zram->lock);
+			zram_free_slot(zram, index);
 			zram_stat_inc(&zram->stats.pages_zero);
 			zram_set_flag(zram, index, ZRAM_ZERO);
+			mutex_unlock(&zram->lock);
 			index++;
 			continue;
 		}
 
 		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+					ws->mem);
 
 		kunmap_atomic(user_mem, KM_USER0);
 
 		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+			zram_put_workspace(ws);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
+		mutex_lock(&zram->lock);
+
+		/* Another write may have stored this index meanwhile */
+		zram_free_slot(zram, index);
+
 		/*
 		 * Page is incompressible. Store it as-is (uncompressed)
 		 * since we do not want to return too many disk write
@@ -341,6 +383,7 @@ static void zram_write(struct zram *zram, struct bio *bio)
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
 				mutex_unlock(&zram->lock);
+				zram_put_workspace(ws);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -360,6 +403,7 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				&zram->table[index].page, &offset,
 				GFP_NOIO | __GFP_HIGHMEM)) {
 			mutex_unlock(&zram->lock);
+			zram_put_workspace(ws);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
@@ -394,6 +438,7 @@ memstore:
 			zram_stat_inc(&zram->stats.good_compress);
 
 		mutex_unlock(&zram->lock);
+		zram_put_workspace(ws);
 		index++;
 	}
 
@@ -405,6 +450,104 @@ out:
 	bio_io_error(bio);
 }
 
+/*
+ * Compress all bios queued on one CPU in a single pass. The batch
+ * latency is measured from the moment the oldest bio was queued.
+ */
+static void zram_async_work(struct work_struct *work)
+{
+	struct zram_async_queue *q =
+		container_of(work, struct zram_async_queue, work);
+	struct zram *zram = q->zram;
+	struct bio_list batch;
+	struct bio *bio;
+	ktime_t first;
+	u64 lat;
+
+	spin_lock_irq(&q->lock);
+	batch = q->bios;
+	bio_list_init(&q->bios);
+	first = q->first_queued;
+	spin_unlock_irq(&q->lock);
+
+	if (bio_list_empty(&batch))
+		return;
+
+	while ((bio = bio_list_pop(&batch))) {
+		zram_write(zram, bio);
+		atomic_dec(&zram->async_pending);
+	}
+
+	lat = ktime_to_ns(ktime_sub(ktime_get(), first));
+
+	spin_lock(&zram->stat64_lock);
+	zram->stats.async_batches++;
+	zram->stats.async_lat_total += lat;
+	if (lat > zram->stats.async_lat_max)
+		zram->stats.async_lat_max = lat;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_async_queue_bio(struct zram *zram, struct bio *bio)
+{
+	struct zram_async_queue *q;
+	unsigned long flags;
+	u32 depth;
+
+	depth = atomic_inc_return(&zram->async_pending);
+
+	q = get_cpu_ptr(zram->async_queue);
+	spin_lock_irqsave(&q->lock, flags);
+	if (bio_list_empty(&q->bios))
+		q->first_queued = ktime_get();
+	bio_list_add(&q->bios, bio);
+	spin_unlock_irqrestore(&q->lock, flags);
+	queue_work_on(smp_processor_id(), zram_async_wq, &q->work);
+	put_cpu_ptr(zram->async_queue);
+
+	spin_lock(&zram->stat64_lock);
+	zram->stats.async_bios++;
+	if (depth > zram->stats.async_depth_max)
+		zram->stats.async_depth_max = depth;
+	spin_unlock(&zram->stat64_lock);
+}
+
+/*
+ * Wait until every bio queued by the async write path is completed.
+ */
+void zram_async_flush(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->async_queue)
+		return;
+
+	for_each_possible_cpu(cpu)
+		flush_work(&per_cpu_ptr(zram->async_queue, cpu)->work);
+}
+
+static int zram_async_init(struct zram *zram)
+{
+	int cpu;
+
+	atomic_set(&zram->async_pending, 0);
+
+	zram->async_queue = alloc_percpu(struct zram_async_queue);
+	if (!zram->async_queue)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_async_queue *q = per_cpu_ptr(zram->async_queue, cpu);
+
+		spin_lock_init(&q->lock);
+		bio_list_init(&q->bios);
+		INIT_WORK(&q->work, zram_async_work);
+		q->zram = zram;
+	}
+
+	return 0;
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -446,26 +589,81 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 		break;
 
 	case WRITE:
-		zram_write(zram, bio);
+		/*
+		 * Reads stay synchronous for latency, but writes
+		 * (typically single-page swap-out from reclaim) are
+		 * handed to the workers so the submitter does not
+		 * stall on compression.
+		 */
+		if (zram->async)
+			zram_async_queue_bio(zram, bio);
+		else
+			zram_write(zram, bio);
 		break;
 	}
 
 	return 0;
 }
 
+static void zram_free_workspace(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->workspace)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_workspace *ws = per_cpu_ptr(zram->workspace, cpu);
+
+		kfree(ws->mem);
+		free_pages((unsigned long)ws->buffer, 1);
+	}
+	free_percpu(zram->workspace);
+	zram->workspace = NULL;
+}
+
+static int zram_alloc_workspace(struct zram *zram)
+{
+	int cpu;
+
+	zram->workspace = alloc_percpu(struct zram_workspace);
+	if (!zram->workspace) {
+		pr_err("Error allocating compressor workspaces\n");
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct zram_workspace *ws = per_cpu_ptr(zram->workspace, cpu);
+
+		mutex_init(&ws->lock);
+
+		ws->mem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		if (!ws->mem) {
+			pr_err("Error allocating compressor working memory!\n");
+			return -ENOMEM;
+		}
+
+		ws->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!ws->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
 
+	zram_async_flush(zram);
+
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_free_workspace(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
@@ -511,19 +709,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_workspace(zram);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -583,10 +771,19 @@ static int create_device(struct zram *zram, int device_id)
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
 
+	ret = zram_async_init(zram);
+	if (ret) {
+		pr_err("Error allocating async queues for device %d\n",
+			device_id);
+		goto out;
+	}
+
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
 		pr_err("Error allocating disk queue for device %d\n",
 			device_id);
+		free_percpu(zram->async_queue);
+		zram->async_queue = NULL;
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -598,6 +795,8 @@ static int create_device(struct zram *zram, int device_id)
 	zram->disk = alloc_disk(1);
 	if (!zram->disk) {
 		blk_cleanup_queue(zram->queue);
+		free_percpu(zram->async_queue);
+		zram->async_queue = NULL;
 		pr_warning("Error allocating disk structure for device %d\n",
 			device_id);
 		ret = -ENOMEM;
@@ -651,6 +850,10 @@ static void destroy_device(struct zram *zram)
 
 	if (zram->queue)
 		blk_cleanup_queue(zram->queue);
+
+	zram_async_flush(zram);
+	free_percpu(zram->async_queue);
+	zram->async_queue = NULL;
 }
 
 static int __init zram_init(void)
@@ -664,11 +867,19 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_async_wq = alloc_workqueue("zram",
+				WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE, 0);
+	if (!zram_async_wq) {
+		pr_warning("Unable to create async workqueue\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_wq;
 	}
 
 	if (!num_devices) {
@@ -698,6 +909,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+destroy_wq:
+	destroy_workqueue(zram_async_wq);
 out:
 	return ret;
 }
@@ -716,6 +929,7 @@ static void __exit zram_exit(void)
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_async_wq);
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
@@ -17,6 +17,9 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/bio.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 #include "xvmalloc.h"
 
@@ -96,15 +99,44 @@ struct zram_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	/* async write path */
+	u64 async_bios;		/* no. of bios handed to the workers */
+	u64 async_batches;	/* no. of worker runs */
+	u64 async_lat_total;	/* sum of batch completion latencies (ns) */
+	u64 async_lat_max;	/* worst batch completion latency (ns) */
+	u32 async_depth_max;	/* high-water mark of queued bios */
+};
+
+/*
+ * Per-CPU queue of write bios waiting to be compressed by the
+ * async workers. Bios are collected on the submitting CPU and
+ * drained in one batch by the work item bound to that CPU.
+ */
+struct zram_async_queue {
+	spinlock_t lock;
+	struct bio_list bios;
+	ktime_t first_queued;	/* enqueue time of oldest bio in batch */
+	struct work_struct work;
+	struct zram *zram;
+};
+
+/*
+ * Per-CPU compression buffers, so that writes submitted or queued on
+ * different CPUs compress in parallel. The mutex covers the rare case
+ * of a writer migrating away from, or sharing, the CPU it picked.
+ */
+struct zram_workspace {
+	struct mutex lock;
+	void *mem;	/* LZO working memory */
+	void *buffer;	/* compressed page */
 };
 
 struct zram {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zram_workspace __percpu *workspace;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
+	struct mutex lock;	/* serialize table and pool updates of
 				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
@@ -117,6 +149,11 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 
+	/* Offload writes to the per-CPU workers */
+	int async;
+	atomic_t async_pending;	/* bios queued but not yet completed */
+	struct zram_async_queue __percpu *async_queue;
+
 	struct zram_stats stats;
 };
 
@@ -128,5 +165,6 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern void zram_async_flush(struct zram *zram);
 
 #endif
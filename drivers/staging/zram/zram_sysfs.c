@@ -188,6 +188,86 @@ static ssize_t mem_used_total_show(struct device *dev,
 	return sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t async_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->async);
+}
+
+static ssize_t async_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->async = !!val;
+
+	/* Drain anything still queued so the switch takes effect now */
+	if (!zram->async)
+		zram_async_flush(zram);
+
+	return len;
+}
+
+static ssize_t async_pending_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", atomic_read(&zram->async_pending));
+}
+
+static ssize_t async_depth_max_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.async_depth_max);
+}
+
+static ssize_t async_bios_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.async_bios));
+}
+
+static ssize_t async_batches_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.async_batches));
+}
+
+static ssize_t async_lat_total_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.async_lat_total));
+}
+
+static ssize_t async_lat_max_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.async_lat_max));
+}
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
@@ -200,6 +280,13 @@ static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(async, S_IRUGO | S_IWUSR, async_show, async_store);
+static DEVICE_ATTR(async_pending, S_IRUGO, async_pending_show, NULL);
+static DEVICE_ATTR(async_depth_max, S_IRUGO, async_depth_max_show, NULL);
+static DEVICE_ATTR(async_bios, S_IRUGO, async_bios_show, NULL);
+static DEVICE_ATTR(async_batches, S_IRUGO, async_batches_show, NULL);
+static DEVICE_ATTR(async_lat_total, S_IRUGO, async_lat_total_show, NULL);
+static DEVICE_ATTR(async_lat_max, S_IRUGO, async_lat_max_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -213,6 +300,13 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_async.attr,
+	&dev_attr_async_pending.attr,
+	&dev_attr_async_depth_max.attr,
+	&dev_attr_async_bios.attr,
+	&dev_attr_async_batches.attr,
+	&dev_attr_async_lat_total.attr,
+	&dev_attr_async_lat_max.attr,
 	NULL,
 };
 
@@ -83,6 +83,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/fs_struct.h>
 #include <linux/slab.h>
+#include <linux/lowmemorykiller.h>
 #ifdef CONFIG_HARDWALL
 #include <asm/hardwall.h>
 #endif
@@ -1081,6 +1082,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_bucket_update(task->signal);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1216,6 +1219,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_bucket_update(task->signal);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
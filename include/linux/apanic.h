@@ -0,0 +1,38 @@
+/*
+ * include/linux/apanic.h
+ *
+ * Memory regions saved in Android panic dumps.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#ifndef _LINUX_APANIC_H
+#define _LINUX_APANIC_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+/*
+ * @name is at most 15 characters and shows up as /proc/apanic_<name>
+ * after the next boot.  @data is read at panic time, so it must stay
+ * valid once registered.
+ */
+struct apanic_region {
+	const char		*name;
+	const void		*data;
+	size_t			size;
+	struct list_head	list;
+};
+
+#ifdef CONFIG_APANIC
+int apanic_register_region(struct apanic_region *region);
+#else
+static inline int apanic_register_region(struct apanic_region *region)
+{
+	return 0;
+}
+#endif
+
+#endif /* _LINUX_APANIC_H */
@@ -1307,6 +1307,9 @@ struct block_device_operations {
 	int (*getgeo)(struct block_device *, struct hd_geometry *);
 	/* this callback is with swap_lock and sometimes page table lock held */
 	void (*swap_slot_free_notify) (struct block_device *, unsigned long);
+	/* polled write from panic context, with interrupts disabled */
+	int (*panic_write) (struct block_device *, sector_t, void *,
+			    unsigned int);
 	struct module *owner;
 };
 
@@ -0,0 +1,27 @@
+/*
+ * include/linux/lowmemorykiller.h
+ *
+ * Hooks used by the core kernel to keep the Android low memory killer's
+ * per-oom_adj process buckets up to date.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#ifndef _LINUX_LOWMEMORYKILLER_H
+#define _LINUX_LOWMEMORYKILLER_H
+
+struct signal_struct;
+
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_bucket_add(struct signal_struct *sig);
+extern void lowmem_bucket_del(struct signal_struct *sig);
+extern void lowmem_bucket_update(struct signal_struct *sig);
+#else
+static inline void lowmem_bucket_add(struct signal_struct *sig) { }
+static inline void lowmem_bucket_del(struct signal_struct *sig) { }
+static inline void lowmem_bucket_update(struct signal_struct *sig) { }
+#endif
+
+#endif /* _LINUX_LOWMEMORYKILLER_H */
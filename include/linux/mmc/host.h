@@ -134,6 +134,13 @@ struct mmc_host_ops {
 	void	(*enable_preset_value)(struct mmc_host *host, bool enable);
 	int	(*select_drive_strength)(unsigned int max_dtr, int host_drv, int card_drv);
 	void	(*hw_reset)(struct mmc_host *host);
+
+	/*
+	 * Optional.  Run a request to completion by polling the controller,
+	 * with interrupts disabled, for writing crash dumps at panic time.
+	 * Any request in flight is abandoned.
+	 */
+	int	(*panic_request)(struct mmc_host *host, struct mmc_request *req);
 };
 
 struct mmc_card;
@@ -15,9 +15,31 @@
 /* forward declaration */
 struct shrm_dev;
 
+/**
+ * struct shrm_l2msg - L2 message in place in a CMT->APE FIFO
+ * @data:	start of the message
+ * @len:	bytes at @data
+ * @wrap:	rest of the message at the start of the FIFO, or NULL
+ * @wrap_len:	bytes at @wrap
+ * @size:	message size
+ *
+ * The FIFO space is only given back to the modem once the receive
+ * handler returns, so the handler copies the message straight to its
+ * final destination.
+ */
+struct shrm_l2msg {
+	void *data;
+	unsigned int len;
+	void *wrap;
+	unsigned int wrap_len;
+	unsigned int size;
+};
+
 typedef void (*rx_cb)(void *data, unsigned int length);
 typedef void (*received_msg_handler)(unsigned char l2_header,
-			void *msg_ptr, unsigned int length,
-			struct shrm_dev *shrm);
+			struct shrm_l2msg *msg, struct shrm_dev *shrm);
+
+void shrm_l2msg_read(struct shrm_l2msg *msg, unsigned int offset,
+			void *buf, unsigned int len);
 
 #endif
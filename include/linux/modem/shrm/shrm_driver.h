@@ -70,6 +70,8 @@
  * @shm_common_ch_wr_kw_task:	task for writing to common channel
  * @shm_audio_ch_wr_kw:		kthread worker for writing to audio channel
  * @shm_audio_ch_wr_kw_task:	task for writing to audio channel
+ * @shm_audio_ch_rx_kw:		kthread worker for audio channel interrupts
+ * @shm_audio_ch_rx_kw_task:	task for audio channel interrupts
  * @shm_ac_wake_kw:		kthread worker for receiving ape-cmt wake requests
  * @shm_ac_wake_kw_task:	task for receiving ape-cmt wake requests
  * @shm_ca_wake_kw:		kthread worker for receiving cmt-ape wake requests
@@ -82,12 +84,20 @@
  * channel
  * @send_ac_msg_pend_notify_1:	work for handling pending message on audio
  * channel
+ * @shm_audio_rx_req:		work to receive messages on audio channel
+ * @shm_audio_read_notif:	work to handle audio channel read notification
  * @shm_ac_wake_req:		work to send ape-cmt wake request
  * @shm_ca_wake_req:		work to send cmt-ape wake request
  * @shm_ca_sleep_req:		work to send cmt-ape sleep request
  * @shm_ac_sleep_req:		work to send ape-cmt sleep request
  * @shm_mod_reset_req:		work to send a reset request to modem
  * @shm_print_dbg_info:		work function to print all prcmu/abb registers
+ * @rx_common_irqs:		common channel message pending interrupts
+ * @rx_common_read_notifs:	common channel read notifications sent
+ * @tx_common_msgs:		messages written to the common channel FIFO
+ * @tx_common_doorbells:	common channel message pending notifications
+ * @tx_audio_msgs:		messages written to the audio channel FIFO
+ * @tx_audio_doorbells:		audio channel message pending notifications
  */
 struct shrm_dev {
 	u8 ca_wake_irq;
@@ -131,6 +141,8 @@ struct shrm_dev {
 	struct task_struct *shm_common_ch_wr_kw_task;
 	struct kthread_worker shm_audio_ch_wr_kw;
 	struct task_struct *shm_audio_ch_wr_kw_task;
+	struct kthread_worker shm_audio_ch_rx_kw;
+	struct task_struct *shm_audio_ch_rx_kw_task;
 	struct kthread_worker shm_ac_wake_kw;
 	struct task_struct *shm_ac_wake_kw_task;
 	struct kthread_worker shm_ca_wake_kw;
@@ -141,12 +153,20 @@ struct shrm_dev {
 	struct task_struct *shm_mod_stuck_kw_task;
 	struct kthread_work send_ac_msg_pend_notify_0;
 	struct kthread_work send_ac_msg_pend_notify_1;
+	struct kthread_work shm_audio_rx_req;
+	struct kthread_work shm_audio_read_notif;
 	struct kthread_work shm_ac_wake_req;
 	struct kthread_work shm_ca_wake_req;
 	struct kthread_work shm_ca_sleep_req;
 	struct kthread_work shm_ac_sleep_req;
 	struct kthread_work shm_mod_reset_req;
 	struct kthread_work shm_print_dbg_info;
+	unsigned long rx_common_irqs;
+	unsigned long rx_common_read_notifs;
+	unsigned long tx_common_msgs;
+	unsigned long tx_common_doorbells;
+	unsigned long tx_audio_msgs;
+	unsigned long tx_audio_doorbells;
 };
 
 /**
@@ -193,12 +213,10 @@ struct message_queue {
  * struct isadev_context - shrm char interface context
  * @dl_queue:	structre to store the queue related info
  * @device_id:	message id(ISI, RPC, AUDIO, SECURITY)
- * @addr:	device addresses.
  */
 struct isadev_context {
 	struct message_queue dl_queue;
 	u8 device_id;
-	void *addr;
 };
 
 /**
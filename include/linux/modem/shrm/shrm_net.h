@@ -8,6 +8,8 @@
 #ifndef __SHRM_NET_H
 #define __SHRM_NET_H
 
+#include <linux/netdevice.h>
+
 #define SHRM_HLEN 1
 #define PHONET_ALEN 1
 
@@ -22,18 +24,29 @@
 #define PIPE_HDL_INDEX		10
 #define NETLINK_SHRM            20
 
+#define SHRM_NAPI_WEIGHT	64
+/* ISI messages waiting for the poll loop */
+#define SHRM_NAPI_RX_QUEUE	512
+
 /**
  * struct shrm_net_iface_priv - shrm net interface device information
  * @shrm_device:	pointer to the shrm device information structure
  * @iface_num:		flag used to indicate the up/down of netdev
+ * @napi:		NAPI context delivering received ISI messages
+ * @rx_queue:		ISI messages copied from the FIFO, not yet delivered
+ * @rx_polls:		number of NAPI poll calls
  */
 struct shrm_net_iface_priv {
 	struct shrm_dev *shrm_device;
 	unsigned int iface_num;
+	struct napi_struct napi;
+	struct sk_buff_head rx_queue;
+	unsigned long rx_polls;
 };
 
 int shrm_register_netdev(struct shrm_dev *shrm_dev_data);
-int shrm_net_receive(struct net_device *dev);
+void shrm_net_rx_schedule(struct net_device *dev);
+int shrm_net_receive_l2msg(struct net_device *dev, struct shrm_l2msg *msg);
 int shrm_suspend_netdev(struct net_device *dev);
 int shrm_resume_netdev(struct net_device *dev);
 int shrm_stop_netdev(struct net_device *dev);
@@ -60,24 +60,25 @@ typedef void (*MSG_PENDING_NOTIF)(const u32 Wptr);
  * @writer_local_wptr:	pointer to local write buffer
  * @shared_wptr:	write pointer shared by cmt and ape
  * @shared_rptr:	read pointer shared by cmt and ape
- * @availablesize:	available memory in fifo
  * @end_addr_fifo:	fifo end addr
  * @fifo_virtual_addr:	fifo virtual addr
- * @fifo_update_lock:	spin lock to update fifo.
  *
  * On writting a message to FIFO the same has to be read by the modem before
  * writing the next message to the FIFO. In oder to over come this a local
  * write and read pointer is used for internal purpose.
+ *
+ * The FIFO is single producer, single consumer and takes no lock: only the
+ * (serialized) writer moves writer_local_wptr, only the read notification
+ * tasklet moves writer_local_rptr, and the free space is derived from the
+ * two.
  */
 struct fifo_write_params {
 	u32 writer_local_rptr;
 	u32 writer_local_wptr;
 	u32 shared_wptr;
 	u32 shared_rptr;
-	u32 availablesize;
 	u32 end_addr_fifo;
 	u32 *fifo_virtual_addr;
-	spinlock_t fifo_update_lock;
 } ;
 
 /**
@@ -101,26 +102,44 @@ struct fifo_read_params{
 
 } ;
 
+/**
+ * struct shrm_tx_src - where the payload of an outgoing message comes from
+ * @copy:	copy @len bytes at @offset of the payload to @dst, returns 0
+ *		or a negative error code. Called with the FIFO lock held and
+ *		must not sleep.
+ * @data:	cookie for @copy
+ *
+ * Lets the writer copy a fragmented payload (skb, user iovec) directly
+ * into the FIFO instead of staging it in a linear kernel buffer.
+ */
+struct shrm_tx_src {
+	int (*copy)(void *dst, struct shrm_tx_src *src, u32 offset, u32 len);
+	void *data;
+};
+
 int shrm_protocol_init(struct shrm_dev *shrm,
 			received_msg_handler common_rx_handler,
 			received_msg_handler audio_rx_handler);
 void shrm_protocol_deinit(struct shrm_dev *shrm);
 void shm_fifo_init(struct shrm_dev *shrm);
 int shm_write_msg_to_fifo(struct shrm_dev *shrm, u8 channel,
-				u8 l2header, void *addr, u32 length);
+			u8 l2header, struct shrm_tx_src *src, u32 length);
 int shm_write_msg(struct shrm_dev *shrm,
 			u8 l2_header, void *addr, u32 length);
+int shm_write_msg_src(struct shrm_dev *shrm,
+			u8 l2_header, struct shrm_tx_src *src, u32 length);
 
 u8 is_the_only_one_unread_message(struct shrm_dev *shrm,
 						u8 channel, u32 length);
+u32 shm_fifo_unpublished(u8 channel);
 u8 read_remaining_messages_common(void);
 u8 read_remaining_messages_audio(void);
-u8 read_one_l2msg_audio(struct shrm_dev *shrm,
-			u8 *p_l2_msg, u32 *p_len);
-u8 read_one_l2msg_common(struct shrm_dev *shrm,
-				u8 *p_l2_msg, u32 *p_len);
+u8 read_one_l2msg_audio(struct shrm_dev *shrm, struct shrm_l2msg *msg);
+u8 read_one_l2msg_common(struct shrm_dev *shrm, struct shrm_l2msg *msg);
+void consume_one_l2msg_audio(struct shrm_dev *shrm, struct shrm_l2msg *msg);
+void consume_one_l2msg_common(struct shrm_dev *shrm, struct shrm_l2msg *msg);
 void receive_messages_common(struct shrm_dev *shrm);
-void receive_messages_audio(struct shrm_dev *shrm);
+void receive_messages_audio(struct shrm_dev *shrm, ktime_t irq_stamp);
 
 void update_ac_common_local_rptr(struct shrm_dev *shrm);
 void update_ac_audio_local_rptr(struct shrm_dev *shrm);
@@ -159,9 +178,7 @@ irqreturn_t ca_msg_pending_notif_0_irq_handler(int irq, void *ctrlr);
 irqreturn_t ca_msg_pending_notif_1_irq_handler(int irq, void *ctrlr);
 
 void shm_ca_msgpending_0_tasklet(unsigned long);
-void shm_ca_msgpending_1_tasklet(unsigned long);
 void shm_ac_read_notif_0_tasklet(unsigned long);
-void shm_ac_read_notif_1_tasklet(unsigned long);
 void shm_ca_wake_req_tasklet(unsigned long);
 
 u8 get_boot_state(void);
@@ -180,4 +197,31 @@ void shrm_char_reset_queues(struct shrm_dev *shrm);
 int shrm_get_cdev_index(u8 l2_header);
 int shrm_get_cdev_l2header(u8 idx);
 
+/* shrm link statistics, see shrm_debug.c */
+enum shrm_stat_fifo {
+	SHRM_AC_COMMON_FIFO,
+	SHRM_AC_AUDIO_FIFO,
+	SHRM_CA_COMMON_FIFO,
+	SHRM_CA_AUDIO_FIFO,
+	SHRM_NR_FIFOS
+};
+
+enum shrm_stat_handshake {
+	SHRM_AC_WAKE,
+	SHRM_AC_SLEEP,
+	SHRM_CA_WAKE,
+	SHRM_CA_SLEEP,
+	SHRM_NR_HANDSHAKES
+};
+
+void shrm_stats_tx(u8 l2_header, u32 len);
+void shrm_stats_rx(u8 l2_header, u32 len);
+void shrm_stats_fifo_level(enum shrm_stat_fifo fifo, u32 words);
+void shrm_stats_fifo_full(u8 channel);
+void shrm_stats_fifo_drained(void);
+void shrm_stats_handshake(enum shrm_stat_handshake hs, ktime_t start);
+void shrm_stats_audio_rx(ktime_t irq_stamp);
+void shrm_debugfs_init(struct shrm_dev *shrm);
+void shrm_debugfs_exit(void);
+
 #endif
@@ -112,20 +112,41 @@ void pasr_put(phys_addr_t paddr, unsigned long size);
 void pasr_get(phys_addr_t paddr, unsigned long size);
 
 
+/**
+ * pasr_put_deferred()
+ *
+ * @paddr: Physical address of the freed memory chunk.
+ * @size: Size of the freed memory chunk.
+ *
+ * Same accounting as pasr_put(), but a section that becomes entirely free
+ * is only masked off at suspend time. This is meant for the page allocator,
+ * where pages come and go far too often to update the DDR mask each time.
+ */
+void pasr_put_deferred(phys_addr_t paddr, unsigned long size);
+
+/**
+ * pasr_mostly_free()
+ *
+ * @paddr: Physical address to look up.
+ *
+ * Returns non-zero if the section holding @paddr is mostly free, so that
+ * allocators can steer new allocations away from it and let it drain.
+ */
+int pasr_mostly_free(phys_addr_t paddr);
+
 static inline void pasr_kput(struct page *page, int order)
 {
-	if (order != MAX_ORDER - 1)
-		return;
-
-	pasr_put(page_to_phys(page), PAGE_SIZE << (MAX_ORDER - 1));
+	pasr_put_deferred(page_to_phys(page), PAGE_SIZE << order);
 }
 
 static inline void pasr_kget(struct page *page, int order)
 {
-	if (order != MAX_ORDER - 1)
-		return;
+	pasr_get(page_to_phys(page), PAGE_SIZE << order);
+}
 
-	pasr_get(page_to_phys(page), PAGE_SIZE << (MAX_ORDER - 1));
+static inline int pasr_kfree_to_tail(struct page *page)
+{
+	return pasr_mostly_free(page_to_phys(page));
 }
 
 int __init early_pasr_setup(void);
@@ -135,6 +156,7 @@ int __init pasr_init_core(struct pasr_map *);
 #else
 #define pasr_kput(page, order) do {} while (0)
 #define pasr_kget(page, order) do {} while (0)
+#define pasr_kfree_to_tail(page) 0
 
 #define pasr_put(paddr, size) do {} while (0)
 #define pasr_get(paddr, size) do {} while (0)
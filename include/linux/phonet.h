@@ -38,6 +38,7 @@
 #define PNPIPE_IFINDEX		2
 #define PNPIPE_HANDLE		3
 #define PNPIPE_INITSTATE	4
+#define PNPIPE_MULTI		5
 
 #define PNADDR_ANY		0
 #define PNADDR_BROADCAST	0xFC
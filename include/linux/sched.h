@@ -648,6 +648,9 @@ struct signal_struct {
 	int oom_score_adj;	/* OOM kill score adjustment */
 	int oom_score_adj_min;	/* OOM kill score adjustment minimum value.
 				 * Only settable by CAP_SYS_RESOURCE. */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_node;	/* on lowmem killer oom_adj bucket */
+#endif
 
 	struct mutex cred_guard_mutex;	/* guard against foreign influences on
 					 * credential calculations
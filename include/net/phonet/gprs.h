@@ -27,9 +27,11 @@
 
 struct sock;
 struct sk_buff;
+struct sk_buff_head;
 
 int pep_writeable(struct sock *sk);
 int pep_write(struct sock *sk, struct sk_buff *skb);
+int pep_write_multi(struct sock *sk, struct sk_buff_head *queue);
 struct sk_buff *pep_read(struct sock *sk);
 
 int gprs_attach(struct sock *sk);
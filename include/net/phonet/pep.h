@@ -44,6 +44,14 @@ struct pep_sock {
 	u8			tx_fc;	/* TX flow control */
 	u8			init_enable;	/* auto-enable at creation */
 	u8			aligned;
+	u8			tx_multi;	/* peer's packets per message */
+	u8			init_multi;	/* offer multi-packet data */
+
+	/* Pipe data messages, to compare with the packet counts */
+	unsigned long		tx_msgs;
+	unsigned long		tx_multi_msgs;
+	unsigned long		rx_msgs;
+	unsigned long		rx_multi_msgs;
 };
 
 static inline struct pep_sock *pep_sk(struct sock *sk)
@@ -75,6 +83,21 @@ static inline struct pnpipehdr *pnp_hdr(struct sk_buff *skb)
 
 #define MAX_PNPIPE_HEADER (MAX_PHONET_HEADER + 4)
 
+/*
+ * PNS_PIPE_MULTI_DATA carries several packets in one pipe message. The
+ * pipe header's fourth byte holds the packet count, and each packet is
+ * preceded by this record header and padded to 32 bits. It is only sent
+ * to a peer that advertised PN_PIPE_SB_MULTI_DATA when the pipe was
+ * connected, with the number of packets per message it accepts.
+ */
+struct pnpipe_multi_rec {
+	__be16			length;
+	u8			reserved[2];
+};
+
+#define PNPIPE_MULTI_MAX	8	/* packets per message we accept */
+#define PNPIPE_MULTI_MAX_LEN	8192	/* bytes per message we send */
+
 enum {
 	PNS_PIPE_CREATE_REQ = 0x00,
 	PNS_PIPE_CREATE_RESP,
@@ -83,6 +106,7 @@ enum {
 
 	PNS_PIPE_DATA = 0x20,
 	PNS_PIPE_ALIGNED_DATA,
+	PNS_PIPE_MULTI_DATA,
 
 	PNS_PEP_CONNECT_REQ = 0x40,
 	PNS_PEP_CONNECT_RESP,
@@ -145,6 +169,7 @@ enum {
 	PN_PIPE_SB_REQUIRED_FC_TX,
 	PN_PIPE_SB_PREFERRED_FC_RX,
 	PN_PIPE_SB_ALIGNED_DATA,
+	PN_PIPE_SB_MULTI_DATA,
 };
 
 /* Phonet pipe flow control models */
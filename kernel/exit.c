@@ -51,6 +51,7 @@
 #include <trace/events/sched.h>
 #include <linux/hw_breakpoint.h>
 #include <linux/oom.h>
+#include <linux/lowmemorykiller.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -973,6 +974,7 @@ NORET_TYPE void do_exit(long code)
 		exit_itimers(tsk->signal);
 		if (tsk->mm)
 			setmax_mm_hiwater_rss(&tsk->signal->maxrss, tsk->mm);
+		lowmem_bucket_del(tsk->signal);
 	}
 	acct_collect(code, group_dead);
 	if (group_dead)
@@ -27,6 +27,9 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,8 +40,11 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its `mutex'; `lru' by `ashmem_lru_lock'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
+ *
+ * Lock Ordering: asma->mutex -> i_mutex -> i_alloc_sem
+ *                asma->mutex -> ashmem_lru_lock
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
@@ -46,15 +52,17 @@ struct ashmem_area {
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	struct mutex mutex;		/* protects all of the above */
+	struct list_head lru;		/* entry in LRU list, if lru_pages */
+	unsigned long lru_pages;	/* unpinned pages not yet purged */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex'
  */
 struct ashmem_range {
-	struct list_head lru;		/* entry in LRU list */
 	struct list_head unpinned;	/* entry in its area's unpinned list */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
@@ -62,18 +70,23 @@ struct ashmem_range {
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/*
+ * LRU list of areas with unpinned pages, least recently unpinned first,
+ * protected by ashmem_lru_lock
+ */
 static LIST_HEAD(ashmem_lru_list);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
-static unsigned long lru_count;
+/* Count of unpinned pages in the areas on our LRU list */
+static atomic_long_t lru_count = ATOMIC_LONG_INIT(0);
 
-/*
- * ashmem_mutex - protects the list of and each individual ashmem_area
- *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
- */
-static DEFINE_MUTEX(ashmem_mutex);
+/* Statistics, exported as read-only module parameters */
+static atomic_long_t ashmem_pin_count = ATOMIC_LONG_INIT(0);
+static atomic_long_t ashmem_unpin_count = ATOMIC_LONG_INIT(0);
+static atomic_long_t ashmem_reclaim_count = ATOMIC_LONG_INIT(0);
+static atomic_long_t ashmem_reclaim_pages = ATOMIC_LONG_INIT(0);
+static atomic_long_t ashmem_reclaim_latency_us = ATOMIC_LONG_INIT(0);
+static atomic_long_t ashmem_reclaim_max_latency_us = ATOMIC_LONG_INIT(0);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -104,14 +117,30 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
-	list_add_tail(&range->lru, &ashmem_lru_list);
-	lru_count += range_size(range);
+	range->asma->lru_pages += range_size(range);
+	atomic_long_add(range_size(range), &lru_count);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
-	list_del(&range->lru);
-	lru_count -= range_size(range);
+	range->asma->lru_pages -= range_size(range);
+	atomic_long_sub(range_size(range), &lru_count);
+}
+
+/*
+ * area_lru_update - puts 'asma' on or takes it off the LRU list to match
+ * its unpinned pages. 'touch' makes it the most recently unpinned area.
+ *
+ * Caller must hold asma->mutex.
+ */
+static void area_lru_update(struct ashmem_area *asma, bool touch)
+{
+	spin_lock(&ashmem_lru_lock);
+	if (!asma->lru_pages)
+		list_del_init(&asma->lru);
+	else if (touch || list_empty(&asma->lru))
+		list_move_tail(&asma->lru, &ashmem_lru_list);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /*
@@ -123,7 +152,7 @@ static inline void lru_del(struct ashmem_range *range)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
@@ -159,7 +188,7 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +198,10 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
-		lru_count -= pre - range_size(range);
+	if (range_on_lru(range)) {
+		range->asma->lru_pages -= pre - range_size(range);
+		atomic_long_sub(pre - range_size(range), &lru_count);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -187,6 +218,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	INIT_LIST_HEAD(&asma->lru);
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -199,10 +232,15 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	/*
+	 * The shrinker only trylocks areas it finds on the LRU list, so once
+	 * we are off it under our mutex nobody else can get at us.
+	 */
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	area_lru_update(asma, false);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +255,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +276,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -247,7 +285,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +306,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -285,7 +323,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +366,70 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+static void ashmem_truncate(struct inode *inode, size_t pgstart, size_t pgend)
+{
+	vmtruncate_range(inode, pgstart * PAGE_SIZE,
+			 (pgend + 1) * PAGE_SIZE - 1);
+	atomic_long_inc(&ashmem_reclaim_count);
+}
+
+/*
+ * ashmem_area_reclaim - purges all unpinned pages of 'asma', truncating
+ * runs of adjacent ranges with a single call. Returns the number of pages
+ * that were on the LRU.
+ *
+ * Caller must hold asma->mutex.
+ */
+static unsigned long ashmem_area_reclaim(struct ashmem_area *asma)
+{
+	struct inode *inode = asma->file->f_dentry->d_inode;
+	struct ashmem_range *range;
+	unsigned long freed = asma->lru_pages;
+	size_t start = 0, end = 0;
+	bool batch = false;
+
+	/* unpinned_list is sorted by descending page */
+	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+		/* an already purged range may extend a run, not start one */
+		if (!batch || range->pgend + 1 != start) {
+			if (batch)
+				ashmem_truncate(inode, start, end);
+			batch = false;
+			end = range->pgend;
+		}
+		start = range->pgstart;
+
+		if (range_on_lru(range)) {
+			batch = true;
+			lru_del(range);
+			range->purged = ASHMEM_WAS_PURGED;
+		}
+	}
+	if (batch)
+		ashmem_truncate(inode, start, end);
+
+	return freed;
+}
+
+static void ashmem_reclaim_account(unsigned long pages, ktime_t start)
+{
+	long us = ktime_us_delta(ktime_get(), start);
+	long max;
+
+	atomic_long_add(pages, &ashmem_reclaim_pages);
+	atomic_long_set(&ashmem_reclaim_latency_us, us);
+	do {
+		max = atomic_long_read(&ashmem_reclaim_max_latency_us);
+		if (us <= max)
+			break;
+	} while (atomic_long_cmpxchg(&ashmem_reclaim_max_latency_us,
+				     max, us) != max);
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -343,37 +441,53 @@ out:
  * Return value is the number of objects (pages) remaining, or -1 if we cannot
  * proceed without risk of deadlock (due to gfp_mask).
  *
- * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * We approximate LRU via least-recently-unpinned, jettisoning all unpinned
+ * pages of one area at a time until we hit 'nr_to_scan' pages freed. Areas
+ * whose mutex is held, possibly by the allocation that got us here, are
+ * skipped.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_area *asma;
+	unsigned long freed = 0;
+	long nr_to_scan = sc->nr_to_scan;
+	ktime_t start;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
 	if (!sc->nr_to_scan)
-		return lru_count;
+		return atomic_long_read(&lru_count);
+
+	start = ktime_get();
+	spin_lock(&ashmem_lru_lock);
+	while (nr_to_scan > 0 && !list_empty(&ashmem_lru_list)) {
+		unsigned long pages;
+
+		asma = list_first_entry(&ashmem_lru_list, struct ashmem_area,
+					lru);
+		list_move_tail(&asma->lru, &ashmem_lru_list);
+		if (!mutex_trylock(&asma->mutex)) {
+			/* count it as scanned so that we cannot spin here */
+			nr_to_scan -= max(1UL, ACCESS_ONCE(asma->lru_pages));
+			continue;
+		}
+		spin_unlock(&ashmem_lru_lock);
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+		pages = ashmem_area_reclaim(asma);
+		area_lru_update(asma, false);
+		mutex_unlock(&asma->mutex);
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		freed += pages;
+		nr_to_scan -= pages;
+		spin_lock(&ashmem_lru_lock);
 	}
-	mutex_unlock(&ashmem_mutex);
+	spin_unlock(&ashmem_lru_lock);
+
+	if (freed)
+		ashmem_reclaim_account(freed, start);
 
-	return lru_count;
+	return atomic_long_read(&lru_count);
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -385,7 +499,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +514,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -408,7 +522,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +536,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -431,7 +545,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,7 +562,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -457,7 +571,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -523,7 +637,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -558,7 +672,7 @@ restart:
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -607,21 +721,25 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
+		atomic_long_inc(&ashmem_pin_count);
 		ret = ashmem_pin(asma, pgstart, pgend);
+		area_lru_update(asma, false);
 		break;
 	case ASHMEM_UNPIN:
+		atomic_long_inc(&ashmem_unpin_count);
 		ret = ashmem_unpin(asma, pgstart, pgend);
+		area_lru_update(asma, true);
 		break;
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_get_pin_status(asma, pgstart, pgend);
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -742,6 +860,32 @@ static void __exit ashmem_exit(void)
 	printk(KERN_INFO "ashmem: unloaded\n");
 }
 
+static int ashmem_stat_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%ld", atomic_long_read(kp->arg));
+}
+
+static int ashmem_stat_set(const char *val, const struct kernel_param *kp)
+{
+	return -EPERM;
+}
+
+static struct kernel_param_ops ashmem_stat_ops = {
+	.set = ashmem_stat_set,
+	.get = ashmem_stat_get,
+};
+
+module_param_cb(pin_count, &ashmem_stat_ops, &ashmem_pin_count, S_IRUGO);
+module_param_cb(unpin_count, &ashmem_stat_ops, &ashmem_unpin_count, S_IRUGO);
+module_param_cb(reclaim_count, &ashmem_stat_ops, &ashmem_reclaim_count,
+		S_IRUGO);
+module_param_cb(reclaim_pages, &ashmem_stat_ops, &ashmem_reclaim_pages,
+		S_IRUGO);
+module_param_cb(reclaim_latency_us, &ashmem_stat_ops,
+		&ashmem_reclaim_latency_us, S_IRUGO);
+module_param_cb(reclaim_max_latency_us, &ashmem_stat_ops,
+		&ashmem_reclaim_max_latency_us, S_IRUGO);
+
 module_init(ashmem_init);
 module_exit(ashmem_exit);
 
@@ -544,6 +544,17 @@ static inline void __free_one_page(struct page *page,
 	}
 	set_page_order(page, order);
 
+	/*
+	 * Pages of a mostly free PASR section go to the tail so that they
+	 * are allocated last and the section gets a chance to drain and be
+	 * put out of self-refresh.
+	 */
+	if (pasr_kfree_to_tail(page)) {
+		list_add_tail(&page->lru,
+			&zone->free_area[order].free_list[migratetype]);
+		goto out;
+	}
+
 	/*
 	 * If this is not the largest possible page, check if the buddy
 	 * of the next-highest order is free. If it is, it's possible
@@ -765,7 +776,7 @@ static inline void expand(struct zone *zone, struct page *page,
 		VM_BUG_ON(bad_range(zone, &page[size]));
 		list_add(&page[size].lru, &area->free_list[migratetype]);
 		area->nr_free++;
-		pasr_kput(page, high);
+		pasr_kput(&page[size], high);
 		set_page_order(&page[size], high);
 	}
 }
@@ -26,10 +26,14 @@
 #include <linux/netdevice.h>
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
+#include <linux/ethtool.h>
 #include <net/sock.h>
 
+#include <linux/phonet.h>
 #include <linux/if_phonet.h>
 #include <net/tcp_states.h>
+#include <net/phonet/phonet.h>
+#include <net/phonet/pep.h>
 #include <net/phonet/gprs.h>
 
 #define GPRS_DEFAULT_MTU 1400
@@ -41,6 +45,8 @@ struct gprs_dev {
 	void			(*old_write_space)(struct sock *);
 
 	struct net_device	*dev;
+	/* packets waiting for TX credits, sent as one message if possible */
+	struct sk_buff_head	tx_queue;
 };
 
 static __be16 gprs_type_trans(struct sk_buff *skb)
@@ -61,12 +67,70 @@ static __be16 gprs_type_trans(struct sk_buff *skb)
 	return htons(0);
 }
 
+/* How many packets to hold back before stopping the device queue */
+static unsigned int gprs_tx_limit(struct gprs_dev *gp)
+{
+	return max_t(unsigned int, pep_sk(gp->sk)->tx_multi, 1);
+}
+
+/*
+ * Send the queued packets while the pipe has credits, batching as many
+ * as the peer accepts into each message. tx_queue lock must be held.
+ */
+static void gprs_tx_flush(struct gprs_dev *gp)
+{
+	struct net_device *dev = gp->dev;
+	struct sock *sk = gp->sk;
+	unsigned int limit = gprs_tx_limit(gp);
+
+	while (!skb_queue_empty(&gp->tx_queue) && pep_writeable(sk)) {
+		struct sk_buff_head batch;
+		struct sk_buff *skb;
+		unsigned int size = 0, len = 0, n;
+		int err;
+
+		__skb_queue_head_init(&batch);
+		while ((skb = skb_peek(&gp->tx_queue)) != NULL) {
+			unsigned int rec = sizeof(struct pnpipe_multi_rec) +
+						ALIGN(skb->len, 4);
+
+			if (skb_queue_len(&batch) == limit ||
+			    (size + rec > PNPIPE_MULTI_MAX_LEN &&
+			     !skb_queue_empty(&batch)))
+				break;
+			__skb_unlink(skb, &gp->tx_queue);
+			__skb_queue_tail(&batch, skb);
+			size += rec;
+			len += skb->len;
+		}
+
+		n = skb_queue_len(&batch);
+		if (n == 1)
+			err = pep_write(sk, __skb_dequeue(&batch));
+		else
+			err = pep_write_multi(sk, &batch);
+		if (err) {
+			LIMIT_NETDEBUG(KERN_WARNING"%s: TX error (%d)\n",
+					dev->name, err);
+			dev->stats.tx_aborted_errors++;
+			dev->stats.tx_errors += n;
+		} else {
+			dev->stats.tx_packets += n;
+			dev->stats.tx_bytes += len;
+		}
+	}
+}
+
 static void gprs_writeable(struct gprs_dev *gp)
 {
 	struct net_device *dev = gp->dev;
 
-	if (pep_writeable(gp->sk))
+	spin_lock_bh(&gp->tx_queue.lock);
+	gprs_tx_flush(gp);
+	if (pep_writeable(gp->sk) &&
+	    skb_queue_len(&gp->tx_queue) < gprs_tx_limit(gp))
 		netif_wake_queue(dev);
+	spin_unlock_bh(&gp->tx_queue.lock);
 }
 
 /*
@@ -82,6 +146,7 @@ static void gprs_state_change(struct sock *sk)
 
 		netif_stop_queue(dev);
 		netif_carrier_off(dev);
+		skb_queue_purge(&gp->tx_queue);
 	}
 }
 
@@ -179,7 +244,10 @@ static int gprs_open(struct net_device *dev)
 
 static int gprs_close(struct net_device *dev)
 {
+	struct gprs_dev *gp = netdev_priv(dev);
+
 	netif_stop_queue(dev);
+	skb_queue_purge(&gp->tx_queue);
 	return 0;
 }
 
@@ -187,7 +255,6 @@ static netdev_tx_t gprs_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct gprs_dev *gp = netdev_priv(dev);
 	struct sock *sk = gp->sk;
-	int len, err;
 
 	switch (skb->protocol) {
 	case  htons(ETH_P_IP):
@@ -200,21 +267,16 @@ static netdev_tx_t gprs_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	skb_orphan(skb);
 	skb_set_owner_w(skb, sk);
-	len = skb->len;
-	err = pep_write(sk, skb);
-	if (err) {
-		LIMIT_NETDEBUG(KERN_WARNING"%s: TX error (%d)\n",
-				dev->name, err);
-		dev->stats.tx_aborted_errors++;
-		dev->stats.tx_errors++;
-	} else {
-		dev->stats.tx_packets++;
-		dev->stats.tx_bytes += len;
-	}
 
-	netif_stop_queue(dev);
-	if (pep_writeable(sk))
-		netif_wake_queue(dev);
+	/* Packets queue up while the pipe is out of credits, and go out
+	 * together once it gets some back. */
+	spin_lock(&gp->tx_queue.lock);
+	__skb_queue_tail(&gp->tx_queue, skb);
+	gprs_tx_flush(gp);
+	if (!skb_queue_empty(&gp->tx_queue) &&
+	    skb_queue_len(&gp->tx_queue) >= gprs_tx_limit(gp))
+		netif_stop_queue(dev);
+	spin_unlock(&gp->tx_queue.lock);
 	return NETDEV_TX_OK;
 }
 
@@ -227,6 +289,54 @@ static int gprs_set_mtu(struct net_device *dev, int new_mtu)
 	return 0;
 }
 
+static const char gprs_gstrings_stats[][ETH_GSTRING_LEN] = {
+	"tx_pipe_messages",
+	"tx_multi_messages",
+	"rx_pipe_messages",
+	"rx_multi_messages",
+	"tx_multi_peer_limit",
+};
+
+static int gprs_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return ARRAY_SIZE(gprs_gstrings_stats);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void gprs_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	if (sset == ETH_SS_STATS)
+		memcpy(data, gprs_gstrings_stats, sizeof(gprs_gstrings_stats));
+}
+
+/*
+ * Pipe message counts; against the packet counts of the interface they
+ * give the aggregation ratio in each direction.
+ */
+static void gprs_get_ethtool_stats(struct net_device *dev,
+				struct ethtool_stats *stats, u64 *data)
+{
+	struct gprs_dev *gp = netdev_priv(dev);
+	struct pep_sock *pn = pep_sk(gp->sk);
+
+	data[0] = pn->tx_msgs;
+	data[1] = pn->tx_multi_msgs;
+	data[2] = pn->rx_msgs;
+	data[3] = pn->rx_multi_msgs;
+	data[4] = pn->tx_multi;
+}
+
+static const struct ethtool_ops gprs_ethtool_ops = {
+	.get_link = ethtool_op_get_link,
+	.get_sset_count = gprs_get_sset_count,
+	.get_strings = gprs_get_strings,
+	.get_ethtool_stats = gprs_get_ethtool_stats,
+};
+
 static const struct net_device_ops gprs_netdev_ops = {
 	.ndo_open	= gprs_open,
 	.ndo_stop	= gprs_close,
@@ -245,6 +355,7 @@ static void gprs_setup(struct net_device *dev)
 	dev->tx_queue_len	= 10;
 
 	dev->netdev_ops		= &gprs_netdev_ops;
+	dev->ethtool_ops	= &gprs_ethtool_ops;
 	dev->destructor		= free_netdev;
 }
 
@@ -273,6 +384,7 @@ int gprs_attach(struct sock *sk)
 	gp = netdev_priv(dev);
 	gp->sk = sk;
 	gp->dev = dev;
+	skb_queue_head_init(&gp->tx_queue);
 
 	netif_stop_queue(dev);
 	err = register_netdev(dev);
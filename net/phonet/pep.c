@@ -169,7 +169,7 @@ static int pipe_handler_send_created_ind(struct sock *sk)
 
 static int pep_accept_conn(struct sock *sk, struct sk_buff *skb)
 {
-	static const u8 data[20] = {
+	u8 data[24] = {
 		PAD, PAD, PAD, 2 /* sub-blocks */,
 		PN_PIPE_SB_REQUIRED_FC_TX, pep_sb_size(5), 3, PAD,
 			PN_MULTI_CREDIT_FLOW_CONTROL,
@@ -181,11 +181,17 @@ static int pep_accept_conn(struct sock *sk, struct sk_buff *skb)
 			PN_ONE_CREDIT_FLOW_CONTROL,
 			PN_LEGACY_FLOW_CONTROL,
 			PAD,
+		PN_PIPE_SB_MULTI_DATA, pep_sb_size(1), PNPIPE_MULTI_MAX, PAD,
 	};
+	int len = 20;
 
 	might_sleep();
-	return pep_reply(sk, skb, PN_PIPE_NO_ERROR, data, sizeof(data),
-				GFP_KERNEL);
+	/* Only answer multi-packet support to a peer that knows about it */
+	if (pep_sk(sk)->tx_multi) {
+		data[3]++;
+		len += 4;
+	}
+	return pep_reply(sk, skb, PN_PIPE_NO_ERROR, data, len, GFP_KERNEL);
 }
 
 static int pep_reject_conn(struct sock *sk, struct sk_buff *skb, u8 code,
@@ -339,6 +345,69 @@ static int pipe_rcv_created(struct sock *sk, struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Split a multi-packet pipe data message into one skb per packet and
+ * queue those. Consumes skb. Socket lock must be held.
+ */
+static int pipe_rcv_multi(struct sock *sk, struct sk_buff *skb)
+{
+	struct pep_sock *pn = pep_sk(sk);
+	struct sk_buff *pkt;
+	unsigned int count = pnp_hdr(skb)->data[0];
+	unsigned int offset = sizeof(struct pnpipehdr);
+	int queued = 0;
+
+	pn->rx_msgs++;
+	pn->rx_multi_msgs++;
+	while (count--) {
+		struct pnpipe_multi_rec *rec, buf;
+		unsigned int len;
+
+		rec = skb_header_pointer(skb, offset, sizeof(buf), &buf);
+		if (rec == NULL)
+			break;
+		len = ntohs(rec->length);
+		offset += sizeof(buf);
+		if (offset + len > skb->len)
+			break;
+
+		/* the last packet gets to keep the original skb */
+		if (count) {
+			pkt = skb_clone(skb, GFP_ATOMIC);
+			if (pkt == NULL)
+				break;
+		} else {
+			pkt = skb;
+			skb = NULL;
+		}
+		if (!pskb_pull(pkt, offset) || pskb_trim(pkt, len)) {
+			kfree_skb(pkt);
+			break;
+		}
+		offset += ALIGN(len, 4);
+
+		if (!pn_flow_safe(pn->rx_fc)) {
+			if (sock_queue_rcv_skb(sk, pkt)) {
+				atomic_inc(&sk->sk_drops);
+				kfree_skb(pkt);
+			}
+			continue;
+		}
+		pkt->dev = NULL;
+		skb_set_owner_r(pkt, sk);
+		queued += pkt->len;
+		skb_queue_tail(&sk->sk_receive_queue, pkt);
+	}
+	if (skb) {
+		/* malformed or out of memory */
+		atomic_inc(&sk->sk_drops);
+		kfree_skb(skb);
+	}
+	if (queued && !sock_flag(sk, SOCK_DEAD))
+		sk->sk_data_ready(sk, queued);
+	return NET_RX_SUCCESS;
+}
+
 /* Queue an skb to a connected sock.
  * Socket lock must be held. */
 static int pipe_do_rcv(struct sock *sk, struct sk_buff *skb)
@@ -394,11 +463,23 @@ static int pipe_do_rcv(struct sock *sk, struct sk_buff *skb)
 		queue = &pn->ctrlreq_queue;
 		goto queue;
 
+	case PNS_PIPE_MULTI_DATA:
+		if (pn_flow_safe(pn->rx_fc)) {
+			if (pn->rx_credits == 0) {
+				atomic_inc(&sk->sk_drops);
+				err = -ENOBUFS;
+				break;
+			}
+			pn->rx_credits--;
+		}
+		return pipe_rcv_multi(sk, skb);
+
 	case PNS_PIPE_ALIGNED_DATA:
 		__skb_pull(skb, 1);
 		/* fall through */
 	case PNS_PIPE_DATA:
 		__skb_pull(skb, 3); /* Pipe data header */
+		pn->rx_msgs++;
 		if (!pn_flow_safe(pn->rx_fc)) {
 			err = sock_queue_rcv_skb(sk, skb);
 			if (!err)
@@ -526,6 +607,11 @@ static int pep_connresp_rcv(struct sock *sk, struct sk_buff *skb)
 			pn->rx_fc = pipe_negotiate_fc(data + 2, len - 2);
 			break;
 
+		case PN_PIPE_SB_MULTI_DATA:
+			if (len < 1)
+				break;
+			pn->tx_multi = data[0];
+			break;
 		}
 		n_sb--;
 	}
@@ -565,11 +651,23 @@ static int pipe_handler_do_rcv(struct sock *sk, struct sk_buff *skb)
 	int err = NET_RX_SUCCESS;
 
 	switch (hdr->message_id) {
+	case PNS_PIPE_MULTI_DATA:
+		if (pn_flow_safe(pn->rx_fc)) {
+			if (pn->rx_credits == 0) {
+				atomic_inc(&sk->sk_drops);
+				err = NET_RX_DROP;
+				break;
+			}
+			pn->rx_credits--;
+		}
+		return pipe_rcv_multi(sk, skb);
+
 	case PNS_PIPE_ALIGNED_DATA:
 		__skb_pull(skb, 1);
 		/* fall through */
 	case PNS_PIPE_DATA:
 		__skb_pull(skb, 3); /* Pipe data header */
+		pn->rx_msgs++;
 		if (!pn_flow_safe(pn->rx_fc)) {
 			err = sock_queue_rcv_skb(sk, skb);
 			if (!err)
@@ -783,7 +881,7 @@ static struct sock *pep_sock_accept(struct sock *sk, int flags, int *errp)
 	int err;
 	u16 peer_type;
 	u8 pipe_handle, enabled, n_sb;
-	u8 aligned = 0;
+	u8 aligned = 0, multi = 0;
 
 	skb = skb_recv_datagram(sk, 0, flags & O_NONBLOCK, errp);
 	if (!skb)
@@ -797,7 +895,7 @@ static struct sock *pep_sock_accept(struct sock *sk, int flags, int *errp)
 	sk_acceptq_removed(sk);
 
 	err = -EPROTO;
-	if (!pskb_may_pull(skb, sizeof(*hdr) + 4))
+	if (!pskb_pull(skb, sizeof(*hdr) + 4))
 		goto drop;
 
 	hdr = pnp_hdr(skb);
@@ -831,8 +929,15 @@ static struct sock *pep_sock_accept(struct sock *sk, int flags, int *errp)
 			peer_type = (peer_type & 0xff00) | data[0];
 			break;
 		case PN_PIPE_SB_ALIGNED_DATA:
+			if (len < 1)
+				goto drop;
 			aligned = data[0] != 0;
 			break;
+		case PN_PIPE_SB_MULTI_DATA:
+			if (len < 1)
+				goto drop;
+			multi = data[0];
+			break;
 		}
 		n_sb--;
 	}
@@ -877,6 +982,7 @@ static struct sock *pep_sock_accept(struct sock *sk, int flags, int *errp)
 	newpn->rx_fc = newpn->tx_fc = PN_LEGACY_FLOW_CONTROL;
 	newpn->init_enable = enabled;
 	newpn->aligned = aligned;
+	newpn->tx_multi = multi;
 
 	err = pep_accept_conn(newsk, skb);
 	if (err) {
@@ -896,13 +1002,22 @@ static int pep_sock_connect(struct sock *sk, struct sockaddr *addr, int len)
 {
 	struct pep_sock *pn = pep_sk(sk);
 	int err;
-	u8 data[4] = { 0 /* sub-blocks */, PAD, PAD, PAD };
+	u8 data[8] = { 0, PAD, PAD, 0 /* sub-blocks */,
+		PN_PIPE_SB_MULTI_DATA, pep_sb_size(1), PNPIPE_MULTI_MAX, PAD,
+	};
+	int size = 4;
 
 	if (pn->pipe_handle == PN_PIPE_INVALID_HANDLE)
 		pn->pipe_handle = 1; /* anything but INVALID_HANDLE */
 
+	/* Modems may not know the sub-block, only offer it when asked to */
+	if (pn->init_multi) {
+		data[3]++;
+		size += 4;
+	}
+	pn->tx_multi = 0; /* until the peer says otherwise */
 	err = pipe_handler_request(sk, PNS_PEP_CONNECT_REQ,
-				pn->init_enable, data, 4);
+				pn->init_enable, data, size);
 	if (err) {
 		pn->pipe_handle = PN_PIPE_INVALID_HANDLE;
 		return err;
@@ -983,6 +1098,8 @@ static int pep_init(struct sock *sk)
 	pn->rx_fc = pn->tx_fc = PN_LEGACY_FLOW_CONTROL;
 	pn->init_enable = 1;
 	pn->aligned = 0;
+	pn->tx_multi = 0;
+	pn->init_multi = 0;
 	return 0;
 }
 
@@ -1039,6 +1156,10 @@ static int pep_setsockopt(struct sock *sk, int level, int optname,
 		pn->init_enable = !!val;
 		break;
 
+	case PNPIPE_MULTI:
+		pn->init_multi = !!val;
+		break;
+
 	default:
 		err = -ENOPROTOOPT;
 	}
@@ -1078,6 +1199,10 @@ static int pep_getsockopt(struct sock *sk, int level, int optname,
 		val = pn->init_enable;
 		break;
 
+	case PNPIPE_MULTI:
+		val = pn->init_multi;
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1116,6 +1241,8 @@ static int pipe_skb_send(struct sock *sk, struct sk_buff *skb)
 
 	if (err && pn_flow_safe(pn->tx_fc))
 		atomic_inc(&pn->tx_credits);
+	else if (!err)
+		pn->tx_msgs++;
 	return err;
 
 }
@@ -1236,6 +1363,76 @@ int pep_write(struct sock *sk, struct sk_buff *skb)
 	return pipe_skb_send(sk, rskb);
 }
 
+/*
+ * Send all the packets in queue as one pipe message. The caller keeps
+ * the batch within tx_multi packets and PNPIPE_MULTI_MAX_LEN bytes of
+ * records. Packets are consumed whether or not the message was sent.
+ */
+int pep_write_multi(struct sock *sk, struct sk_buff_head *queue)
+{
+	struct pep_sock *pn = pep_sk(sk);
+	struct pnpipehdr *ph;
+	struct sk_buff *skb, *pkt;
+	unsigned int size = 0, count = skb_queue_len(queue);
+	int err;
+
+	skb_queue_walk(queue, pkt)
+		size += sizeof(struct pnpipe_multi_rec) + ALIGN(pkt->len, 4);
+	if (count > pn->tx_multi ||
+	    size > PNPIPE_MULTI_MAX_LEN) {
+		err = -EMSGSIZE;
+		goto out;
+	}
+
+	skb = alloc_skb(MAX_PNPIPE_HEADER + size, GFP_ATOMIC);
+	if (!skb) {
+		err = -ENOMEM;
+		goto out;
+	}
+	skb_reserve(skb, MAX_PNPIPE_HEADER);
+	skb_queue_walk(queue, pkt) {
+		struct pnpipe_multi_rec *rec;
+		unsigned int len = ALIGN(pkt->len, 4);
+
+		rec = (struct pnpipe_multi_rec *)__skb_put(skb,
+							sizeof(*rec) + len);
+		rec->length = htons(pkt->len);
+		rec->reserved[0] = rec->reserved[1] = 0;
+		if (len)
+			memset((u8 *)(rec + 1) + len - 4, 0, 4);
+		skb_copy_bits(pkt, 0, rec + 1, pkt->len);
+	}
+	__skb_queue_purge(queue);
+	skb_set_owner_w(skb, sk);
+
+	if (pn_flow_safe(pn->tx_fc) &&
+	    !atomic_add_unless(&pn->tx_credits, -1, 0)) {
+		kfree_skb(skb);
+		return -ENOBUFS;
+	}
+
+	__skb_push(skb, sizeof(*ph));
+	skb_reset_transport_header(skb);
+	ph = pnp_hdr(skb);
+	ph->utid = 0;
+	ph->message_id = PNS_PIPE_MULTI_DATA;
+	ph->pipe_handle = pn->pipe_handle;
+	ph->data[0] = count;
+	err = pn_skb_send(sk, skb, NULL);
+
+	if (err) {
+		if (pn_flow_safe(pn->tx_fc))
+			atomic_inc(&pn->tx_credits);
+		return err;
+	}
+	pn->tx_msgs++;
+	pn->tx_multi_msgs++;
+	return 0;
+out:
+	__skb_queue_purge(queue);
+	return err;
+}
+
 struct sk_buff *pep_read(struct sock *sk)
 {
 	struct sk_buff *skb = skb_dequeue(&sk->sk_receive_queue);